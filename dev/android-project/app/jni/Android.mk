@@ -27,6 +27,8 @@ LOCAL_C_INCLUDES := \
 LOCAL_SRC_FILES := \
 	$(LOBSTER_PATH)/compiled_lobster/src/compiled_lobster.cpp \
     $(LOBSTER_PATH)/src/compiler.cpp \
+	$(LOBSTER_PATH)/src/anim.cpp \
+	$(LOBSTER_PATH)/src/asset.cpp \
 	$(LOBSTER_PATH)/src/audio.cpp \
 	$(LOBSTER_PATH)/src/builtins.cpp \
 	$(LOBSTER_PATH)/src/disasm.cpp \
@@ -52,6 +54,8 @@ LOCAL_SRC_FILES := \
 	$(LOBSTER_PATH)/src/sdlaudiosfxr.cpp \
 	$(LOBSTER_PATH)/src/sdlsystem.cpp \
 	$(LOBSTER_PATH)/src/simplex.cpp \
+	$(LOBSTER_PATH)/src/regex.cpp \
+	$(LOBSTER_PATH)/src/spatial.cpp \
 	$(LOBSTER_PATH)/src/stdafx.cpp \
 	$(LOBSTER_PATH)/src/tocpp.cpp \
 	$(LOBSTER_PATH)/src/vmdata.cpp \
@@ -107,6 +107,8 @@ public:
 private:
 
 	friend class b2DynamicTree;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 
 	void BufferMove(int32 proxyId);
 	void UnBufferMove(int32 proxyId);
@@ -125,6 +125,9 @@ public:
 
 private:
 
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
+
 	int32 AllocateNode();
 	void FreeNode(int32 node);
 
@@ -150,6 +150,8 @@ protected:
 	friend class b2ContactSolver;
 	friend class b2Body;
 	friend class b2Fixture;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 
 	// Flags stored in m_flags
 	enum
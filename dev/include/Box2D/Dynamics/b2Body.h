@@ -423,6 +423,8 @@ private:
 
 	friend class b2ParticleSystem;
 	friend class b2ParticleGroup;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 
 	// m_flags
 	enum
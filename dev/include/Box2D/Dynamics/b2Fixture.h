@@ -206,6 +206,8 @@ protected:
 	friend class b2World;
 	friend class b2Contact;
 	friend class b2ContactManager;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 
 	b2Fixture();
 
@@ -297,6 +297,8 @@ private:
 	friend class b2ContactManager;
 	friend class b2Controller;
 	friend class b2ParticleSystem;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 
 	void Init(const b2Vec2& gravity);
 
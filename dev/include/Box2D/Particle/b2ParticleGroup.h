@@ -262,6 +262,8 @@ public:
 private:
 
 	friend class b2ParticleSystem;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 
 	b2ParticleSystem* m_system;
 	int32 m_firstIndex, m_lastIndex;
@@ -28,6 +28,7 @@
 #include <Box2D/Collision/Shapes/b2EdgeShape.h>
 #include <Box2D/Collision/Shapes/b2ChainShape.h>
 #include <algorithm>
+#include <vector>
 
 // Define LIQUIDFUN_SIMD_TEST_VS_REFERENCE to run both SIMD and reference
 // versions, and assert that the results are identical. This is useful when
@@ -395,6 +396,7 @@ b2ParticleSystem::b2ParticleSystem(const b2ParticleSystemDef* def,
 {
 	b2Assert(def);
 	m_paused = false;
+	m_taskExecutor = NULL;
 	m_timestamp = 0;
 	m_allParticleFlags = 0;
 	m_needsUpdateAllParticleFlags = false;
@@ -1811,8 +1813,41 @@ b2ParticleSystem::GetInsideBoundsEnumerator(const b2AABB& aabb) const
 	return InsideBoundsEnumerator(lowerTag, upperTag, firstProxy, lastProxy);
 }
 
+// Below this many particles, threads cost more than they save.
+static const int32 k_minParticlesPerTask = 4096;
+
+// The amount of tasks to split work on count particles into.
+int32 b2ParticleSystem::GetTaskCount(int32 count) const
+{
+	if (!m_taskExecutor)
+	{
+		return 1;
+	}
+	return b2Max(1, b2Min(m_taskExecutor->GetThreadCount(),
+						  count / k_minParticlesPerTask));
+}
+
+// Calls fn(task, begin, end) for taskCount consecutive ranges of [0, count),
+// on the task executor if there is more than one.
+void b2ParticleSystem::ParallelFor(int32 count, int32 taskCount,
+	const std::function<void(int32, int32, int32)>& fn) const
+{
+	if (taskCount <= 1)
+	{
+		fn(0, 0, count);
+		return;
+	}
+	m_taskExecutor->Run(taskCount, [&](int32 task) {
+		fn(task, (int32)((int64)count * task / taskCount),
+		   (int32)((int64)count * (task + 1) / taskCount));
+	});
+}
+
+// Buffer is b2GrowableBuffer, or ContactVector when finding contacts on
+// multiple threads, since the block allocator is not thread-safe.
+template<typename Buffer>
 inline void b2ParticleSystem::AddContact(int32 a, int32 b,
-	b2GrowableBuffer<b2ParticleContact>& contacts) const
+	Buffer& contacts) const
 {
 	b2Vec2 d = m_positionBuffer.data[b] - m_positionBuffer.data[a];
 	float32 distBtParticlesSq = b2Dot(d, d);
@@ -1828,14 +1863,26 @@ inline void b2ParticleSystem::AddContact(int32 a, int32 b,
 	}
 }
 
-void b2ParticleSystem::FindContacts_Reference(
-	b2GrowableBuffer<b2ParticleContact>& contacts) const
+struct ContactVector
 {
-	const Proxy* beginProxy = m_proxyBuffer.Begin();
-	const Proxy* endProxy = m_proxyBuffer.End();
+	std::vector<b2ParticleContact> contacts;
 
-	contacts.SetCount(0);
-	for (const Proxy *a = beginProxy, *c = beginProxy; a < endProxy; a++)
+	b2ParticleContact& Append()
+	{
+		contacts.push_back(b2ParticleContact());
+		return contacts.back();
+	}
+};
+
+// Finds the contacts of proxies [beginRange, endRange) with the proxies after
+// them. 'c' must start at the first proxy FindContacts_Reference would have
+// it at for beginRange.
+template<typename Buffer>
+void b2ParticleSystem::FindContactsInRange(const Proxy* beginRange,
+	const Proxy* endRange, const Proxy* c, Buffer& contacts) const
+{
+	const Proxy* endProxy = m_proxyBuffer.End();
+	for (const Proxy *a = beginRange; a < endRange; a++)
 	{
 		uint32 rightTag = computeRelativeTag(a->tag, 1, 0);
 		for (const Proxy* b = a + 1; b < endProxy; b++)
@@ -1857,6 +1904,59 @@ void b2ParticleSystem::FindContacts_Reference(
 	}
 }
 
+void b2ParticleSystem::FindContacts_Reference(
+	b2GrowableBuffer<b2ParticleContact>& contacts) const
+{
+	const Proxy* beginProxy = m_proxyBuffer.Begin();
+	const Proxy* endProxy = m_proxyBuffer.End();
+
+	contacts.SetCount(0);
+	int32 taskCount = GetTaskCount(m_count);
+	if (taskCount <= 1)
+	{
+		FindContactsInRange(beginProxy, endProxy, beginProxy, contacts);
+		return;
+	}
+	// Each range gets its own contacts, which are concatenated in order, so
+	// the result is the same as when done in one go. Where the bottom row
+	// scan starts for each range is cheap to find up front.
+	std::vector<const Proxy*> bottomStart(taskCount);
+	std::vector<ContactVector> found(taskCount);
+	const Proxy* c = beginProxy;
+	for (int32 task = 0, a = 0; task < taskCount; task++)
+	{
+		int32 begin = (int32)((int64)m_count * task / taskCount);
+		for (; a < begin; a++)
+		{
+			uint32 bottomLeftTag = computeRelativeTag(beginProxy[a].tag, -1, 1);
+			for (; c < endProxy; c++)
+			{
+				if (bottomLeftTag <= c->tag) break;
+			}
+		}
+		bottomStart[task] = c;
+	}
+	ParallelFor(m_count, taskCount, [&](int32 task, int32 begin, int32 end) {
+		found[task].contacts.reserve((end - begin) * 3);
+		FindContactsInRange(beginProxy + begin, beginProxy + end,
+							bottomStart[task], found[task]);
+	});
+	int32 total = 0;
+	for (int32 task = 0; task < taskCount; task++)
+	{
+		total += (int32)found[task].contacts.size();
+	}
+	contacts.Reserve(total);
+	for (int32 task = 0; task < taskCount; task++)
+	{
+		const std::vector<b2ParticleContact>& f = found[task].contacts;
+		if (f.empty()) continue;
+		memcpy(contacts.Data() + contacts.GetCount(), &f[0],
+			   f.size() * sizeof(b2ParticleContact));
+		contacts.SetCount(contacts.GetCount() + (int32)f.size());
+	}
+}
+
 // Put the positions and indices in proxy-order. This allows us to process
 // particles with SIMD, since adjacent particles are adjacent in memory.
 void b2ParticleSystem::ReorderForFindContact(FindContactInput* reordered,
@@ -2034,14 +2134,18 @@ inline b2ContactListener* b2ParticleSystem::GetParticleContactListener() const
 void b2ParticleSystem::UpdateProxies_Reference(
 	b2GrowableBuffer<Proxy>& proxies) const
 {
-	const Proxy* const endProxy = proxies.End();
-	for (Proxy* proxy = proxies.Begin(); proxy < endProxy; ++proxy)
-	{
-		int32 i = proxy->index;
-		b2Vec2 p = m_positionBuffer.data[i];
-		proxy->tag = computeTag(m_inverseDiameter * p.x,
-								m_inverseDiameter * p.y);
-	}
+	Proxy* const beginProxy = proxies.Begin();
+	ParallelFor(proxies.GetCount(), GetTaskCount(proxies.GetCount()),
+				[&](int32, int32 begin, int32 end) {
+		for (Proxy* proxy = beginProxy + begin; proxy < beginProxy + end;
+			 ++proxy)
+		{
+			int32 i = proxy->index;
+			b2Vec2 p = m_positionBuffer.data[i];
+			proxy->tag = computeTag(m_inverseDiameter * p.x,
+									m_inverseDiameter * p.y);
+		}
+	});
 }
 
 #if defined(LIQUIDFUN_SIMD_NEON)
@@ -3072,10 +3176,14 @@ void b2ParticleSystem::Solve(const b2TimeStep& step)
 			SolveWall();
 		}
 		// The particle positions can be updated only at the end of substep.
-		for (int32 i = 0; i < m_count; i++)
-		{
-			m_positionBuffer.data[i] += subStep.dt * m_velocityBuffer.data[i];
-		}
+		ParallelFor(m_count, GetTaskCount(m_count),
+					[&](int32, int32 begin, int32 end) {
+			for (int32 i = begin; i < end; i++)
+			{
+				m_positionBuffer.data[i] +=
+					subStep.dt * m_velocityBuffer.data[i];
+			}
+		});
 	}
 }
 
@@ -3103,15 +3211,18 @@ void b2ParticleSystem::UpdateAllGroupFlags()
 void b2ParticleSystem::LimitVelocity(const b2TimeStep& step)
 {
 	float32 criticalVelocitySquared = GetCriticalVelocitySquared(step);
-	for (int32 i = 0; i < m_count; i++)
-	{
-		b2Vec2& v = m_velocityBuffer.data[i];
-		float32 v2 = b2Dot(v, v);
-		if (v2 > criticalVelocitySquared)
+	ParallelFor(m_count, GetTaskCount(m_count),
+				[&](int32, int32 begin, int32 end) {
+		for (int32 i = begin; i < end; i++)
 		{
-			v *= b2Sqrt(criticalVelocitySquared / v2);
+			b2Vec2& v = m_velocityBuffer.data[i];
+			float32 v2 = b2Dot(v, v);
+			if (v2 > criticalVelocitySquared)
+			{
+				v *= b2Sqrt(criticalVelocitySquared / v2);
+			}
 		}
-	}
+	});
 }
 
 void b2ParticleSystem::SolveGravity(const b2TimeStep& step)
@@ -3183,12 +3294,16 @@ void b2ParticleSystem::SolvePressure(const b2TimeStep& step)
 	float32 criticalPressure = GetCriticalPressure(step);
 	float32 pressurePerWeight = m_def.pressureStrength * criticalPressure;
 	float32 maxPressure = b2_maxParticlePressure * criticalPressure;
-	for (int32 i = 0; i < m_count; i++)
-	{
-		float32 w = m_weightBuffer[i];
-		float32 h = pressurePerWeight * b2Max(0.0f, w - b2_minParticleWeight);
-		m_accumulationBuffer[i] = b2Min(h, maxPressure);
-	}
+	ParallelFor(m_count, GetTaskCount(m_count),
+				[&](int32, int32 begin, int32 end) {
+		for (int32 i = begin; i < end; i++)
+		{
+			float32 w = m_weightBuffer[i];
+			float32 h =
+				pressurePerWeight * b2Max(0.0f, w - b2_minParticleWeight);
+			m_accumulationBuffer[i] = b2Min(h, maxPressure);
+		}
+	});
 	// ignores particles which have their own repulsive force
 	if (m_allParticleFlags & k_noPressureFlags)
 	{
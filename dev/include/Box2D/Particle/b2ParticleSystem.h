@@ -23,6 +23,8 @@
 #include <Box2D/Particle/b2Particle.h>
 #include <Box2D/Dynamics/b2TimeStep.h>
 
+#include <functional>
+
 #if LIQUIDFUN_UNIT_TESTS
 #include <gtest/gtest.h>
 #endif // LIQUIDFUN_UNIT_TESTS
@@ -50,6 +52,23 @@ struct b2AABB;
 struct FindContactInput;
 struct FindContactCheck;
 
+/// Lets a particle system spread the parts of its step that are independent
+/// per particle (or per range of sorted particles) over multiple threads.
+/// Results are the same regardless of the thread count.
+class b2ParticleTaskExecutor
+{
+public:
+	virtual ~b2ParticleTaskExecutor() {}
+
+	/// The maximum amount of tasks worth passing to Run().
+	virtual int32 GetThreadCount() const = 0;
+
+	/// Calls task(0) .. task(taskCount - 1), possibly concurrently, and
+	/// returns once all of them have finished.
+	virtual void Run(int32 taskCount,
+					 const std::function<void(int32)>& task) = 0;
+};
+
 struct b2ParticleContact
 {
 private:
@@ -414,6 +433,14 @@ public:
 	/// Get the particle density.
 	float32 GetDensity() const;
 
+	/// Set an executor to solve parts of the step on multiple threads, or
+	/// NULL (the default) to solve all of it on the calling thread. The
+	/// executor is not owned by the particle system.
+	void SetTaskExecutor(b2ParticleTaskExecutor* executor);
+
+	/// Get the executor set with SetTaskExecutor().
+	b2ParticleTaskExecutor* GetTaskExecutor() const;
+
 	/// Change the particle gravity scale. Adjusts the effect of the global
 	/// gravity vector on particles.
 	void SetGravityScale(float32 gravityScale);
@@ -743,6 +770,8 @@ private:
 	friend class b2ParticleGroup;
 	friend class b2ParticleBodyContactRemovePredicate;
 	friend class b2FixtureParticleQueryCallback;
+	// Lobster: saves and restores all simulation state, see physics.cpp.
+	friend class b2WorldSnapshot;
 #ifdef LIQUIDFUN_UNIT_TESTS
 	FRIEND_TEST(FunctionTests, GetParticleMass);
 	FRIEND_TEST(FunctionTests, AreProxyBuffersTheSame);
@@ -931,8 +960,14 @@ private:
 
 	void UpdateAllParticleFlags();
 	void UpdateAllGroupFlags();
-	void AddContact(int32 a, int32 b,
-		b2GrowableBuffer<b2ParticleContact>& contacts) const;
+	int32 GetTaskCount(int32 count) const;
+	void ParallelFor(int32 count, int32 taskCount,
+		const std::function<void(int32, int32, int32)>& fn) const;
+	template<typename Buffer> void AddContact(int32 a, int32 b,
+		Buffer& contacts) const;
+	template<typename Buffer> void FindContactsInRange(
+		const Proxy* beginRange, const Proxy* endRange, const Proxy* c,
+		Buffer& contacts) const;
 	void FindContacts_Reference(
 		b2GrowableBuffer<b2ParticleContact>& contacts) const;
 	void ReorderForFindContact(FindContactInput* reordered,
@@ -1066,6 +1101,7 @@ private:
 		float32 impulse, const b2Vec2& normal);
 
 	bool m_paused;
+	b2ParticleTaskExecutor* m_taskExecutor;
 	int32 m_timestamp;
 	int32 m_allParticleFlags;
 	bool m_needsUpdateAllParticleFlags;
@@ -1210,6 +1246,17 @@ inline bool b2ParticleSystem::GetPaused() const
 	return m_paused;
 }
 
+inline void b2ParticleSystem::SetTaskExecutor(
+	b2ParticleTaskExecutor* executor)
+{
+	m_taskExecutor = executor;
+}
+
+inline b2ParticleTaskExecutor* b2ParticleSystem::GetTaskExecutor() const
+{
+	return m_taskExecutor;
+}
+
 inline const b2ParticleContact* b2ParticleSystem::GetContacts() const
 {
 	return m_contactBuffer.Data();
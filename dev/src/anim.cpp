@@ -0,0 +1,179 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Skeletal animation of many instances at once, e.g. for crowds. Doesn't need graphics, so
+// also usable on a server or for CPU side uses of the bones. With graphics, clips come from
+// gl_mesh_anim, and gl_render_mesh_pose renders an instance.
+
+#include "lobster/stdafx.h"
+
+#include "lobster/natreg.h"
+
+#include "lobster/anim.h"
+
+#include "ThreadPool/ThreadPool.h"
+
+namespace lobster {
+
+struct AnimClipResource : Resource {
+    shared_ptr<const AnimClip> clip;
+
+    AnimClipResource(AnimClip *clip) : clip(clip) {}
+
+    size_t2 MemoryUsage() {
+        return { sizeof(AnimClipResource) + sizeof(AnimClip) +
+                 clip->mats.size() * sizeof(float3x4), 0 };
+    }
+};
+
+static ResourceType anim_clip_type = { "animclip" };
+static ResourceType anim_poses_type = { "animposes" };
+
+Value NewAnimClip(VM &vm, int numbones, int numframes, const float3x4 *mats) {
+    return Value(vm.NewResource(&anim_clip_type,
+                                new AnimClipResource(new AnimClip(numbones, numframes, mats))));
+}
+
+static shared_ptr<const AnimClip> &GetAnimClip(const Value &res) {
+    return GetResourceDec<AnimClipResource>(res, &anim_clip_type).clip;
+}
+
+AnimPoses &GetAnimPoses(const Value &res) {
+    return GetResourceDec<AnimPoses>(res, &anim_poses_type);
+}
+
+AnimPoses::AnimPoses(shared_ptr<const AnimClip> clip, iint count)
+    : clip(clip), bones(clip->numbones * count), params(count, float3(0.0f)) {
+    auto nb = clip->numbones;
+    for (iint i = 0; i < count; i++)
+        PoseFrame(clip->mats.data(), clip->numframes, nb, 0, &bones[i * nb]);
+}
+
+static unique_ptr<ThreadPool> anim_pool;
+
+// Evaluates all instances whose parameters changed. Instances that have the same parameters
+// as another one (e.g. a crowd playing the same clip in sync) just get a copy of its bones.
+// Larger batches are spread over a thread pool.
+static void Evaluate(VM &vm, AnimPoses &ap, const LVector *frames, const LVector *frames2,
+                     const LVector *weights) {
+    auto n = ssize(ap.params);
+    if (frames->len != n || (frames2->len && frames2->len != n) ||
+        (weights->len && weights->len != n))
+        vm.BuiltinError("anim_evaluate: frames/frames2/weights must have one entry per"
+                        " instance");
+    if (frames2->len != weights->len)
+        vm.BuiltinError("anim_evaluate: frames2 and weights must be given together");
+    vector<pair<tuple<float, float, float>, int>> todo;
+    for (iint i = 0; i < n; i++) {
+        auto p = float3(frames->At(i).fltval(), 0, 0);
+        if (weights->len) {
+            p.y = frames2->At(i).fltval();
+            p.z = weights->At(i).fltval();
+        }
+        if (p == ap.params[i]) continue;
+        ap.params[i] = p;
+        todo.push_back({ { p.x, p.y, p.z }, (int)i });
+    }
+    if (todo.empty()) return;
+    sort(todo.begin(), todo.end());
+    vector<int> unique;
+    for (size_t k = 0; k < todo.size(); k++)
+        if (!k || todo[k].first != todo[k - 1].first) unique.push_back((int)k);
+    auto &clip = *ap.clip;
+    auto nb = clip.numbones;
+    auto Eval = [&](size_t start, size_t end) {
+        vector<float3x4> clip2(nb);
+        for (auto u = start; u < end; u++) {
+            auto &t = todo[unique[u]];
+            auto out = &ap.bones[t.second * nb];
+            PoseFrame(clip.mats.data(), clip.numframes, nb, get<0>(t.first), out);
+            auto w = get<2>(t.first);
+            if (w == 0) continue;
+            PoseFrame(clip.mats.data(), clip.numframes, nb, get<1>(t.first), clip2.data());
+            auto o = (float *)out;
+            auto b = (const float *)clip2.data();
+            for (int j = 0; j < nb * 12; j++) o[j] += (b[j] - o[j]) * w;
+        }
+    };
+    // Not worth the overhead of threads for just a few thousand bones.
+    auto nthreads = std::min((size_t)NumHWThreads(), unique.size() * nb / 4096);
+    if (nthreads > 1) {
+        if (!anim_pool) anim_pool.reset(new ThreadPool((size_t)NumHWThreads()));
+        vector<future<void>> results;
+        for (size_t i = 0; i < nthreads; i++)
+            results.push_back(anim_pool->enqueue([&, i]() {
+                Eval(unique.size() * i / nthreads, unique.size() * (i + 1) / nthreads);
+            }));
+        for (auto &r : results) r.wait();
+    } else {
+        Eval(0, unique.size());
+    }
+    for (size_t k = 0, u = 0; k < todo.size(); k++) {
+        if (u + 1 < unique.size() && (int)k == unique[u + 1]) u++;
+        if ((int)k == unique[u]) continue;
+        copy_n(&ap.bones[todo[unique[u]].second * nb], nb, &ap.bones[todo[k].second * nb]);
+    }
+}
+
+void AddAnim(NativeRegistry &nfr) {
+
+nfr("anim_clip", "mats,numbones", "F]I", "R:animclip",
+    "creates an animation from bone matrices: for each frame, for each bone, a 3x4 matrix as"
+    " 12 floats in row major order. with graphics, gl_mesh_anim gets the one of a mesh.",
+    [](StackPtr &, VM &vm, Value &mats, Value &numbones) {
+        auto v = mats.vval();
+        auto nb = numbones.ival();
+        if (nb <= 0 || !v->len || v->len % (nb * 12))
+            vm.BuiltinError("anim_clip: mats must hold 12 floats for each bone of each frame");
+        vector<float3x4> m(v->len / 12);
+        auto f = (float *)m.data();
+        for (iint i = 0; i < v->len; i++) f[i] = v->At(i).fltval();
+        return NewAnimClip(vm, (int)nb, (int)(v->len / (nb * 12)), m.data());
+    });
+
+nfr("anim_poses", "clip,count", "R:animclipI", "R:animposes",
+    "creates bones for count instances of clip, all at frame 0, to be evaluated with"
+    " anim_evaluate. much faster than animating instances one by one.",
+    [](StackPtr &, VM &vm, Value &clip, Value &count) {
+        if (count.ival() < 0) vm.BuiltinError("anim_poses: count must be >= 0");
+        return Value(vm.NewResource(&anim_poses_type,
+                                    new AnimPoses(GetAnimClip(clip), count.ival())));
+    });
+
+nfr("anim_evaluate", "poses,frames,frames2,weights", "R:animposesF]F]F]", "",
+    "sets the frame of each instance in poses, interpolating between the frames around it."
+    " frames2 and weights may be [], or be another frame (e.g. in a different animation in the"
+    " same clip) and how much to blend towards it, for each instance. only instances that"
+    " changed since the last call are evaluated, and those at the same point only once.",
+    [](StackPtr &, VM &vm, Value &poses, Value &frames, Value &frames2, Value &weights) {
+        Evaluate(vm, GetAnimPoses(poses), frames.vval(), frames2.vval(), weights.vval());
+        return NilVal();
+    });
+
+nfr("anim_bones", "poses,instance", "R:animposesI", "F]",
+    "the bones of an instance in poses, in the same format as anim_clip takes them.",
+    [](StackPtr &, VM &vm, Value &poses, Value &instance) {
+        auto &ap = GetAnimPoses(poses);
+        auto i = instance.ival();
+        if (i < 0 || i >= ssize(ap.params)) vm.BuiltinError("anim_bones: instance out of range");
+        auto n = ap.clip->numbones * 12;
+        auto v = vm.NewVec(n, n, TYPE_ELEM_VECTOR_OF_FLOAT);
+        auto f = (const float *)ap.Bones(i);
+        for (int j = 0; j < n; j++) v->Elems()[j] = Value(f[j]);
+        return Value(v);
+    });
+
+}  // AddAnim
+
+}  // namespace lobster
@@ -0,0 +1,199 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Background asset loading: file reads and CPU-side decoding run on a thread pool, while
+// anything that needs the main thread (GPU upload, adding to the sound cache) happens when
+// the result is requested from Lobster.
+
+#include "lobster/stdafx.h"
+
+#include "lobster/natreg.h"
+
+#include "lobster/glinterface.h"
+#include "lobster/graphics.h"
+#include "lobster/sdlinterface.h"
+
+#include "ThreadPool/ThreadPool.h"
+
+using namespace lobster;
+
+enum AssetKind { ASSET_FILE, ASSET_IMAGE, ASSET_SOUND };
+
+struct AssetJob : Resource {
+    AssetKind kind;
+    string filename;
+    SoundType soundtype = SOUND_WAV;
+
+    // Written by the worker, only to be read after `done`.
+    bool ok = false;
+    string data;
+    uint8_t *image = nullptr;
+    int2 dim = int2_0;
+    void *sound = nullptr;
+
+    atomic<bool> done;
+    future<void> completion;
+
+    AssetJob(AssetKind kind, string_view filename) : kind(kind), filename(filename), done(false) {}
+
+    ~AssetJob() {
+        // The worker may still be writing into us.
+        if (completion.valid()) completion.wait();
+        if (image) FreeImageFromFile(image);
+        if (sound) SDLFreeDecodedSound(sound);
+    }
+
+    void Run() {
+        switch (kind) {
+            case ASSET_FILE:
+                ok = LoadFile(filename, &data) >= 0;
+                break;
+            case ASSET_IMAGE:
+                image = LoadImageFile(filename, dim);
+                ok = image != nullptr;
+                break;
+            case ASSET_SOUND:
+                sound = SDLDecodeSound(filename, soundtype);
+                ok = sound != nullptr;
+                break;
+        }
+        done = true;
+    }
+
+    void Wait() {
+        if (completion.valid()) completion.wait();
+    }
+
+    size_t2 MemoryUsage() {
+        // Until then, the worker may still be writing these.
+        if (!done) return { sizeof(AssetJob), 0 };
+        return { sizeof(AssetJob), data.size() + (image ? size_t(dim.x) * dim.y * 4 : 0) };
+    }
+};
+
+static ResourceType asset_type = { "asset" };
+
+static unique_ptr<ThreadPool> asset_pool;
+
+static Value StartAssetJob(VM &vm, AssetJob *job) {
+    if (!asset_pool) asset_pool.reset(new ThreadPool((size_t)std::max(1, NumHWThreads() - 1)));
+    job->completion = asset_pool->enqueue([job]() { job->Run(); });
+    return Value(vm.NewResource(&asset_type, job));
+}
+
+static AssetJob &GetAssetJob(const Value &res, AssetKind kind, VM &vm) {
+    auto &job = GetResourceDec<AssetJob>(res, &asset_type);
+    if (job.kind != kind) vm.BuiltinError("asset: job is of the wrong kind for this function");
+    return job;
+}
+
+static Value StartSoundJob(VM &vm, Value &fn, SoundType st) {
+    // Must happen on the main thread, and before decoding since that uses the mixer format.
+    if (!SDLSoundInit()) return NilVal();
+    auto job = new AssetJob(ASSET_SOUND, fn.sval()->strv());
+    job->soundtype = st;
+    return StartAssetJob(vm, job);
+}
+
+void AddAsset(NativeRegistry &nfr) {
+
+nfr("asset_load_file", "filename", "S", "R:asset",
+    "starts loading a file on a background thread. returns a handle that can be polled with"
+    " asset_done, and whose contents can be retrieved with asset_file.",
+    [](StackPtr &, VM &vm, Value &fn) {
+        return StartAssetJob(vm, new AssetJob(ASSET_FILE, fn.sval()->strv()));
+    });
+
+nfr("asset_load_image", "filename", "S", "R:asset",
+    "starts loading and decoding an image on a background thread (see gl_load_texture for"
+    " formats). use asset_texture to turn the result into a texture. cubemaps are not supported.",
+    [](StackPtr &, VM &vm, Value &fn) {
+        return StartAssetJob(vm, new AssetJob(ASSET_IMAGE, fn.sval()->strv()));
+    });
+
+nfr("asset_load_wav", "filename", "S", "R:asset?",
+    "starts loading and decoding a sound on a background thread, like load_wav. use asset_sound"
+    " to make it available to play_wav. returns nil if audio could not be initialized.",
+    [](StackPtr &, VM &vm, Value &fn) {
+        return StartSoundJob(vm, fn, SOUND_WAV);
+    });
+
+nfr("asset_load_sfxr", "filename", "S", "R:asset?",
+    "starts synthesizing a sound on a background thread, like load_sfxr. use asset_sound"
+    " to make it available to play_sfxr. returns nil if audio could not be initialized.",
+    [](StackPtr &, VM &vm, Value &fn) {
+        return StartSoundJob(vm, fn, SOUND_SFXR);
+    });
+
+nfr("asset_load_ogg", "filename", "S", "R:asset?",
+    "starts loading and decoding a sound on a background thread, like load_ogg. use asset_sound"
+    " to make it available to play_ogg. returns nil if audio could not be initialized.",
+    [](StackPtr &, VM &vm, Value &fn) {
+        return StartSoundJob(vm, fn, SOUND_OGG);
+    });
+
+nfr("asset_done", "job", "R:asset", "B",
+    "whether the background part of this job has finished (successfully or not). never blocks.",
+    [](StackPtr &, VM &, Value &res) {
+        auto &job = GetResourceDec<AssetJob>(res, &asset_type);
+        return Value(job.done.load());
+    });
+
+nfr("asset_wait", "job", "R:asset", "B",
+    "blocks until the background part of this job has finished. returns whether it succeeded.",
+    [](StackPtr &, VM &, Value &res) {
+        auto &job = GetResourceDec<AssetJob>(res, &asset_type);
+        job.Wait();
+        return Value(job.ok);
+    });
+
+nfr("asset_file", "job", "R:asset", "S?",
+    "returns the contents of a file loaded with asset_load_file, or nil if it could not be"
+    " loaded. blocks if the job hasn't finished yet.",
+    [](StackPtr &, VM &vm, Value &res) {
+        auto &job = GetAssetJob(res, ASSET_FILE, vm);
+        job.Wait();
+        return job.ok ? Value(vm.NewString(job.data)) : NilVal();
+    });
+
+nfr("asset_texture", "job,textureformat", "R:assetI?", "R:texture?",
+    "creates a texture from an image loaded with asset_load_image (see texture.lobster for"
+    " texture format), or returns nil if it failed to load. blocks if the job hasn't finished"
+    " yet. the decoded image is freed afterwards, so this can only be called once per job.",
+    [](StackPtr &, VM &vm, Value &res, Value &tf) {
+        extern void TestGL(VM &vm); TestGL(vm);
+        auto &job = GetAssetJob(res, ASSET_IMAGE, vm);
+        job.Wait();
+        if (!job.image) return NilVal();
+        auto tex = CreateTexture(job.filename, job.image, int3(job.dim, 0),
+                                 tf.intval() & ~(TF_CUBEMAP | TF_FLOAT));
+        FreeImageFromFile(job.image);
+        job.image = nullptr;
+        return tex.id ? vm.NewResource(&texture_type, new OwnedTexture(tex)) : NilVal();
+    });
+
+nfr("asset_sound", "job", "R:asset", "B",
+    "makes a sound loaded with asset_load_wav/sfxr/ogg available for playback with the"
+    " corresponding play function under the same filename. blocks if the job hasn't finished"
+    " yet. returns false on error.",
+    [](StackPtr &, VM &vm, Value &res) {
+        auto &job = GetAssetJob(res, ASSET_SOUND, vm);
+        job.Wait();
+        if (!job.sound) return Value(false);
+        auto ok = SDLAddDecodedSound(job.filename, job.sound);
+        job.sound = nullptr;  // Now owned by the sound cache.
+        return Value(ok);
+    });
+
+}  // AddAsset
@@ -15,13 +15,14 @@
 #include "lobster/stdafx.h"
 
 #include "lobster/natreg.h"
+#include "lobster/strkernels.h"
 
 #include "lobster/wfc.h"
 
 namespace lobster {
 
-static RandomNumberGenerator<MersenneTwister> rndm;
-static RandomNumberGenerator<Xoshiro256SS> rndx;
+// Timers started with timing_start on this thread (and thus VM), with their start time.
+static thread_local vector<pair<int, double>> timer_stack;
 
 static int IntCompare(const Value &a, const Value &b) {
     return a.ival() < b.ival() ? -1 : a.ival() > b.ival();
@@ -65,6 +66,31 @@ template<typename T> Value BinarySearch(StackPtr &sp, Value &l, Value &key, T co
     return Value(i);
 }
 
+// What get_stack_trace shows, captured without formatting anything, so throwing exceptions is
+// cheap as long as nobody looks at the trace. Variables are not captured, since they will be
+// gone by the time the trace gets rendered.
+struct StackTrace : Resource {
+    vector<VM::FunStack> frames;  // Only the function and call site of each are used.
+    int line, fileidx;
+
+    StackTrace(VM &vm) : frames(vm.fun_id_stack), line(vm.last_line), fileidx(vm.last_fileidx) {}
+
+    string Render(VM &vm) {
+        if (frames.empty()) return vm.DumpFileLine(fileidx, line);
+        string sd;
+        for (auto &frame : reverse(frames)) {
+            append(sd, "in function ", vm.DumpStackFrameStart(frame).first, "\n");
+        }
+        return sd;
+    }
+
+    size_t2 MemoryUsage() {
+        return { sizeof(StackTrace), frames.capacity() * sizeof(VM::FunStack) };
+    }
+};
+
+static ResourceType stack_trace_type = { "stacktrace" };
+
 void AddBuiltins(NativeRegistry &nfr) {
 
 nfr("print", "x", "Ss", "",
@@ -224,9 +250,28 @@ nfr("top", "xs", "A]*", "Ab1",
         PushN(sp, (int)l->width);
     });
 
+nfr("push_front", "xs,x", "A]*Akw1", "Ab]1",
+    "inserts one element at the start of a vector, returns existing vector. amortized O(1)"
+    " just like push, so vectors can be used as queues / deques.",
+    [](StackPtr &sp, VM &vm) {
+        auto v = DangleVec<RefObjPtr>(sp);
+        auto l = Pop(sp).vval();
+        assert(v.len == l->width);
+        l->Insert(vm, v.vals, 0);
+        Push(sp, l);
+    });
+
+nfr("pop_front", "xs", "A]*", "A1",
+    "removes first element from vector and returns it. O(1) just like pop.",
+    [](StackPtr &sp, VM &vm) {
+        auto l = Pop(sp).vval();
+        if (!l->len) vm.BuiltinError("pop_front: empty vector");
+        l->RemovePush(sp, 0);
+    });
+
 nfr("insert", "xs,i,x", "A]*IAkw1", "Ab]1",
-    "inserts a value into a vector at index i, existing elements shift upward,"
-    " returns original vector",
+    "inserts a value into a vector at index i, existing elements shift upward (or those before"
+    " i shift downward, if fewer), returns original vector",
     [](StackPtr &sp, VM &vm) {
         auto v = DangleVec<RefObjPtr>(sp);
         auto i = Pop(sp).ival();
@@ -239,7 +284,8 @@ nfr("insert", "xs,i,x", "A]*IAkw1", "Ab]1",
     });
 
 nfr("remove", "xs,i", "A]*I", "A1",
-    "remove element at index i, following elements shift down. returns the element removed.",
+    "remove element at index i, following elements shift down (or those before i shift up, if"
+    " fewer). returns the element removed.",
     [](StackPtr &sp, VM &vm) {
         auto i = Pop(sp).ival();
         auto l = Pop(sp).vval();
@@ -394,7 +440,8 @@ nfr("find_string", "s,substr,offset", "SSI?", "I",
     "finds the index at which substr first appears, or -1 if none."
     " optionally start at a position other than 0",
     [](StackPtr &, VM &, Value &s, Value &sub, Value &offset) {
-        return Value((ssize_t)s.sval()->strv().find(sub.sval()->strv(), (size_t)offset.ival()));
+        return Value((ssize_t)FindSubstring(s.sval()->strv(), sub.sval()->strv(),
+                                            (size_t)offset.ival()));
     });
 
 nfr("find_string_reverse", "s,substr,offset", "SSI?", "I",
@@ -411,30 +458,28 @@ nfr("replace_string", "s,a,b,count", "SSSI?", "S",
     " if a is empty, no replacements are made."
     " if count is specified, makes at most that many replacements",
     [](StackPtr &, VM &vm, Value &is, Value &ia, Value &ib, Value &count) {
-        string s;
         auto sv = is.sval()->strv();
         auto a = ia.sval()->strv();
         auto b = ib.sval()->strv();
         auto c = count.ival() ? count.ival() : numeric_limits<iint>::max();
-        if (a.empty()) {
-            // We could error here, but more useful to just return the input.
-            s = a;
-        } else {
-            for (size_t i = 0;;) {
-                auto j = std::min(sv.find(a, i), sv.size());
-                auto prefix = sv.substr(i, j - i);;
-                s += prefix;
-                i += prefix.size();
-                if (j == sv.size()) break;
-                s += b;
-                i += a.size();
-                if (!--c) {
-                    s += sv.substr(i);
-                    break;
-                }
-            }
+        // We could error on an empty a, but more useful to just return the input.
+        if (a.empty()) return Value(vm.NewString(sv));
+        // Count first, so the result can be written directly into a string of the right size.
+        iint n = 0;
+        for (size_t i = 0; n < c && (i = FindSubstring(sv, a, i)) != string_view::npos;
+             i += a.size()) n++;
+        auto ns = vm.NewString((iint)sv.size() + n * ((iint)b.size() - (iint)a.size()));
+        auto dest = (char *)ns->data();
+        size_t i = 0;
+        for (; n; n--) {
+            auto j = FindSubstring(sv, a, i);
+            memcpy(dest, sv.data() + i, j - i);
+            dest += j - i;
+            memcpy(dest, b.data(), b.size());
+            dest += b.size();
+            i = j + a.size();
         }
-        auto ns = vm.NewString(s);
+        memcpy(dest, sv.data() + i, sv.size() - i);
         return Value(ns);
     });
 
@@ -471,20 +516,19 @@ nfr("tokenize", "s,delimiters,whitespace,dividing", "SSSI?", "S]",
     " \" \" as whitespace. If dividing was true, there would be a 5th empty string element.",
     [](StackPtr &, VM &vm, Value &s, Value &delims, Value &whitespace, Value &dividing) {
         auto v = (LVector *)vm.NewVec(0, 0, TYPE_ELEM_VECTOR_OF_STRING);
-        auto ws = whitespace.sval()->strv();
-        auto dl = delims.sval()->strv();
+        CharSet ws(whitespace.sval()->strv());
+        CharSet dl(delims.sval()->strv());
         auto p = s.sval()->strv();
-        p.remove_prefix(std::min(p.find_first_not_of(ws), p.size()));
+        p.remove_prefix(ws.Find<false>(p));
         bool has_delim = false;
         while (!p.empty() || (has_delim && dividing.True())) {
-            auto delim = std::min(p.find_first_of(dl), p.size());
-            auto delimstr = p.substr(0, delim);
-            auto end = std::min(delimstr.find_last_not_of(ws) + 1, delim);
+            auto delim = dl.Find<true>(p);
+            auto end = ws.FindLastNot(p.substr(0, delim));
             v->Push(vm, vm.NewString(string_view(p.data(), end)));
             p.remove_prefix(delim);
-            has_delim = std::min(p.find_first_not_of(dl), p.size()) != 0;
+            has_delim = !p.empty();
             if (has_delim) p.remove_prefix(1);
-            p.remove_prefix(std::min(p.find_first_not_of(ws), p.size()));
+            p.remove_prefix(ws.Find<false>(p));
         }
         return Value(v);
     });
@@ -492,14 +536,23 @@ nfr("tokenize", "s,delimiters,whitespace,dividing", "SSSI?", "S]",
 nfr("unicode_to_string", "us", "I]", "S",
     "converts a vector of ints representing unicode values to a UTF-8 string.",
     [](StackPtr &, VM &vm, Value &v) {
-        char buf[7];
-        string s;
-        for (iint i = 0; i < v.vval()->len; i++) {
-            auto &c = v.vval()->At(i);
-            ToUTF8((int)c.ival(), buf);
-            s += buf;
+        auto vec = v.vval();
+        iint len = 0;
+        for (iint i = 0; i < vec->len; i++) {
+            auto u = vec->At(i).ival();
+            if (u < 0 || u > numeric_limits<int>::max())
+                vm.BuiltinError("unicode_to_string: values out of range");
+            len += UTF8Len((int)u);
         }
-        return Value(vm.NewString(s));
+        // ToUTF8 terminates what it writes, which lands on the next char or the terminator.
+        auto ns = vm.NewString(len);
+        auto dest = (char *)ns->data();
+        for (iint i = 0; i < vec->len; i++) {
+            auto u = (int)vec->At(i).ival();
+            if (u < 0x80) *dest++ = (char)u;
+            else dest += ToUTF8(u, dest);
+        }
+        return Value(ns);
     });
 
 nfr("string_to_unicode", "s", "S", "I]B",
@@ -507,15 +560,20 @@ nfr("string_to_unicode", "s", "S", "I]B",
     " if there was a decoding error, and the vector will only contain the characters up to the"
     " error",
     [](StackPtr &sp, VM &vm, Value &s) {
-        auto v = (LVector *)vm.NewVec(0, s.sval()->len, TYPE_ELEM_VECTOR_OF_INT);
+        auto str = s.sval()->strv();
+        // Validating up front leaves a decoding loop without error checks.
+        auto valid = ValidUTF8Prefix(str);
+        auto v = (LVector *)vm.NewVec(0, (iint)valid, TYPE_ELEM_VECTOR_OF_INT);
         Push(sp, v);
-        auto p = s.sval()->strv();
+        auto p = str.substr(0, valid);
+        // Never grows, since we reserved a code point per byte.
         while (!p.empty()) {
-            int u = FromUTF8(p);
-            if (u < 0) return Value(false);
-            v->Push(vm, u);
+            auto ascii = ASCIIPrefix(p);
+            for (size_t i = 0; i < ascii; i++) v->Push(vm, Value((int)p[i]));
+            p.remove_prefix(ascii);
+            if (!p.empty()) v->Push(vm, FromUTF8(p));
         }
-        return Value(true);
+        return Value(valid == str.size());
     });
 
 nfr("number_to_string", "number,base,minchars", "III", "S",
@@ -537,45 +595,41 @@ nfr("number_to_string", "number,base,minchars", "III", "S",
 nfr("lowercase", "s", "S", "S",
     "converts a UTF-8 string from any case to lower case, affecting only A-Z",
     [](StackPtr &, VM &vm, Value &s) {
-        auto ns = vm.NewString(s.sval()->strv());
-        for (auto &c : ns->strv()) {
-            // This is unicode-safe, since all unicode chars are in bytes >= 128
-            if (c >= 'A' && c <= 'Z') (char &)c += 'a' - 'A';
-        }
+        auto ns = vm.NewString(s.sval()->len);
+        ShiftASCIIRange(s.sval()->data(), (char *)ns->data(), (size_t)ns->len, 'A', 'Z', 'a' - 'A');
         return Value(ns);
     });
 
 nfr("uppercase", "s", "S", "S",
     "converts a UTF-8 string from any case to upper case, affecting only a-z",
     [](StackPtr &, VM &vm, Value &s) {
-        auto ns = vm.NewString(s.sval()->strv());
-        for (auto &c : ns->strv()) {
-            // This is unicode-safe, since all unicode chars are in bytes >= 128
-            if (c >= 'a' && c <= 'z') (char &)c -= 'a' - 'A';
-        }
+        auto ns = vm.NewString(s.sval()->len);
+        ShiftASCIIRange(s.sval()->data(), (char *)ns->data(), (size_t)ns->len, 'a', 'z', 'A' - 'a');
         return Value(ns);
     });
 
 nfr("escape_string", "s,set,prefix,postfix", "SSSS", "S",
     "prefixes & postfixes any occurrences or characters in set in string s",
     [](StackPtr &, VM &vm, Value &s, Value &set, Value &prefix, Value &postfix) {
-        string out;
-        for (auto p = s.sval()->strv();;) {
-            auto loc = p.find_first_of(set.sval()->strv());
-            if (loc != string_view::npos) {
-                out.append(p.data(), loc);
-                auto presv = prefix.sval()->strv();
-                out.append(presv.data(), presv.size());
-                out += p[loc++];
-                auto postsv = postfix.sval()->strv();
-                out.append(postsv.data(), postsv.size());
-                p.remove_prefix(loc);
-            } else {
-                out += p;
-                break;
-            }
+        CharSet cs(set.sval()->strv());
+        auto p = s.sval()->strv();
+        auto presv = prefix.sval()->strv();
+        auto postsv = postfix.sval()->strv();
+        auto ns = vm.NewString((iint)(p.size() + cs.Count(p) * (presv.size() + postsv.size())));
+        auto dest = (char *)ns->data();
+        for (;;) {
+            auto loc = cs.Find<true>(p);
+            memcpy(dest, p.data(), loc);
+            dest += loc;
+            if (loc == p.size()) break;
+            memcpy(dest, presv.data(), presv.size());
+            dest += presv.size();
+            *dest++ = p[loc++];
+            memcpy(dest, postsv.data(), postsv.size());
+            dest += postsv.size();
+            p.remove_prefix(loc);
         }
-        return Value(vm.NewString(out));
+        return Value(ns);
     });
 
 nfr("concat_string", "v,sep", "S]S", "S",
@@ -807,27 +861,84 @@ nfr("volume", "v", "I}", "I", "the volume of the area spanned by the vector",
 
 nfr("rnd", "max", "I", "I",
     "a random value [0..max).",
-    [](StackPtr &, VM &, Value &a) { return Value(rndx.rnd_int64(std::max((iint)1, a.ival()))); });
+    [](StackPtr &, VM &vm, Value &a) {
+        return Value(vm.rndx.rnd_int64(std::max((iint)1, a.ival())));
+    });
 nfr("rnd", "max", "I}", "I}",
     "a random vector within the range of an input vector.",
-    [](StackPtr &sp, VM &) { VECTOROP(rndx.rnd_int64(std::max((iint)1, f.ival()))); });
+    [](StackPtr &sp, VM &vm) { VECTOROP(vm.rndx.rnd_int64(std::max((iint)1, f.ival()))); });
 nfr("rnd_float", "", "", "F",
     "a random float [0..1)",
-    [](StackPtr &, VM &) { return Value(rndx.rnd_double()); });
+    [](StackPtr &, VM &vm) { return Value(vm.rndx.rnd_double()); });
 nfr("rnd_gaussian", "", "", "F",
     "a random float in a gaussian distribution with mean 0 and stddev 1",
-    [](StackPtr &, VM &) { return Value(rndx.rnd_gaussian()); });
+    [](StackPtr &, VM &vm) { return Value(vm.rndx.rnd_gaussian()); });
 nfr("rnd_seed", "seed", "I", "",
-    "explicitly set a random seed for reproducable randomness",
-    [](StackPtr &, VM &, Value &seed) { rndx.seed(seed.ival()); return NilVal(); });
-
+    "explicitly set a random seed for reproducable randomness. each thread has its own random"
+    " state, worker threads derive theirs from the main thread when started.",
+    [](StackPtr &, VM &vm, Value &seed) { vm.rndx.seed(seed.ival()); return NilVal(); });
+
+nfr("rnd_fill", "xs,max", "I]I", "Ib]",
+    "overwrites all elements of an int vector with random values [0..max), returns the vector."
+    " produces the same values as calling rnd() for each element, but in a single call.",
+    [](StackPtr &, VM &vm, Value &v, Value &max) {
+        auto m = (uint64_t)std::max((iint)1, max.ival());
+        auto elems = v.vval()->Elems();
+        auto &r = vm.rndx.rnd;
+        for (iint i = 0; i < v.vval()->len; i++) elems[i] = Value((iint)(r.Random() % m));
+        return v;
+    });
+nfr("rnd_float_fill", "xs", "F]", "Fb]",
+    "overwrites all elements of a float vector with random values [0..1), returns the vector.",
+    [](StackPtr &, VM &vm, Value &v) {
+        auto elems = v.vval()->Elems();
+        auto &r = vm.rndx.rnd;
+        for (iint i = 0; i < v.vval()->len; i++)
+            elems[i] = Value((r.Random() >> 11) * 0x1.0p-53);
+        return v;
+    });
+nfr("rnd_gaussian_fill", "xs", "F]", "Fb]",
+    "overwrites all elements of a float vector with random values in a gaussian distribution"
+    " with mean 0 and stddev 1, returns the vector.",
+    [](StackPtr &, VM &vm, Value &v) {
+        auto elems = v.vval()->Elems();
+        for (iint i = 0; i < v.vval()->len; i++) elems[i] = Value(vm.rndx.rnd_gaussian());
+        return v;
+    });
+nfr("rnd_shuffle", "xs", "A]*", "Ab]1",
+    "randomly reorders the elements of a vector in place (Fisher-Yates), returns the vector.",
+    [](StackPtr &, VM &vm, Value &v) {
+        auto l = v.vval();
+        auto w = l->width;
+        auto elems = l->Elems();
+        for (iint i = l->len - 1; i > 0; i--) {
+            auto j = vm.rndx.rnd_int64(i + 1);
+            if (j == i) continue;
+            for (iint k = 0; k < w; k++) std::swap(elems[i * w + k], elems[j * w + k]);
+        }
+        return v;
+    });
+nfr("rnd_permutation", "n", "I", "I]",
+    "returns a new vector containing the numbers [0..n) in random order.",
+    [](StackPtr &, VM &vm, Value &n) {
+        auto len = std::max((iint)0, n.ival());
+        auto v = vm.NewVec(len, len, TYPE_ELEM_VECTOR_OF_INT);
+        auto elems = v->Elems();
+        // "Inside-out" Fisher-Yates: initializes and shuffles in a single pass.
+        for (iint i = 0; i < len; i++) {
+            auto j = vm.rndx.rnd_int64(i + 1);
+            elems[i] = elems[j];
+            elems[j] = Value(i);
+        }
+        return Value(v);
+    });
 
 nfr("rndm", "max", "I", "I",
     "deprecated: old mersenne twister version of the above for backwards compat.",
-    [](StackPtr &, VM &, Value &a) { return Value(rndm.rnd_int(std::max(1, (int)a.ival()))); });
+    [](StackPtr &, VM &vm, Value &a) { return Value(vm.rndm.rnd_int(std::max(1, (int)a.ival()))); });
 nfr("rndm_seed", "seed", "I", "",
     "deprecated: old mersenne twister version of the above for backwards compat.",
-    [](StackPtr &, VM &, Value &seed) { rndm.seed((int)seed.ival()); return NilVal(); });
+    [](StackPtr &, VM &vm, Value &seed) { vm.rndm.seed((int)seed.ival()); return NilVal(); });
 
 nfr("div", "a,b", "II", "F",
     "forces two ints to be divided as floats",
@@ -1212,7 +1323,7 @@ nfr("wave_function_collapse", "tilemap,size", "S]I}:2", "S]I",
         for (int i = 0; i < sz.y; i++) outmap[i] = (char *)outstrings.vval()->At(i).sval()->data();
         int num_contradictions = 0;
         auto ok = WaveFunctionCollapse(int2(iint2(cols, ssize(inmap))), inmap.data(), sz, outmap.data(),
-                                       rndx, num_contradictions);
+                                       vm.rndx, num_contradictions);
         if (!ok)
             vm.BuiltinError("tilemap contained too many tile ids");
         Push(sp,  outstrings);
@@ -1324,7 +1435,7 @@ nfr("type_field_value", "obj,idx", "AI", "S",
         Value r;
         if (IsUDT(ti.t) && i >= 0 && i < ti.len) {
             auto &sti = vm.GetTypeInfo(ti.elemtypes[i].type);
-            r = vm.ToString(a.oval()->AtS(i), sti);
+            r = vm.ToString(a.oval()->GetSlot(ti, i), sti);
         } else {
             r = vm.NewString(0);
         }
@@ -1343,6 +1454,14 @@ nfr("vm_compiled_mode", "", "", "B",
         return Value(!VM_JIT_MODE);
     });
 
+nfr("vm_allocation_count", "", "", "I",
+    "returns the total amount of heap allocations (objects, vectors, strings etc) the VM has"
+    " made so far. the difference between two calls tells you how much allocation happened"
+    " in between.",
+    [](StackPtr &, VM &vm) {
+        return Value(vm.pool.num_allocs());
+    });
+
 nfr("seconds_elapsed", "", "", "F",
     "seconds since program start as a float, unlike gl_time() it is calculated every time it is"
     " called",
@@ -1350,6 +1469,79 @@ nfr("seconds_elapsed", "", "", "F",
         return Value(vm.Time());
     });
 
+nfr("timing_start", "name", "S", "I",
+    "starts timing a section of code under name, until the matching timing_stop. these can be"
+    " nested. time is accumulated per frame, see timing_percentiles. engine subsystems (physics,"
+    " meshgen, cubegen, font rendering, file loading) report under their own names as well."
+    " returns the nesting depth of this timer, for timing_stop.",
+    [](StackPtr &, VM &, Value &name) {
+        // Looking up by name is cheap enough relative to what is typically being timed.
+        timer_stack.push_back({ RegisterTimer(name.sval()->strv()), SecondsSinceStart() });
+        return Value(ssize(timer_stack));
+    });
+
+nfr("timing_stop", "depth", "I?", "",
+    "stops the timer most recently started with timing_start, or if given the depth that"
+    " timing_start returned, that timer. timers started after it that were never stopped (e.g."
+    " because an exception or return from unwound past their timing_stop) are dropped.",
+    [](StackPtr &, VM &vm, Value &depth) {
+        auto d = depth.ival();
+        if (d) {
+            if (d < 0 || d > ssize(timer_stack)) vm.BuiltinError("timing_stop: no such timer");
+            timer_stack.resize((size_t)d);
+        }
+        if (timer_stack.empty()) vm.BuiltinError("timing_stop: no timer running");
+        auto [id, start] = timer_stack.back();
+        timer_stack.pop_back();
+        TimerAdd(id, start, SecondsSinceStart());
+        return NilVal();
+    });
+
+nfr("timing_frame_end", "", "", "",
+    "ends a frame for the purpose of timing_percentiles. gl_frame() does this automatically, so"
+    " this is only needed in programs without a window.",
+    [](StackPtr &, VM &) {
+        TimingFrameEnd();
+    });
+
+nfr("timing_percentiles", "name,percentiles", "SF]", "F]",
+    "for the timer with this name, returns its total time per frame (in seconds) at each of the"
+    " given percentiles (0..100), computed over the last 256 frames. the timer \"frame\" has the"
+    " frame times themselves. returns an empty vector if there is no such timer or no frames"
+    " have ended yet.",
+    [](StackPtr &, VM &vm, Value &name, Value &pcts) {
+        vector<double> ps, rs;
+        for (iint i = 0; i < pcts.vval()->len; i++) ps.push_back(pcts.vval()->At(i).fval());
+        auto res = (LVector *)vm.NewVec(0, (iint)ps.size(), TYPE_ELEM_VECTOR_OF_FLOAT);
+        if (TimerPercentiles(name.sval()->strv(), ps, rs)) {
+            for (auto r : rs) res->Push(vm, Value(r));
+        }
+        return Value(res);
+    });
+
+nfr("timing_names", "", "", "S]",
+    "returns the names of all timers that exist so far.",
+    [](StackPtr &, VM &vm) {
+        return ToValueOfVectorOfStrings(vm, TimerNames());
+    });
+
+nfr("timing_trace", "on", "B", "",
+    "starts or stops recording every individual timing_start/stop (and native subsystem timing)"
+    " for timing_save_trace. this uses memory for each event, so only leave it on for short"
+    " periods.",
+    [](StackPtr &, VM &, Value &on) {
+        TimingTrace(on.True());
+        return NilVal();
+    });
+
+nfr("timing_save_trace", "filename", "S", "B",
+    "writes all events recorded since timing_trace(true) as a JSON trace that can be viewed in"
+    " chrome://tracing or ui.perfetto.dev, and discards them. returns false if the file"
+    " couldn't be written.",
+    [](StackPtr &, VM &, Value &fn) {
+        return Value(TimingSaveTrace(fn.sval()->strv()));
+    });
+
 nfr("date_time", "utc", "B?", "I]",
     "a vector of integers representing date & time information (index with date_time.lobster)."
     " By default returns local time, pass true for UTC instead.",
@@ -1420,6 +1612,22 @@ nfr("get_stack_trace", "", "", "S",
         return Value(vm.NewString(sd));
     });
 
+nfr("capture_stack_trace", "", "", "R:stacktrace?",
+    "records the current stack (like get_stack_trace, but without variables) in a way that is"
+    " cheap to do often, e.g. for every exception thrown. use stack_trace_string to turn it"
+    " into text. returns nil if there is nothing to record (needs --runtime-verbose).",
+    [](StackPtr &, VM &vm) {
+        if (vm.fun_id_stack.empty() && (vm.last_line < 0 || vm.last_fileidx < 0)) return NilVal();
+        return Value(vm.NewResource(&stack_trace_type, new StackTrace(vm)));
+    });
+
+nfr("stack_trace_string", "trace", "R:stacktrace?", "S",
+    "renders a stack trace from capture_stack_trace as text, or an empty string if nil.",
+    [](StackPtr &, VM &vm, Value &trace) {
+        if (trace.False()) return Value(vm.NewString(""));
+        return Value(vm.NewString(GetResourceDec<StackTrace>(trace, &stack_trace_type).Render(vm)));
+    });
+
 nfr("get_memory_usage", "n", "I", "S",
     "gets a text showing the top n object types that are using the most memory.",
     [](StackPtr &, VM &vm, Value &n) {
@@ -1526,6 +1734,29 @@ nfr("thread_read", "type", "T", "A1?",
 
 }  // AddBuiltins
 
+// A float4x4 (see matrix.lobster) is a struct of 16 floats in column major order, so it
+// lives on the stack (or inline in vectors) rather than the heap.
+static double4x4 ValuesToMatrix(const Value *v) {
+    double4x4 m;
+    auto d = m.data_mut();
+    for (int i = 0; i < 16; i++) d[i] = v[i].fval();
+    return m;
+}
+
+static void MatrixToValues(Value *v, const double4x4 &m) {
+    for (auto f : m) *v++ = f;
+}
+
+static double4x4 PopMatrix(StackPtr &sp) {
+    auto l = Pop(sp).ival();
+    assert(l == 16);
+    PopN(sp, l);
+    return ValuesToMatrix(TopPtr(sp));
+}
+
+static void PushMatrix(StackPtr &sp, const double4x4 &m) {
+    for (auto f : m) Push(sp, f);
+}
 
 void AddMatrix(NativeRegistry &nfr) {
 
@@ -1589,6 +1820,69 @@ nfr("matrix_translation", "trans", "F}:3", "F]",
         Push(sp, r);
     });
 
+nfr("matrix_multiply", "a,b", "F}:16F}:16", "F}:16",
+    "multiplies two float4x4 matrices",
+    [](StackPtr &sp, VM &) {
+        auto b = PopMatrix(sp);
+        auto a = PopMatrix(sp);
+        PushMatrix(sp, a * b);
+    });
+
+nfr("matrix_multiply_all", "a,bs", "F}:16F}:16]", "",
+    "multiplies every float4x4 in bs by a, in place (bs[i] = a * bs[i])",
+    [](StackPtr &sp, VM &) {
+        auto bs = Pop(sp).vval();
+        auto a = PopMatrix(sp);
+        for (iint i = 0; i < bs->len; i++) {
+            MatrixToValues(bs->AtSt(i), a * ValuesToMatrix(bs->AtSt(i)));
+        }
+    });
+
+nfr("matrix_inverse", "m", "F}:16", "F}:16",
+    "inverse of a float4x4. returns the identity matrix if m is not invertible",
+    [](StackPtr &sp, VM &) {
+        PushMatrix(sp, invert(PopMatrix(sp)));
+    });
+
+nfr("matrix_transpose", "m", "F}:16", "F}:16",
+    "",
+    [](StackPtr &sp, VM &) {
+        PushMatrix(sp, PopMatrix(sp).transpose());
+    });
+
+nfr("matrix_compose", "translation,rotation,scale", "F}:3F}:4F}:3", "F}:16",
+    "a float4x4 that scales, then rotates by the quaternion rotation, then translates",
+    [](StackPtr &sp, VM &) {
+        auto s = PopVec<double3>(sp);
+        auto q = PopVec<double4>(sp);
+        auto t = PopVec<double3>(sp);
+        auto x = q.x, y = q.y, z = q.z, w = q.w;
+        PushMatrix(sp, double4x4(
+            double4(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y), 0) * s.x,
+            double4(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x), 0) * s.y,
+            double4(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y), 0) * s.z,
+            double4(t, 1)));
+    });
+
+nfr("matrix_transform", "m,p", "F}:16F}:3", "F}:3",
+    "transforms point p by a float4x4 (p.w = 1)",
+    [](StackPtr &sp, VM &) {
+        auto p = PopVec<double3>(sp);
+        auto m = PopMatrix(sp);
+        PushVec(sp, (m * double4(p, 1)).xyz());
+    });
+
+nfr("matrix_transform_points", "m,ps", "F}:16F}:3]", "",
+    "transforms all points in ps by a float4x4, in place",
+    [](StackPtr &sp, VM &) {
+        auto ps = Pop(sp).vval();
+        auto m = PopMatrix(sp);
+        for (iint i = 0; i < ps->len; i++) {
+            auto p = ValueToF<3>(ps->AtSt(i), 3);
+            ToValue(ps->AtSt(i), 3, (m * double4(p, 1)).xyz());
+        }
+    });
+
 }  // AddMatrix
 
 }
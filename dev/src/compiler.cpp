@@ -363,12 +363,25 @@ void PrepQuery(Query &query, vector<pair<string, string>> &filenames) {
 
 void Compile(NativeRegistry &nfr, string_view fn, string_view stringsource, string &bytecode,
              string *parsedump, string *pakfile, bool return_value, int runtime_checks,
-             Query *query, int max_errors, bool full_error) {
+             Query *query, int max_errors, bool full_error,
+             vector<pair<string, string>> *filenames_out) {
     vector<pair<string, string>> filenames;
+    static int lex_parse_timer = RegisterTimer("lex_parse");
+    auto lex_parse_start = SecondsSinceStart();
     Lex lex(fn, filenames, stringsource, max_errors);
     SymbolTable st(lex);
     Parser parser(nfr, lex, st);
     parser.Parse();
+    auto lex_parse_end = SecondsSinceStart();
+    TimerAdd(lex_parse_timer, lex_parse_start, lex_parse_end);
+    if (min_output_level <= OUTPUT_INFO) {
+        size_t source_size = 0;
+        for (auto &s : lex.allsources) source_size += s->size();
+        auto ms = (lex_parse_end - lex_parse_start) * 1000.0;
+        auto mb = source_size / (1024.0 * 1024.0);
+        LOG_INFO("lex+parse: ", ms, " ms for ", mb, " MB (", ms / std::max(mb, 0.000001),
+                 " ms/MB)");
+    }
     if (query) PrepQuery(*query, filenames);
     TypeChecker tc(parser, st, return_value, query, full_error);
     if (query) tc.ProcessQuery();  // Failed to find location during type checking.
@@ -385,33 +398,55 @@ void Compile(NativeRegistry &nfr, string_view fn, string_view stringsource, stri
         auto err = BuildPakFile(*pakfile, bytecode, parser.pakfiles);
         if (!err.empty()) THROW_OR_ABORT(err);
     }
+    if (filenames_out) *filenames_out = std::move(filenames);
+}
+
+#if VM_JIT_MODE
+// Runs a program in a new VM, given the exports of its (main) JIT unit.
+static pair<string, iint> RunJITExports(NativeRegistry &nfr, string_view bytecode_buffer,
+                                        string_view fn, void **exports,
+                                        vector<string> &&program_args, TraceMode trace,
+                                        bool dump_leaks, int runtime_checks) {
+    auto vmargs = VMArgs {
+        nfr, string(fn), (uint8_t *)bytecode_buffer.data(),
+        bytecode_buffer.size(), std::move(program_args),
+        (fun_base_t *)exports[1], (fun_base_t)exports[0], trace, dump_leaks,
+        runtime_checks
+    };
+    lobster::VMAllocator vma(std::move(vmargs));
+    vma.vm->EvalProgram();
+    return vma.vm->evalret;
 }
+#endif
 
 pair<string, iint> RunTCC(NativeRegistry &nfr, string_view bytecode_buffer, string_view fn,
                           const char *object_name, vector<string> &&program_args, TraceMode trace,
-                          bool compile_only, string &error, int runtime_checks, bool dump_leaks) {
-    string sd;
-    error = ToCPP(nfr, sd, bytecode_buffer, false, runtime_checks, "nullptr");
-    if (!error.empty()) return { "", 0 };
+                          bool compile_only, string &error, int runtime_checks, bool dump_leaks,
+                          JITMode jit_mode) {
     #if VM_JIT_MODE
-        const char *export_names[] = { "compiled_entry_point", "vtables", nullptr };
-        auto start_time = SecondsSinceStart();
         pair<string, iint> ret;
-        auto ok = RunC(sd.c_str(), object_name, error, vm_ops_jit_table, export_names,
-            [&](void **exports) -> bool {
-                LOG_INFO("time to tcc (seconds): ", SecondsSinceStart() - start_time);
-                if (compile_only) return true;
-                auto vmargs = VMArgs {
-                    nfr, string(fn), (uint8_t *)bytecode_buffer.data(),
-                    bytecode_buffer.size(), std::move(program_args),
-                    (fun_base_t *)exports[1], (fun_base_t)exports[0], trace, dump_leaks,
-                    runtime_checks
-                };
-                lobster::VMAllocator vma(std::move(vmargs));
-                vma.vm->EvalProgram();
-                ret = vma.vm->evalret;
-                return true;
-            });
+        auto start_time = SecondsSinceStart();
+        auto run = [&](void **exports) {
+            LOG_INFO("time to tcc (seconds): ", SecondsSinceStart() - start_time);
+            if (compile_only) return;
+            ret = RunJITExports(nfr, bytecode_buffer, fn, exports, std::move(program_args),
+                                trace, dump_leaks, runtime_checks);
+        };
+        string sd;
+        auto ok = true;
+        if (jit_mode != JITMode::EAGER && !object_name) {
+            ok = RunLazyJIT(nfr, bytecode_buffer, fn, runtime_checks, jit_mode == JITMode::TIERED,
+                            sd, error, run);
+        } else {
+            error = ToCPP(nfr, sd, bytecode_buffer, false, runtime_checks, "nullptr");
+            if (!error.empty()) return { "", 0 };
+            const char *export_names[] = { "compiled_entry_point", "vtables", nullptr };
+            ok = RunC(sd.c_str(), object_name, error, vm_ops_jit_table, export_names,
+                [&](void **exports) -> bool {
+                    run(exports);
+                    return true;
+                });
+        }
         if (!ok || !error.empty()) {
             // So we can see what the problem is..
             FILE *f = fopen((MainDir() + "compiled_lobster_jit_debug.c").c_str(), "w");
@@ -423,17 +458,93 @@ pair<string, iint> RunTCC(NativeRegistry &nfr, string_view bytecode_buffer, stri
         }
         return ret;
     #else
+        (void)nfr;
+        (void)bytecode_buffer;
         (void)fn;
         (void)object_name;
         (void)program_args;
         (void)trace;
         (void)compile_only;
         (void)dump_leaks;
+        (void)jit_mode;
         error = "cannot JIT code: libtcc not enabled";
         return { "", 0 };
     #endif
 }
 
+#if VM_JIT_MODE
+// compile_run_code / compile_run_file programs that ran recently, kept compiled (bytecode and
+// JIT state, including any functions that got hot) such that running the same code again
+// skips the compiler entirely. Entries are checked against the versions of all files they
+// were compiled from. A program is taken out while it runs, so concurrent or recursive runs
+// of the same code simply compile their own copy.
+struct CompileRunCache {
+    struct Program {
+        string bytecode;
+        vector<pair<string, int64_t>> files;  // Abs path, version.
+        LazyJIT *jit = nullptr;
+        uint64_t last_used = 0;
+
+        ~Program() {
+            if (jit) DeleteLazyJIT(jit);
+        }
+
+        // False if we can't tell when one of the files changes.
+        bool SetFiles(const vector<pair<string, string>> &filenames, bool stringiscode) {
+            // For code passed as a string, the first entry is not a file.
+            for (size_t i = stringiscode; i < filenames.size(); i++) {
+                auto version = FileVersion(filenames[i].second);
+                if (version < 0) return false;
+                files.push_back({ filenames[i].second, version });
+            }
+            return true;
+        }
+
+        bool UpToDate() {
+            for (auto &[abspath, version] : files) {
+                if (FileVersion(abspath) != version) return false;
+            }
+            return true;
+        }
+    };
+
+    static const size_t max_programs = 64;
+
+    mutex mtx;
+    map<string, unique_ptr<Program>, less<>> programs;
+    uint64_t use_counter = 0;
+
+    static CompileRunCache &Get() {
+        static CompileRunCache cache;
+        return cache;
+    }
+
+    unique_ptr<Program> Take(string_view key) {
+        unique_ptr<Program> prog;
+        {
+            lock_guard<mutex> lock(mtx);
+            auto it = programs.find(key);
+            if (it == programs.end()) return nullptr;
+            prog = std::move(it->second);
+            programs.erase(it);
+        }
+        return prog->UpToDate() ? std::move(prog) : nullptr;
+    }
+
+    void Add(string &&key, unique_ptr<Program> &&prog) {
+        lock_guard<mutex> lock(mtx);
+        prog->last_used = use_counter++;
+        programs[std::move(key)] = std::move(prog);
+        if (programs.size() <= max_programs) return;
+        auto lru = programs.begin();
+        for (auto it = programs.begin(); it != programs.end(); ++it) {
+            if (it->second->last_used < lru->second->last_used) lru = it;
+        }
+        programs.erase(lru);
+    }
+};
+#endif
+
 Value CompileRun(VM &parent_vm, StackPtr &parent_sp, Value &source, bool stringiscode,
                  vector<string> &&args) {
     string_view fn = stringiscode ? "string" : source.sval()->strv();  // fixme: datadir + sanitize?
@@ -441,16 +552,44 @@ Value CompileRun(VM &parent_vm, StackPtr &parent_sp, Value &source, bool stringi
     try
     #endif
     {
-        int runtime_checks = RUNTIME_ASSERT;  // FIXME: let caller decide?
-        string bytecode_buffer;
-        Compile(parent_vm.nfr, fn, stringiscode ? source.sval()->strv() : string_view(),
-                bytecode_buffer, nullptr, nullptr, true, runtime_checks, nullptr, 1, false);
-        string error;
-        auto ret = RunTCC(parent_vm.nfr, bytecode_buffer, fn, nullptr, std::move(args),
-                          TraceMode::OFF, false, error, runtime_checks, true);
-        if (!error.empty()) THROW_OR_ABORT(error);
-        Push(parent_sp, Value(parent_vm.NewString(ret.first)));
-        return NilVal();
+        #if VM_JIT_MODE
+            static int compile_timer = RegisterTimer("compile_run_compile");
+            static int run_timer = RegisterTimer("compile_run_run");
+            int runtime_checks = RUNTIME_ASSERT;  // FIXME: let caller decide?
+            auto start_time = SecondsSinceStart();
+            auto key = cat(stringiscode ? "code:" : "file:", source.sval()->strv());
+            auto &cache = CompileRunCache::Get();
+            auto prog = cache.Take(key);
+            auto cached = prog != nullptr;
+            auto cacheable = true;
+            if (!cached) {
+                prog = make_unique<CompileRunCache::Program>();
+                vector<pair<string, string>> filenames;
+                Compile(parent_vm.nfr, fn, stringiscode ? source.sval()->strv() : string_view(),
+                        prog->bytecode, nullptr, nullptr, true, runtime_checks, nullptr, 1, false,
+                        &filenames);
+                cacheable = prog->SetFiles(filenames, stringiscode);
+                string sd, error;
+                prog->jit = NewLazyJIT(parent_vm.nfr, prog->bytecode, fn, runtime_checks, true,
+                                       sd, error);
+                if (!prog->jit) THROW_OR_ABORT("libtcc JIT error: " + string(fn) + ":\n" + error);
+            }
+            auto run_time = SecondsSinceStart();
+            TimerAdd(compile_timer, start_time, run_time);
+            auto ret = RunJITExports(parent_vm.nfr, prog->bytecode, fn, LazyJITExports(prog->jit),
+                                     std::move(args), TraceMode::OFF, true, runtime_checks);
+            auto end_time = SecondsSinceStart();
+            TimerAdd(run_timer, run_time, end_time);
+            LOG_INFO("compile_run: ", fn, " in ", (end_time - start_time) * 1000.0, " ms (",
+                     cached ? string("cached") : cat("compile ", (run_time - start_time) * 1000.0, " ms"),
+                     ")");
+            if (cacheable) cache.Add(std::move(key), std::move(prog));
+            Push(parent_sp, Value(parent_vm.NewString(ret.first)));
+            return NilVal();
+        #else
+            (void)args;
+            THROW_OR_ABORT(cat("cannot JIT code: libtcc not enabled: ", fn));
+        #endif
     }
     #ifdef USE_EXCEPTION_HANDLING
     catch (string &s) {
@@ -467,7 +606,9 @@ nfr("compile_run_code", "code,args", "SS]", "SS?",
     " the argument is a string of code. returns the return value of the program as a string,"
     " with an error string as second return value, or nil if none. using parse_data(),"
     " two program can communicate more complex data structures even if they don't have the same"
-    " version of struct definitions.",
+    " version of struct definitions. recently run programs are kept compiled, so running the"
+    " same code again is cheap. the time spent is recorded under timers compile_run_compile and"
+    " compile_run_run (see timing_percentiles).",
     [](StackPtr &sp, VM &vm, Value &filename, Value &args) {
         return CompileRun(vm, sp, filename, true, ValueToVectorOfStrings(args));
     });
@@ -486,6 +627,9 @@ void RegisterCoreLanguageBuiltins(NativeRegistry &nfr) {
     extern void AddFile(NativeRegistry &nfr);     RegisterBuiltin(nfr, "file",      AddFile);
     extern void AddReader(NativeRegistry &nfr);   RegisterBuiltin(nfr, "parsedata", AddReader);
     extern void AddMatrix(NativeRegistry &nfr);   RegisterBuiltin(nfr, "matrix",    AddMatrix);
+    extern void AddSpatial(NativeRegistry &nfr);  RegisterBuiltin(nfr, "spatial",   AddSpatial);
+    extern void AddRegex(NativeRegistry &nfr);    RegisterBuiltin(nfr, "regex",     AddRegex);
+    extern void AddAnim(NativeRegistry &nfr);     RegisterBuiltin(nfr, "anim",      AddAnim);
 }
 
 #if !LOBSTER_ENGINE
@@ -564,7 +708,8 @@ Field::Field(const Field &o)
       defaultval(o.defaultval ? o.defaultval->Clone() : nullptr),
       isprivate(o.isprivate),
       in_scope(o.in_scope),
-      defined_in(o.defined_in) {}
+      defined_in(o.defined_in),
+      storage(o.storage) {}
 
 Function::~Function() {
     for (auto ov : overloads) delete ov;
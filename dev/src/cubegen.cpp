@@ -437,6 +437,7 @@ nfr("cg_stretch", "newsize,world", "I}:3R:voxels", "R:voxels", "",
 nfr("cg_create_mesh", "block", "R:voxels", "R:mesh",
     "converts block to a mesh",
     [](StackPtr &, VM &vm, Value &wid) {
+        LOBSTER_TIMED_SCOPE("cubegen_mesh");
         auto &v = GetVoxels(wid);
         auto &palette = palettes[v.palette_idx].colors;
         static int3 neighbors[] = {
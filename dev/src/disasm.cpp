@@ -176,6 +176,29 @@ const int *DisAsmIns(NativeRegistry &nfr, string &sd, const int *ip, const int *
             break;
         }
 
+        case IL_JUMP_TABLE_SPARSE: {
+            auto n = *ip++;
+            auto targets = ip + n;
+            sd += "[ ";
+            for (int i = 0; i < n; i++) append(sd, ip[i], ":", targets[i], " ");
+            append(sd, "default:", targets[n], " ]");
+            ip += n * 2 + 1;
+            break;
+        }
+
+        case IL_JUMP_TABLE_STRING: {
+            ip++;  // owned.
+            auto n = *ip++;
+            sd += "[ ";
+            for (int i = 0; i < n; i++) {
+                EscapeAndQuote(bcf->stringtable()->Get(ip[2])->string_view(), sd);
+                append(sd, ":", ip[3], " ");
+                ip += 4;
+            }
+            append(sd, "default:", *ip++, " ]");
+            break;
+        }
+
         case IL_FUNSTART: {
             auto fidx = *ip++;
             sd += (fidx >= 0 ? bcf->functions()->Get(fidx)->name()->string_view() : "__dummy");
@@ -44,6 +44,7 @@ using namespace lobster;
 extern void AddGraphics(NativeRegistry &nfr);
 extern void AddFont(NativeRegistry &nfr);
 extern void AddSound(NativeRegistry &nfr);
+extern void AddAsset(NativeRegistry &nfr);
 extern void AddPhysics(NativeRegistry &nfr);
 extern void AddNoise(NativeRegistry &nfr);
 extern void AddMeshGen(NativeRegistry &nfr);
@@ -58,6 +59,7 @@ FileLoader EnginePreInit(NativeRegistry &nfr) {
     RegisterBuiltin(nfr, "graphics",  AddGraphics);
     RegisterBuiltin(nfr, "font",      AddFont);
     RegisterBuiltin(nfr, "sound",     AddSound);
+    RegisterBuiltin(nfr, "asset",     AddAsset);
     RegisterBuiltin(nfr, "physics",   AddPhysics);
     RegisterBuiltin(nfr, "noise",     AddNoise);
     RegisterBuiltin(nfr, "meshgen",   AddMeshGen);
@@ -33,9 +33,19 @@
     #endif
     #include <sys/types.h>
     #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
     #include <unistd.h>
 #endif
 
+#ifdef _WIN32
+    #define fseek64 _fseeki64
+    #define ftell64 _ftelli64
+#else
+    #define fseek64 fseeko
+    #define ftell64 ftello
+#endif
+
 namespace lobster {
 
 template<typename T, bool B> T Read(VM &vm, iint i, const LString *s) {
@@ -130,6 +140,294 @@ Value ParseSchemas(VM &vm, flatbuffers::Parser &parser, const Value &schema,
     return NilVal();
 }
 
+// A file opened for streaming, so large files can be processed without loading them whole.
+// Reads go through a window of bytes: either our own buffer refilled from the FILE, or for
+// mapped files simply the entire mapping, so that reading lines or chunks is the same code.
+struct FileStream : Resource {
+    FILE *f = nullptr;
+    bool writing = false;
+    bool mapped = false;
+    const char *window = nullptr;
+    size_t window_len = 0;
+    size_t window_pos = 0;
+    int64_t window_start = 0;  // File offset of window[0].
+    vector<char> rbuf;
+    string line;
+    #ifdef _WIN32
+        HANDLE file_handle = INVALID_HANDLE_VALUE;
+        HANDLE map_handle = nullptr;
+    #endif
+
+    static const size_t buffer_size = 64 * 1024;
+
+    ~FileStream() { Close(); }
+
+    bool IsOpen() { return f || mapped; }
+
+    void Close() {
+        if (f) {
+            fclose(f);
+            f = nullptr;
+        }
+        if (mapped) {
+            #ifdef _WIN32
+                if (window) UnmapViewOfFile(window);
+                if (map_handle) CloseHandle(map_handle);
+                CloseHandle(file_handle);
+            #else
+                if (window) munmap((void *)window, window_len);
+            #endif
+            mapped = false;
+        }
+        window = nullptr;
+        window_len = window_pos = 0;
+        rbuf = {};
+    }
+
+    bool OpenRead(const string &path) {
+        f = fopen(path.c_str(), "rb");
+        if (!f) return false;
+        rbuf.resize(buffer_size);
+        window = rbuf.data();
+        return true;
+    }
+
+    bool OpenWrite(string_view filename, bool append, bool allow_absolute) {
+        f = OpenFor(filename, append ? "ab" : "wb", allow_absolute);
+        if (!f) return false;
+        writing = true;
+        // Many small writes are common (e.g. a line at a time), so use a bigger buffer.
+        setvbuf(f, nullptr, _IOFBF, buffer_size);
+        return true;
+    }
+
+    bool Map(const string &path) {
+        #ifdef _WIN32
+            file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file_handle == INVALID_HANDLE_VALUE) return false;
+            mapped = true;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file_handle, &size)) { Close(); return false; }
+            // Empty files can't be mapped, but are a valid (empty) view.
+            if (!size.QuadPart) return true;
+            map_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!map_handle) { Close(); return false; }
+            window = (const char *)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+            if (!window) { Close(); return false; }
+            window_len = (size_t)size.QuadPart;
+        #else
+            auto fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) || !S_ISREG(st.st_mode)) { close(fd); return false; }
+            mapped = true;
+            if (st.st_size) {
+                auto p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) { close(fd); Close(); return false; }
+                window = (const char *)p;
+                window_len = (size_t)st.st_size;
+            }
+            // The mapping stays valid after closing the descriptor.
+            close(fd);
+        #endif
+        return true;
+    }
+
+    bool Refill() {
+        if (mapped) return false;
+        window_start += window_len;
+        window_pos = 0;
+        window_len = fread(rbuf.data(), 1, rbuf.size(), f);
+        return window_len > 0;
+    }
+
+    size_t Read(char *dest, size_t n) {
+        size_t done = 0;
+        while (done < n) {
+            if (window_pos == window_len && !Refill()) break;
+            auto m = std::min(n - done, window_len - window_pos);
+            memcpy(dest + done, window + window_pos, m);
+            window_pos += m;
+            done += m;
+        }
+        return done;
+    }
+
+    // Reads up to the next \n, which is not included, and neither is a preceding \r.
+    bool ReadLine(string &line) {
+        line.clear();
+        bool any = false;
+        for (;;) {
+            if (window_pos == window_len && !Refill()) break;
+            any = true;
+            auto start = window + window_pos;
+            auto avail = window_len - window_pos;
+            auto nl = (const char *)memchr(start, '\n', avail);
+            if (nl) {
+                line.append(start, nl - start);
+                window_pos += nl - start + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+            line.append(start, avail);
+            window_pos = window_len;
+        }
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        return any;
+    }
+
+    int64_t Tell() {
+        return writing ? ftell64(f) : window_start + (int64_t)window_pos;
+    }
+
+    bool Seek(int64_t pos) {
+        if (pos < 0) return false;
+        if (mapped) {
+            if (pos > (int64_t)window_len) return false;
+            window_pos = (size_t)pos;
+            return true;
+        }
+        if (!writing && pos >= window_start && pos <= window_start + (int64_t)window_len) {
+            // Inside what we already buffered, no need to touch the file.
+            window_pos = (size_t)(pos - window_start);
+            return true;
+        }
+        if (fseek64(f, pos, SEEK_SET)) return false;
+        window_start = pos;
+        window_len = window_pos = 0;
+        return true;
+    }
+
+    int64_t Size() {
+        if (mapped) return (int64_t)window_len;
+        if (writing) fflush(f);
+        auto cur = ftell64(f);
+        if (fseek64(f, 0, SEEK_END)) return -1;
+        auto size = ftell64(f);
+        fseek64(f, cur, SEEK_SET);
+        return size;
+    }
+
+    size_t2 MemoryUsage() {
+        return { sizeof(FileStream), rbuf.size() };
+    }
+};
+
+static ResourceType file_type = { "file" };
+
+static FileStream &GetFileStream(VM &vm, const Value &res) {
+    auto &fs = GetResourceDec<FileStream>(res, &file_type);
+    if (!fs.IsOpen()) vm.BuiltinError("file: file has already been closed");
+    return fs;
+}
+
+static FileStream &GetFileStream(VM &vm, const Value &res, bool writing) {
+    auto &fs = GetFileStream(vm, res);
+    if (fs.writing != writing)
+        vm.BuiltinError(writing ? "file: file is not open for writing"
+                                : "file: file is not open for reading");
+    return fs;
+}
+
+// Sub processes started through a pool, which caps how many run at once. Queued ones are
+// started whenever the pool is used from Lobster (any process_ call), so there are no extra
+// threads beyond the ones collecting output.
+struct ProcessState {
+    vector<string> cmdline;
+    size_t index = 0;
+    string pending_stdin;
+    bool keep_stdin_open = false;
+    bool stdin_closed = false;
+    bool queued = true;
+    bool killed = false;
+    unique_ptr<SubProcess> sp;
+
+    // Processes that couldn't be launched (or were killed while queued) are done as well.
+    bool Done() { return !queued && (!sp || sp->Done()); }
+
+    iint ExitCode() { return sp ? sp->ExitCode() : -1; }
+};
+
+struct PoolState {
+    size_t max_running = 1;
+    size_t num_started = 0;
+    shared_ptr<SubProcessSignal> signal = make_shared<SubProcessSignal>();
+    vector<shared_ptr<ProcessState>> queued;   // In start order.
+    vector<shared_ptr<ProcessState>> active;   // Started, not yet returned by wait_any.
+
+    void Launch(ProcessState &ps) {
+        ps.queued = false;
+        if (ps.killed) return;
+        vector<const char *> cmdl;
+        for (auto &a : ps.cmdline) cmdl.push_back(a.c_str());
+        cmdl.push_back(nullptr);
+        ps.sp.reset(StartSubProcess(cmdl.data(), signal));
+        if (!ps.sp) return;
+        if (!ps.pending_stdin.empty()) ps.sp->WriteStdin(ps.pending_stdin);
+        ps.pending_stdin.clear();
+        if (!ps.keep_stdin_open || ps.stdin_closed) ps.sp->CloseStdin();
+    }
+
+    void Pump() {
+        size_t running = 0;
+        for (auto &ps : active) if (!ps->Done()) running++;
+        size_t i = 0;
+        for (; i < queued.size() && running < max_running; i++) {
+            Launch(*queued[i]);
+            active.push_back(queued[i]);
+            if (!active.back()->Done()) running++;
+        }
+        queued.erase(queued.begin(), queued.begin() + i);
+    }
+
+    // Keeps starting queued processes as others finish, until pred() holds or timeout seconds
+    // have passed (no limit if negative). Returns pred().
+    template<typename F> bool WaitFor(double timeout, F pred) {
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(std::max(timeout, 0.0)));
+        for (;;) {
+            int64_t finished;
+            {
+                lock_guard<mutex> lock(signal->mtx);
+                finished = signal->finished;
+            }
+            Pump();
+            if (pred()) return true;
+            unique_lock<mutex> lock(signal->mtx);
+            auto changed = [&]() { return signal->finished != finished; };
+            if (timeout < 0) {
+                signal->cv.wait(lock, changed);
+            } else if (!signal->cv.wait_until(lock, deadline, changed)) {
+                lock.unlock();
+                Pump();
+                return pred();
+            }
+        }
+    }
+};
+
+struct ProcessPool : Resource {
+    shared_ptr<PoolState> pool = make_shared<PoolState>();
+};
+
+struct Process : Resource {
+    shared_ptr<PoolState> pool;
+    shared_ptr<ProcessState> ps;
+
+    Process(shared_ptr<PoolState> pool, shared_ptr<ProcessState> ps) : pool(pool), ps(ps) {}
+};
+
+static ResourceType process_pool_type = { "processpool" };
+static ResourceType process_type = { "process" };
+
+static Process &GetProcess(const Value &res) {
+    auto &p = GetResourceDec<Process>(res, &process_type);
+    p.pool->Pump();
+    return p;
+}
+
 void AddFile(NativeRegistry &nfr) {
 
 nfr("scan_folder", "folder,rel", "SB?", "S]?I]?",
@@ -193,6 +491,119 @@ nfr("exists_file", "file", "S", "B", "checks wether a file exists.",
         return Value(ok);
     });
 
+nfr("file_open_read", "file", "S", "R:file?",
+    "opens a file for streaming reads with file_read_chunk / file_read_line, without loading"
+    " it all into memory. searches the same dirs as read_file (but not pak files). returns"
+    " nil if the file can't be found.",
+    [](StackPtr &, VM &vm, Value &file) {
+        auto path = FindDataFile(file.sval()->strv());
+        if (path.empty()) return NilVal();
+        auto fs = new FileStream();
+        if (!fs->OpenRead(path)) {
+            delete fs;
+            return NilVal();
+        }
+        return Value(vm.NewResource(&file_type, fs));
+    });
+
+nfr("file_open_write", "file,append,absolute_path", "SB?I?", "R:file?",
+    "opens a file for buffered writing with file_write. truncates the file unless append is"
+    " true. returns nil if the file can't be opened.",
+    [](StackPtr &, VM &vm, Value &file, Value &append, Value &absolute) {
+        auto fs = new FileStream();
+        if (!fs->OpenWrite(file.sval()->strv(), append.True(), absolute.True())) {
+            delete fs;
+            return NilVal();
+        }
+        return Value(vm.NewResource(&file_type, fs));
+    });
+
+nfr("file_map", "file", "S", "R:file?",
+    "maps a file into memory read-only, usable with the same functions as file_open_read,"
+    " but seeking is free and pages are only loaded by the OS as they get read. returns nil"
+    " if the file can't be found or mapped.",
+    [](StackPtr &, VM &vm, Value &file) {
+        auto path = FindDataFile(file.sval()->strv());
+        if (path.empty()) return NilVal();
+        auto fs = new FileStream();
+        if (!fs->Map(path)) {
+            delete fs;
+            return NilVal();
+        }
+        return Value(vm.NewResource(&file_type, fs));
+    });
+
+nfr("file_read_chunk", "f,buf,len", "R:fileSkI", "SI",
+    "reads up to len bytes into buf starting at index 0, so the same buffer can be passed in"
+    " for every chunk, and read from with read_int32_le etc. the buffer is only"
+    " reallocated if it is smaller than len. returns the buffer, and the amount of bytes read"
+    " (less than len only at the end of the file, 0 once there is nothing left)",
+    [](StackPtr &sp, VM &vm) {
+        auto len = Pop(sp).ival();
+        auto buf = Pop(sp).sval();
+        auto &fs = GetFileStream(vm, Pop(sp), false);
+        if (len < 0) vm.BuiltinError("file_read_chunk: negative length");
+        if (buf->len < len) {
+            buf->Dec(vm);
+            buf = vm.NewString(len);
+        }
+        auto n = fs.Read((char *)buf->data(), (size_t)len);
+        Push(sp, buf);
+        Push(sp, (iint)n);
+    });
+
+nfr("file_read_line", "f", "R:file", "S?",
+    "reads the next line (without the line ending), or returns nil at the end of the file.",
+    [](StackPtr &, VM &vm, Value &res) {
+        auto &fs = GetFileStream(vm, res, false);
+        if (!fs.ReadLine(fs.line)) return NilVal();
+        return Value(vm.NewString(fs.line));
+    });
+
+nfr("file_write", "f,contents", "R:fileS", "B",
+    "appends a string at the current position. returns false if writing failed.",
+    [](StackPtr &, VM &vm, Value &res, Value &contents) {
+        auto &fs = GetFileStream(vm, res, true);
+        auto s = contents.sval();
+        return Value(fwrite(s->data(), 1, (size_t)s->len, fs.f) == (size_t)s->len);
+    });
+
+nfr("file_flush", "f", "R:file", "B",
+    "writes any buffered data to the file. returns false if that failed.",
+    [](StackPtr &, VM &vm, Value &res) {
+        auto &fs = GetFileStream(vm, res, true);
+        return Value(fflush(fs.f) == 0);
+    });
+
+nfr("file_seek", "f,pos", "R:fileI", "B",
+    "sets the position from the start of the file for the next read or write. returns false"
+    " if it is out of range.",
+    [](StackPtr &, VM &vm, Value &res, Value &pos) {
+        auto &fs = GetFileStream(vm, res);
+        return Value(fs.Seek(pos.ival()));
+    });
+
+nfr("file_tell", "f", "R:file", "I",
+    "returns the current position from the start of the file.",
+    [](StackPtr &, VM &vm, Value &res) {
+        auto &fs = GetFileStream(vm, res);
+        return Value(fs.Tell());
+    });
+
+nfr("file_size", "f", "R:file", "I",
+    "returns the size of the file in bytes, or -1 if it can't be determined.",
+    [](StackPtr &, VM &vm, Value &res) {
+        auto &fs = GetFileStream(vm, res);
+        return Value(fs.Size());
+    });
+
+nfr("file_close", "f", "R:file", "",
+    "closes the file now, rather than when the handle is freed. it can't be used afterwards.",
+    [](StackPtr &, VM &, Value &res) {
+        GetResourceDec<FileStream>(res, &file_type).Close();
+        return NilVal();
+    });
+
 nfr("launch_subprocess", "commandline,stdin", "S]S?", "IS",
     "launches a sub process, with optionally a stdin for the process, and returns its"
     " return code (or -1 if it couldn't launch at all), and any output",
@@ -210,6 +621,140 @@ nfr("launch_subprocess", "commandline,stdin", "S]S?", "IS",
         Push(sp, vm.NewString(out));
     });
 
+nfr("process_pool", "max_running", "I?", "R:processpool",
+    "creates a pool to run sub processes in the background with process_start, at most"
+    " max_running at a time (default: the number of hardware threads).",
+    [](StackPtr &, VM &vm, Value &max_running) {
+        auto pp = new ProcessPool();
+        auto n = max_running.ival();
+        pp->pool->max_running = n > 0 ? (size_t)n : (size_t)NumHWThreads();
+        return Value(vm.NewResource(&process_pool_type, pp));
+    });
+
+nfr("process_start", "pool,commandline,stdin,keep_stdin_open", "R:processpoolS]S?B?",
+    "R:process",
+    "queues a sub process to be launched as soon as the pool has room, and returns"
+    " immediately. stdin is written to it on launch, after which its stdin is closed unless"
+    " keep_stdin_open is true, in which case process_write can be used to send more."
+    " use process_read to get output as it comes in. if it can't be launched it is"
+    " done immediately, with exit code -1.",
+    [](StackPtr &, VM &vm, Value &res, Value &commandline, Value &stdins, Value &keep_open) {
+        auto &pool = GetResourceDec<ProcessPool>(res, &process_pool_type).pool;
+        auto ps = make_shared<ProcessState>();
+        auto cl = commandline.vval();
+        for (iint i = 0; i < cl->len; i++) ps->cmdline.push_back(string(cl->At(i).sval()->strv()));
+        if (stdins.True()) ps->pending_stdin = stdins.sval()->strv();
+        ps->keep_stdin_open = keep_open.True();
+        ps->index = pool->num_started++;
+        pool->queued.push_back(ps);
+        pool->Pump();
+        return Value(vm.NewResource(&process_type, new Process(pool, ps)));
+    });
+
+nfr("process_read", "process", "R:process", "SS",
+    "returns any stdout and stderr output the process produced since the last call."
+    " never blocks.",
+    [](StackPtr &sp, VM &vm) {
+        auto &p = GetProcess(Pop(sp));
+        string out, err;
+        if (p.ps->sp) p.ps->sp->TakeOutput(out, err);
+        Push(sp, vm.NewString(out));
+        Push(sp, vm.NewString(err));
+    });
+
+nfr("process_write", "process,data", "R:processS", "B",
+    "sends data to the stdin of a process started with keep_stdin_open. returns false if"
+    " its stdin has been closed.",
+    [](StackPtr &, VM &, Value &res, Value &data) {
+        auto &ps = *GetProcess(res).ps;
+        if (!ps.keep_stdin_open || ps.stdin_closed) return Value(false);
+        if (ps.queued) {
+            ps.pending_stdin += data.sval()->strv();
+            return Value(true);
+        }
+        return Value(ps.sp && ps.sp->WriteStdin(data.sval()->strv()));
+    });
+
+nfr("process_close_stdin", "process", "R:process", "",
+    "closes stdin of a process started with keep_stdin_open, signaling end of input.",
+    [](StackPtr &, VM &, Value &res) {
+        auto &ps = *GetProcess(res).ps;
+        ps.stdin_closed = true;
+        if (ps.sp) ps.sp->CloseStdin();
+        return NilVal();
+    });
+
+nfr("process_done", "process", "R:process", "B",
+    "whether the process has exited (or couldn't be launched). never blocks.",
+    [](StackPtr &, VM &, Value &res) {
+        return Value(GetProcess(res).ps->Done());
+    });
+
+nfr("process_wait", "process,timeout", "R:processF?:/", "B",
+    "waits until the process is done, or timeout seconds have passed (default: forever)."
+    " returns whether it is done.",
+    [](StackPtr &, VM &, Value &res, Value &timeout) {
+        auto &p = GetProcess(res);
+        auto &ps = *p.ps;
+        return Value(p.pool->WaitFor(timeout.fval(), [&]() { return ps.Done(); }));
+    });
+
+nfr("process_wait_any", "pool,timeout", "R:processpoolF?:/", "R:process?",
+    "waits until any process in the pool is done, or timeout seconds have passed"
+    " (default: forever). returns a process that is done, each process only once, or nil if"
+    " none finished in time or there are no more processes left. use process_index to find"
+    " out which one it is.",
+    [](StackPtr &, VM &vm, Value &res, Value &timeout) {
+        auto &pool = GetResourceDec<ProcessPool>(res, &process_pool_type).pool;
+        shared_ptr<ProcessState> done;
+        pool->WaitFor(timeout.fval(), [&]() {
+            if (pool->active.empty() && pool->queued.empty()) return true;
+            for (auto [i, ps] : enumerate(pool->active)) {
+                if (ps->Done()) {
+                    done = ps;
+                    pool->active.erase(pool->active.begin() + i);
+                    return true;
+                }
+            }
+            return false;
+        });
+        return done ? Value(vm.NewResource(&process_type, new Process(pool, done))) : NilVal();
+    });
+
+nfr("process_wait_all", "pool,timeout", "R:processpoolF?:/", "B",
+    "waits until all processes in the pool are done, or timeout seconds have passed"
+    " (default: forever). returns whether they are all done.",
+    [](StackPtr &, VM &, Value &res, Value &timeout) {
+        auto &pool = GetResourceDec<ProcessPool>(res, &process_pool_type).pool;
+        return Value(pool->WaitFor(timeout.fval(), [&]() {
+            if (!pool->queued.empty()) return false;
+            for (auto &ps : pool->active) if (!ps->Done()) return false;
+            return true;
+        }));
+    });
+
+nfr("process_exit_code", "process", "R:process", "I",
+    "the exit code of a process that is done, or -1 if it is still running or couldn't be"
+    " launched.",
+    [](StackPtr &, VM &, Value &res) {
+        return Value(GetProcess(res).ps->ExitCode());
+    });
+
+nfr("process_index", "process", "R:process", "I",
+    "the order in which this process was started on its pool, starting from 0.",
+    [](StackPtr &, VM &, Value &res) {
+        return Value((iint)GetProcess(res).ps->index);
+    });
+
+nfr("process_kill", "process", "R:process", "",
+    "terminates the process, or makes sure it never starts if it was still queued.",
+    [](StackPtr &, VM &, Value &res) {
+        auto &ps = *GetProcess(res).ps;
+        ps.killed = true;
+        if (ps.sp) ps.sp->Kill();
+        return NilVal();
+    });
+
 nfr("vector_to_buffer", "vec,width", "A]*I?:4", "S",
     "converts a vector of ints/floats (or structs of them) to a buffer, where"
     " each scalar is written with \"width\" bytes (1/2/4/8, default 4). Returns nil if the"
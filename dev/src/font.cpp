@@ -137,7 +137,6 @@ nfr("gl_text", "text", "S", "Sb",
             otransforms.push();
             otransforms.append_object2view(scaling(curfontsize / float(maxfontsize)));
         }
-        SetTexture(0, f->tex);
         texturedshader->Set();
         f->RenderText(s.sval()->strv());
         if (curfontsize > maxfontsize) {
@@ -32,95 +32,51 @@
 
 FT_Library library = nullptr;
 
+// Pages beyond this are only created if all existing ones hold glyphs needed for the
+// current text, otherwise the least recently used page gets evicted.
+const int max_atlas_pages = 4;
+const size_t max_cached_runs = 1024;
+const int glyph_margin = 1;
+
 BitmapFont::~BitmapFont() {
-    DeleteTexture(tex);
+    for (auto &page : pages) DeleteTexture(page.tex);
 }
 
 BitmapFont::BitmapFont(OutlineFont *_font, int _size, float _osize)
-    : tex(DummyTexture()), font_height(_size), outlinesize(_osize), font(_font) {}
+    : font_height(_size), outlinesize(_osize), font(_font) {}
 
 bool BitmapFont::CacheChars(string_view text) {
     usedcount++;
-    font->EnsureCharsPresent(text);
-    if (positions.size() == font->unicodetable.size())
-        return true;
-    DeleteTexture(tex);
-    positions.clear();
-    if (FT_Set_Pixel_Sizes((FT_Face)font->fthandle, 0, font_height))
-        return false;
-    auto face = (FT_Face)font->fthandle;
-    const int outline_passes = outlinesize > 0 ? 2 : 1;
+    usetick++;
     FT_Stroker stroker = nullptr;
-    if (outline_passes > 1) {
-        FT_Stroker_New(library, &stroker);
-        FT_Stroker_Set(stroker, FT_Fixed(outlinesize * 64), FT_STROKER_LINECAP_ROUND,
-                       FT_STROKER_LINEJOIN_ROUND, 0);
-    }
-    const int margin = 1;
-    int texw = min(4096, MaxTextureSize());
-    vector<byte4> image;
-    auto x = margin, y = margin;
-    int rowheight = 0;
-    max_ascent = 0;
-    int max_descent = 0;
-    for (int i : font->unicodetable) {
-        auto char_index = FT_Get_Char_Index(face, i);
-        FT_Load_Glyph(face, char_index, FT_LOAD_DEFAULT);
-        auto advance = (int)((face->glyph->metrics.horiAdvance + FT_Fixed(outlinesize * 64)) / 64);
-        int maxwidth = 0;
-        for (int pass = 0; pass < outline_passes; pass++) {
-            FT_Glyph glyph;
-            FT_Get_Glyph(face->glyph, &glyph);
-            if (!pass && stroker) FT_Glyph_StrokeBorder(&glyph, stroker, false, true);
-            FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, nullptr, true);
-            FT_BitmapGlyph bglyph = (FT_BitmapGlyph)glyph;
-            auto width = (int)bglyph->bitmap.width;
-            auto height = (int)bglyph->bitmap.rows;
-            max_ascent = max(bglyph->top, max_ascent);
-            max_descent = min(bglyph->top - height, max_descent);
-            int offx = 0, offy = 0;
-            if (!pass) {
-                if (width > texw - x) {
-                    x = margin;
-                    y = rowheight + margin;
-                }
-                positions.push_back(Glyph {
-                    x, y, advance,
-                    bglyph->left, bglyph->top,
-                    width, height
-                });
-                maxwidth = width;
-                rowheight = max(rowheight, y + height);
-            } else {
-                offx = bglyph->left - positions.back().left;
-                offy = positions.back().top - bglyph->top;
+    bool sized = false;
+    bool ok = true;
+    auto old_ascent = max_ascent;
+    for (;;) {
+        int c = FromUTF8(text);
+        if (c <= 0)
+            break;
+        auto it = glyphs.find(c);
+        if (it != glyphs.end()) {
+            if (it->second.page >= 0) pages[it->second.page].lastused = usetick;
+            continue;
+        }
+        // Only pay for FreeType setup if there are actually glyphs to rasterize.
+        if (!sized) {
+            if (FT_Set_Pixel_Sizes((FT_Face)font->fthandle, 0, font_height)) {
+                ok = false;
+                break;
             }
-            for (int row = 0; row < height; ++row) {
-                for (int pixel = 0; pixel < width; ++pixel) {
-                    auto off = (x + offx + pixel) + (y + offy + row) * texw;
-                    if ((int)image.size() <= off) {
-                        image.resize(off + 16, byte4_0);
-                    }
-                    auto alpha = bglyph->bitmap.buffer[pixel + row * bglyph->bitmap.pitch];
-                    if (outline_passes > 1) {
-                        if (!pass) {
-                            image[off] = { 0x00, 0x00, 0x00, alpha };
-                        } else {
-                            auto cur_alpha = image[off].w;
-                            auto max_alpha = max(cur_alpha, alpha);
-                            auto col = (uint8_t)mix(0x00, 0xFF, alpha / 255.0f);
-                            image[off] = { col, col, col, max_alpha };
-                        }
-                    } else {
-                        // FIXME: wastefull
-                        image[off] = { 0xFF, 0xFF, 0xFF, alpha };
-                    }
-                }
+            if (outlinesize > 0) {
+                FT_Stroker_New(library, &stroker);
+                FT_Stroker_Set(stroker, FT_Fixed(outlinesize * 64), FT_STROKER_LINECAP_ROUND,
+                               FT_STROKER_LINEJOIN_ROUND, 0);
             }
-            FT_Done_Glyph(glyph);
+            sized = true;
         }
-        x += maxwidth + margin;
+        RasterizeGlyph(c, stroker);
     }
+    if (stroker) FT_Stroker_Done(stroker);
     // FIXME: there appears to be no way to figure out the "baseline" in pixels, such
     // that we can place characters within a font_height bounding box correctly.
     // We have the max_ascent computed here, and also face->ascender etc, but even though
@@ -129,64 +85,212 @@ bool BitmapFont::CacheChars(string_view text) {
     // outside of it.
     // So we do something horrible, which actually works well for all fonts tested, and
     // thats to adjust by whatever amount we are bigger (or smaller) than the fontsize.
-    max_ascent += (font_height - (max_ascent - max_descent)) / 2;
-    if (stroker) FT_Stroker_Done(stroker);
-    int texh = 1;
-    while (texh <= (int)image.size() / texw)
-        texh *= 2;
-    image.resize(texh * texw);
-    tex = CreateTexture("font_atlas", &image[0].x, int3(texw, texh, 0), TF_CLAMP | TF_NOMIPMAP);
-    return true;
+    max_ascent = raw_ascent + (font_height - (raw_ascent - raw_descent)) / 2;
+    // Any runs laid out with the old baseline are now wrong.
+    if (max_ascent != old_ascent) generation++;
+    return ok;
 }
 
-void BitmapFont::RenderText(string_view text) {
+void BitmapFont::RasterizeGlyph(int c, void *stroker) {
+    LOBSTER_TIMED_SCOPE("font_glyph");
+    auto face = (FT_Face)font->fthandle;
+    auto char_index = FT_Get_Char_Index(face, c);
+    FT_Load_Glyph(face, char_index, FT_LOAD_DEFAULT);
+    auto advance = (int)((face->glyph->metrics.horiAdvance + FT_Fixed(outlinesize * 64)) / 64);
+    const int outline_passes = stroker ? 2 : 1;
+    Glyph g { 0, 0, advance, 0, 0, 0, 0, -1 };
+    for (int pass = 0; pass < outline_passes; pass++) {
+        FT_Glyph glyph;
+        FT_Get_Glyph(face->glyph, &glyph);
+        if (!pass && stroker) FT_Glyph_StrokeBorder(&glyph, (FT_Stroker)stroker, false, true);
+        FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, nullptr, true);
+        FT_BitmapGlyph bglyph = (FT_BitmapGlyph)glyph;
+        auto width = (int)bglyph->bitmap.width;
+        auto height = (int)bglyph->bitmap.rows;
+        raw_ascent = max(bglyph->top, raw_ascent);
+        raw_descent = min(bglyph->top - height, raw_descent);
+        int offx = 0, offy = 0;
+        if (!pass) {
+            g.left = bglyph->left;
+            g.top = bglyph->top;
+            g.width = width;
+            g.height = height;
+            scratch.assign(width * height, byte4_0);
+        } else {
+            offx = bglyph->left - g.left;
+            offy = g.top - bglyph->top;
+        }
+        for (int row = 0; row < height; ++row) {
+            for (int pixel = 0; pixel < width; ++pixel) {
+                auto px = offx + pixel;
+                auto py = offy + row;
+                // The fill should always be inside the border, but clip just in case.
+                if (px < 0 || py < 0 || px >= g.width || py >= g.height) continue;
+                auto &dest = scratch[px + py * g.width];
+                auto alpha = bglyph->bitmap.buffer[pixel + row * bglyph->bitmap.pitch];
+                if (outline_passes > 1) {
+                    if (!pass) {
+                        dest = { 0x00, 0x00, 0x00, alpha };
+                    } else {
+                        auto max_alpha = max(dest.w, alpha);
+                        auto col = (uint8_t)mix(0x00, 0xFF, alpha / 255.0f);
+                        dest = { col, col, col, max_alpha };
+                    }
+                } else {
+                    // FIXME: wastefull
+                    dest = { 0xFF, 0xFF, 0xFF, alpha };
+                }
+            }
+        }
+        FT_Done_Glyph(glyph);
+    }
+    int2 pos;
+    if (g.width && g.height && AllocGlyph(int2(g.width, g.height), g.page, pos)) {
+        g.x = pos.x;
+        g.y = pos.y;
+        UpdateTexture(pages[g.page].tex, &scratch[0].x, pos, int2(g.width, g.height));
+    } else {
+        // Whitespace, or too big to ever fit a page: only contributes its advance.
+        g.width = g.height = 0;
+        g.page = -1;
+    }
+    glyphs[c] = g;
+}
+
+bool BitmapFont::AllocGlyph(int2 size, int &page, int2 &pos) {
+    if (pagesize.x == 0) {
+        // Big enough to hold a decent amount of glyphs of this size.
+        int maxside = min(4096, MaxTextureSize());
+        int side = 256;
+        while (side < maxside && side < (font_height + int(outlinesize) * 2) * 16) side *= 2;
+        pagesize = int2(side);
+    }
+    auto need = size + glyph_margin;
+    if (need.x > pagesize.x - glyph_margin || need.y > pagesize.y - glyph_margin) return false;
+    auto fits = [&](int p) {
+        auto &pg = pages[p];
+        // Pick the tightest shelf that still has room.
+        Shelf *best = nullptr;
+        for (auto &shelf : pg.shelves) {
+            if (shelf.height >= need.y && pagesize.x - shelf.x >= need.x &&
+                (!best || shelf.height < best->height))
+                best = &shelf;
+        }
+        if (!best) {
+            auto top = pg.shelves.empty() ? glyph_margin
+                                          : pg.shelves.back().y + pg.shelves.back().height;
+            // Round up, such that glyphs of similar height can share a shelf.
+            auto height = min((need.y + 7) & ~7, pagesize.y - top);
+            if (height < need.y) return false;
+            pg.shelves.push_back({ top, height, glyph_margin });
+            best = &pg.shelves.back();
+        }
+        pos = int2(best->x, best->y);
+        best->x += need.x;
+        pg.lastused = usetick;
+        page = p;
+        return true;
+    };
+    for (int p = 0; p < (int)pages.size(); p++) {
+        if (fits(p)) return true;
+    }
+    int lru = -1;
+    if ((int)pages.size() >= max_atlas_pages) {
+        for (int p = 0; p < (int)pages.size(); p++) {
+            if (pages[p].lastused != usetick && (lru < 0 || pages[p].lastused < pages[lru].lastused))
+                lru = p;
+        }
+    }
+    if (lru >= 0) {
+        EvictPage(lru);
+    } else {
+        lru = (int)pages.size();
+        pages.push_back(Page { CreateColoredTexture("font_atlas", int3(pagesize, 0), float4_0,
+                                                    TF_CLAMP | TF_NOMIPMAP) });
+    }
+    return fits(lru);
+}
+
+void BitmapFont::EvictPage(int page) {
+    for (auto it = glyphs.begin(); it != glyphs.end(); ) {
+        if (it->second.page == page) it = glyphs.erase(it);
+        else it++;
+    }
+    auto &pg = pages[page];
+    pg.shelves.clear();
+    // Clear the texture, such that filtering at glyph edges can't pick up old glyphs.
+    scratch.assign(pagesize.x * pagesize.y, byte4_0);
+    UpdateTexture(pg.tex, &scratch[0].x, int2_0, pagesize);
+    generation++;
+}
+
+BitmapFont::TextRun *BitmapFont::Layout(string_view text) {
+    run_key.assign(text.data(), text.size());
+    auto it = runs.find(run_key);
+    if (it != runs.end() && it->second.generation == generation) {
+        usedcount++;
+        usetick++;
+        for (auto &batch : it->second.batches) pages[batch.page].lastused = usetick;
+        return &it->second;
+    }
     if (!CacheChars(text))
-        return;
-    struct PT { float2 p; float2 t; };
-    int len = StrLenUTF8(text);
-    if (len <= 0)
-        return;
-    vector<PT> vbuf(len * 4);
-    vector<int> ibuf(len * 6);
-    auto x = 0.0f;
-    auto y = 0.0f;
-    int idx = 0;
-    for (int j = 0; j < len * 4; j += 4) {
+        return nullptr;
+    if (it == runs.end()) {
+        // Don't let UIs that generate lots of unique strings grow this without bounds.
+        if (runs.size() >= max_cached_runs) runs.clear();
+        it = runs.insert({ run_key, TextRun() }).first;
+    }
+    auto &run = it->second;
+    run.batches.clear();
+    run.generation = generation;
+    auto x = 0;
+    for (;;) {
         int c = FromUTF8(text);
-        auto &glyph = positions[font->unicodemap[c]];
-        float x1 = glyph.x / float(tex.size.x);
-        float x2 = (glyph.x + glyph.width) / float(tex.size.x);
-        float y1 = glyph.y / float(tex.size.y);
-        float y2 = (glyph.y + glyph.height) / float(tex.size.y);
-        float ox = x + glyph.left;
-        float oy = y + (max_ascent - glyph.top);
-        vbuf[j + 0] = { float2(ox, oy), float2(x1, y1) };
-        vbuf[j + 1] = { float2(ox, oy + glyph.height), float2(x1, y2) };
-        vbuf[j + 2] = { float2(ox + glyph.width, oy + glyph.height), float2(x2, y2) };
-        vbuf[j + 3] = { float2(ox + glyph.width, oy), float2(x2, y1) };
-        ibuf[idx++] = j + 0;
-        ibuf[idx++] = j + 1;
-        ibuf[idx++] = j + 2;
-        ibuf[idx++] = j + 2;
-        ibuf[idx++] = j + 3;
-        ibuf[idx++] = j + 0;
+        if (c <= 0)
+            break;
+        auto &glyph = glyphs[c];
+        if (glyph.page >= 0) {
+            TextRun::Batch *batch = nullptr;
+            for (auto &b : run.batches) if (b.page == glyph.page) batch = &b;
+            if (!batch) {
+                run.batches.push_back({ glyph.page, {}, {} });
+                batch = &run.batches.back();
+            }
+            float x1 = glyph.x / float(pagesize.x);
+            float x2 = (glyph.x + glyph.width) / float(pagesize.x);
+            float y1 = glyph.y / float(pagesize.y);
+            float y2 = (glyph.y + glyph.height) / float(pagesize.y);
+            float ox = float(x + glyph.left);
+            float oy = float(max_ascent - glyph.top);
+            auto j = (int)batch->vbuf.size();
+            batch->vbuf.push_back({ float2(ox, oy), float2(x1, y1) });
+            batch->vbuf.push_back({ float2(ox, oy + glyph.height), float2(x1, y2) });
+            batch->vbuf.push_back({ float2(ox + glyph.width, oy + glyph.height), float2(x2, y2) });
+            batch->vbuf.push_back({ float2(ox + glyph.width, oy), float2(x2, y1) });
+            for (auto i : { 0, 1, 2, 2, 3, 0 }) batch->ibuf.push_back(j + i);
+        }
         x += glyph.advance;
     }
-    SetTexture(0, tex);
+    run.size = int2(x, font_height);
+    return &run;
+}
+
+void BitmapFont::RenderText(string_view text) {
+    auto run = Layout(text);
+    if (!run)
+        return;
     if (!Is2DMode()) CullFace(false);
-    RenderArraySlow("RenderText", PRIM_TRIS, gsl::make_span(vbuf), "pT", gsl::make_span(ibuf));
+    for (auto &batch : run->batches) {
+        SetTexture(0, pages[batch.page].tex);
+        RenderArraySlow("RenderText", PRIM_TRIS, gsl::make_span(batch.vbuf), "pT",
+                        gsl::make_span(batch.ibuf));
+    }
     if (!Is2DMode()) CullFace(true);
 }
 
 const int2 BitmapFont::TextSize(string_view text) {
-    if (!CacheChars(text))
-        return int2_0;
-    auto x = 0;
-    for (;;) {
-        int c = FromUTF8(text);
-        if (c <= 0) return int2(x, font_height);
-        x += positions[font->unicodemap[c]].advance;
-    }
+    auto run = Layout(text);
+    return run ? run->size : int2_0;
 }
 
 OutlineFont *LoadFont(string_view name) {
@@ -228,22 +332,6 @@ int OutlineFont::GetCharCode(string_view_nt name) {
     return glyph_to_char[glyphi];
 }
 
-bool OutlineFont::EnsureCharsPresent(string_view utf8str) {
-    bool anynew = false;
-    for (;;) {
-        int uc = FromUTF8(utf8str);
-        if (uc <= 0)
-            break;
-        auto it = unicodemap.find(uc);
-        if (it == unicodemap.end()) {
-            anynew = true;
-            unicodemap[uc] = (int)unicodetable.size();
-            unicodetable.push_back(uc);
-        }
-    }
-    return anynew;
-}
-
 void FTClosedown() {
     if (library) FT_Done_FreeType(library);
     library = nullptr;
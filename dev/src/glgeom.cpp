@@ -17,6 +17,7 @@
 #include "lobster/vmdata.h"
 #include "lobster/glinterface.h"
 #include "lobster/glincludes.h"
+#include "lobster/anim.h"
 
 int GenBO_(string_view name, int type, size_t bytesize, const void *data, bool dyn) {
     int bo;
@@ -130,19 +131,19 @@ void BindAsSSBO(Shader *sh, string_view_nt name, int id) {
     #endif
 }
 
-void Mesh::Render(Shader *sh) {
+void Mesh::Render(Shader *sh, const float3x4 *bones) {
     if (prim == PRIM_POINT) SetPointSprite(pointsize);
     sh->Set();
     if (numbones && numframes) {
-        int frame1 = ffloor(curanim);
-        int frame2 = frame1 + 1;
-        float frameoffset = curanim - frame1;
-        float3x4 *mat1 = &mats[(frame1 % numframes) * numbones],
-                 *mat2 = &mats[(frame2 % numframes) * numbones];
-        auto outframe = new float3x4[numbones];
-        for(int i = 0; i < numbones; i++) outframe[i] = mix(mat1[i], mat2[i], frameoffset);
-        sh->SetAnim(outframe, numbones);
-        delete[] outframe;
+        if (!bones) {
+            if (posed != curanim || pose.empty()) {
+                pose.resize(numbones);
+                lobster::PoseFrame(mats, numframes, numbones, curanim, pose.data());
+                posed = curanim;
+            }
+            bones = pose.data();
+        }
+        sh->SetAnim(bones, numbones);
     }
     geom->RenderSetup();
     if (surfs.size()) {
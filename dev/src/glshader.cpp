@@ -453,9 +453,9 @@ void Shader::Set() {
                              float2(GetFrameBufferSize(GetScreenSize())).begin()));
 }
 
-void Shader::SetAnim(float3x4 *bones, int num) {
+void Shader::SetAnim(const float3x4 *bones, int num) {
     // FIXME: Check if num fits with shader def.
-    if (bones_i >= 0) GL_CALL(glUniform4fv(bones_i, num * 3, (float *)bones));
+    if (bones_i >= 0) GL_CALL(glUniform4fv(bones_i, num * 3, (const float *)bones));
 }
 
 void Shader::SetTextures(const vector<Texture> &textures) {
@@ -243,6 +243,14 @@ void DeleteTexture(Texture &tex) {
     tex.id = 0;
 }
 
+// Overwrites a region of an existing RGBA8 2D texture.
+void UpdateTexture(const Texture &tex, const uint8_t *buf, const int2 &pos, const int2 &size) {
+    GL_CALL(glBindTexture(tex.type, tex.id));
+    GL_CALL(glTexSubImage2D(tex.type, 0, pos.x, pos.y, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE,
+                            buf));
+    GL_CALL(glBindTexture(tex.type, 0));
+}
+
 void SetTexture(int textureunit, const Texture &tex) {
     GL_CALL(glActiveTexture(GL_TEXTURE0 + textureunit));
     glBindTexture(tex.type, tex.id);
@@ -20,6 +20,7 @@
 #include "lobster/sdlinterface.h"
 
 #include "lobster/graphics.h"
+#include "lobster/anim.h"
 
 using namespace lobster;
 
@@ -881,6 +882,31 @@ nfr("gl_render_mesh", "m", "R:mesh", "",
         return NilVal();
     });
 
+nfr("gl_mesh_anim", "m", "R:mesh", "R:animclip",
+    "the bones of all frames of animated mesh m, for use with anim_poses. instances of the mesh"
+    " can then be animated all at once with anim_evaluate, which is much faster than"
+    " gl_animate_mesh for many instances, and rendered with gl_render_mesh_pose.",
+    [](StackPtr &, VM &vm, Value &i) {
+        auto &m = GetMesh(i);
+        if (!m.numbones || !m.numframes) vm.BuiltinError("gl_mesh_anim: mesh is not animated");
+        return NewAnimClip(vm, m.numbones, m.numframes, m.mats);
+    });
+
+nfr("gl_render_mesh_pose", "m,poses,instance", "R:meshR:animposesI", "",
+    "renders the specified mesh with the bones of an instance in poses (see anim_poses)",
+    [](StackPtr &, VM &vm, Value &i, Value &poses, Value &instance) {
+        TestGL(vm);
+        auto &ap = GetAnimPoses(poses);
+        auto &m = GetMesh(i);
+        if (m.numbones != ap.clip->numbones)
+            vm.BuiltinError("gl_render_mesh_pose: mesh does not match poses");
+        auto inst = instance.ival();
+        if (inst < 0 || inst >= ssize(ap.params))
+            vm.BuiltinError("gl_render_mesh_pose: instance out of range");
+        m.Render(currentshader, ap.Bones(inst));
+        return NilVal();
+    });
+
 nfr("gl_save_mesh", "m,name", "R:meshS", "B",
     "saves the specified mesh to a file in the PLY format. useful if the mesh was generated"
     " procedurally. returns false if the file could not be written",
@@ -266,6 +266,9 @@ void ValToGUI(VM &vm, Value *v, const TypeInfo &ti, string_view_nt label, bool e
     }
     auto l = label.c_str();
     auto flags = expanded ? ImGuiTreeNodeFlags_DefaultOpen : 0;
+    // Packed objects get edited as a copy of their fields, which gets stored back below.
+    LObject *packed = nullptr;
+    vector<Value> packed_buf;
     switch (ti.t) {
         case V_INT: {
             if (ti.enumidx == 0) {
@@ -322,7 +325,12 @@ void ValToGUI(VM &vm, Value *v, const TypeInfo &ti, string_view_nt label, bool e
                 Nil();
                 break;
             }
-            v = v->oval()->Elems();  // To iterate it like a struct.
+            if (ti.packed_size) {
+                packed = v->oval();
+                v = (Value *)packed->ElemsUnpacked(ti, packed_buf);
+            } else {
+                v = v->oval()->Elems();  // To iterate it like a struct.
+            }
         case V_STRUCT_R:
         case V_STRUCT_S: {
             auto st = vm.bcf->udts()->Get(ti.structidx);
@@ -419,6 +427,9 @@ void ValToGUI(VM &vm, Value *v, const TypeInfo &ti, string_view_nt label, bool e
             Text(sd);
             break;
     }
+    if (packed) {
+        for (iint i = 0; i < ti.len; i++) packed->SetSlot(vm, ti, i, packed_buf[i]);
+    }
     if (in_table) {
         ImGui::PopID();
         //ImGui::PopItemWidth();
@@ -0,0 +1,564 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lazy and tiered JIT: functions get compiled by TCC one at a time, on first call, or, when
+// tiered, only once they get hot. Until then they are run by the interpreter below, which
+// executes the same ops as the generated code (see CGenerator::Function), directly from a
+// pre-decoded form of the bytecode.
+
+#include "lobster/stdafx.h"
+
+#include "lobster/il.h"
+#include "lobster/vmops.h"
+#include "lobster/tonative.h"
+
+#ifdef _WIN32
+    #include <malloc.h>
+    #define alloca _alloca
+#else
+    #include <alloca.h>
+#endif
+
+#if VM_JIT_MODE
+
+#if LOBSTER_ENGINE
+extern "C" void GLFrame(lobster::StackPtr sp, lobster::VM &vm);
+#endif
+
+namespace lobster {
+
+// Ops that need more than calling their U_ function get decoded into these instead.
+enum InterpOp {
+    I_PUSHVARL = IL_MAX_OPS,
+    I_PUSHVARVL,
+    I_LVAL_VARL,
+    I_JUMP,
+    I_GLFRAME,
+    I_RETURN,
+    I_GOTOFUNEXIT,
+    I_KEEPREF,
+    I_KEEPREFLOOP,
+    I_PUSHFUN,
+    I_CALL,
+    I_CALLV,
+    I_DDCALL,
+};
+
+struct InterpFun {
+    const int *funstart = nullptr;  // FUNSTART args, if any.
+    int numregs = 1, numlocals = 0, nkeepvars = 0;
+    // (varidx, local index), where the index is -1 for free variables.
+    vector<pair<int, int>> args, defs, owned;
+    bool restore_defs = false;
+    // [opcode, size, regso, operands...], with jump targets as indices into this.
+    vector<int> ins;
+    unordered_map<int, int> block_pos;  // Bytecode offset -> ins index.
+    // Loop block bytecode offset -> compiled code continuing from it. Guarded by LazyJIT::mtx.
+    unordered_map<int, void *> osr_entries;
+    // Shared by all threads running this program. It only counts, so needs no ordering.
+    atomic<int> hotness { 0 };
+
+    bool Heat(int threshold) { return hotness.fetch_add(1, memory_order_relaxed) + 1 >= threshold; }
+};
+
+struct LazyJIT {
+    CGenerator gen;
+    string fn;
+    bool tiered;
+    // Patched by whichever thread compiles a function, while others call through it. Compiled
+    // code sees this as a plain fun_base_t array.
+    unique_ptr<atomic<fun_base_t>[]> funtab;
+    vector<fun_base_t> stubtab;
+    vector<const void *> imports;
+    vector<void *> units;
+    vector<void *> exports;  // Of the main unit.
+    vector<unique_ptr<InterpFun>> interp_funs;
+    size_t num_compiled = 0, num_osr = 0;
+    double compile_time = 0;
+    // Worker threads (see vm.cpp StartWorkers) share all of the above, so decoding and compiling
+    // happen under this lock.
+    mutex mtx;
+
+    // Calls + loop iterations before a function gets compiled.
+    static const int hot_threshold = 1000;
+
+    typedef void (*osr_t)(VM &, StackPtr, Value *, Value *, Value *);
+
+    LazyJIT(NativeRegistry &nfr, string_view bytecode_buffer, string_view fn, int runtime_checks,
+            bool tiered)
+        : gen(nfr, bytecode_buffer, false, runtime_checks, true), fn(fn), tiered(tiered) {}
+
+    ~LazyJIT() {
+        for (auto u : units) FreeC(u);
+        LOG_INFO(tiered ? "tiered" : "lazy", " JIT: compiled ", num_compiled, " of ",
+                 stubtab.size(), " functions (", num_osr, " loops), in ", compile_time,
+                 " seconds");
+    }
+
+    // Must be called after gen.Init(). The tables get their stubs once the main unit has been
+    // relocated, but their addresses must be fixed before it is compiled.
+    void SetupImports() {
+        static_assert(sizeof(atomic<fun_base_t>) == sizeof(fun_base_t));
+        funtab.reset(new atomic<fun_base_t>[gen.fun_ids.size()]);
+        stubtab.resize(gen.fun_ids.size());
+        interp_funs.resize(gen.fun_ids.size());
+        for (auto imp = vm_ops_jit_table; *imp; imp += 2) {
+            imports.push_back(imp[0]);
+            imports.push_back(imp[1]);
+        }
+        imports.insert(imports.end(), {
+            "funtab", funtab.get(),
+            "stubtab", stubtab.data(),
+            "LazyCompile", (void *)&LazyCompile,
+            "lazy_context", this,
+            nullptr
+        });
+    }
+
+    void SetStubs(const fun_base_t *lazy_stubs) {
+        copy(lazy_stubs, lazy_stubs + stubtab.size(), stubtab.begin());
+        for (size_t i = 0; i < stubtab.size(); i++) funtab[i].store(lazy_stubs[i]);
+    }
+
+    // Must be called with mtx held.
+    void *Compile(VM &vm, int k, int osr_block) {
+        auto start_time = SecondsSinceStart();
+        string sd, error;
+        ToCLazyFunction(gen, sd, k, osr_block);
+        auto name = cat(osr_block >= 0 ? "osr_" : "fun_", gen.fun_ids[k]);
+        const char *export_names[] = { name.c_str(), nullptr };
+        vector<void *> exports;
+        auto unit = CompileC(sd.c_str(), error, imports.data(), export_names, exports);
+        if (!unit || !exports[0]) vm.SeriousError("libtcc JIT error: " + fn + ":\n" + error);
+        units.push_back(unit);
+        compile_time += SecondsSinceStart() - start_time;
+        return exports[0];
+    }
+
+    // Called by the stubs. Returns the compiled function, or nullptr if it was interpreted.
+    static fun_base_t LazyCompile(VM &vm, LazyJIT *jit, int k, StackPtr sp) {
+        auto cf = jit->funtab[k].load(memory_order_acquire);
+        if (cf != jit->stubtab[k]) return cf;
+        if (jit->tiered && !jit->Decode(k).Heat(hot_threshold)) {
+            jit->Interpret(vm, k, sp);
+            return nullptr;
+        }
+        lock_guard<mutex> lock(jit->mtx);
+        // Another thread may have compiled it while we were waiting.
+        cf = jit->funtab[k].load(memory_order_relaxed);
+        if (cf != jit->stubtab[k]) return cf;
+        cf = (fun_base_t)jit->Compile(vm, k, -1);
+        jit->funtab[k].store(cf, memory_order_release);
+        jit->num_compiled++;
+        return cf;
+    }
+
+    InterpFun &Decode(int k);
+    void Interpret(VM &vm, int k, StackPtr psp);
+};
+
+InterpFun &LazyJIT::Decode(int k) {
+    lock_guard<mutex> lock(mtx);
+    auto &fp = interp_funs[k];
+    if (fp) return *fp;
+    fp.reset(new InterpFun());
+    auto &f = *fp;
+    auto code = gen.code;
+    auto specidents = gen.specidents;
+    auto ip = code + gen.fun_ids[k];
+    unordered_map<int, int> var_to_local;
+    auto local = [&](int varidx) {
+        return specidents->Get(varidx)->used_as_freevar() ? -1 : var_to_local[varidx];
+    };
+    vector<pair<size_t, int>> fixups;  // (ins index, bytecode offset)
+    for (;;) {
+        int id = (int)(ip - code);
+        int opc = *ip++;
+        auto args = ip + 1;
+        int regso = -1;
+        ParseOpAndGetArity(opc, ip, regso);
+        auto start = f.ins.size();
+        auto emit = [&](int iopc, initializer_list<int> ops) {
+            f.ins.push_back(iopc);
+            f.ins.push_back((int)ops.size() + 3);
+            f.ins.push_back(regso);
+            f.ins.insert(f.ins.end(), ops);
+        };
+        auto target = [&](int offset) {
+            fixups.push_back({ f.ins.size(), offset });
+            f.ins.push_back(-1);
+        };
+        switch (opc) {
+            case IL_FUNSTART: {
+                assert(f.ins.empty() && !f.funstart);
+                f.funstart = args;
+                auto fip = args + 1;  // definedfunction
+                f.numregs = std::max(1, *fip++);
+                auto nargs = *fip++;
+                auto argvars = fip;
+                fip += nargs;
+                auto ndefs = *fip++;
+                auto defvars = fip;
+                fip += ndefs;
+                for (int i = 0; i < nargs; i++) {
+                    if (!specidents->Get(argvars[i])->used_as_freevar())
+                        var_to_local[argvars[i]] = f.numlocals++;
+                }
+                for (int i = 0; i < ndefs; i++) {
+                    if (!specidents->Get(defvars[i])->used_as_freevar())
+                        var_to_local[defvars[i]] = f.numlocals++;
+                }
+                for (int i = 0; i < nargs; i++) f.args.push_back({ argvars[i], local(argvars[i]) });
+                for (int i = 0; i < ndefs; i++) f.defs.push_back({ defvars[i], local(defvars[i]) });
+                f.nkeepvars = *fip++;
+                auto nowned = *fip++;
+                for (int i = 0; i < nowned; i++) f.owned.push_back({ fip[i], local(fip[i]) });
+                break;
+            }
+            case IL_BLOCK_START:
+            case IL_JUMP_TABLE_CASE_START:
+                f.block_pos[id] = (int)f.ins.size();
+                break;
+            case IL_JUMP_TABLE_END:
+            case IL_PROFILE:
+                break;
+            case IL_PUSHVARL:
+                emit(I_PUSHVARL, { var_to_local[args[0]] });
+                break;
+            case IL_PUSHVARVL:
+                emit(I_PUSHVARVL, { args[1] });
+                for (int i = 0; i < args[1]; i++) f.ins.push_back(var_to_local[args[0] + i]);
+                f.ins[start + 1] += args[1];
+                break;
+            case IL_LVAL_VARL:
+                emit(I_LVAL_VARL, { var_to_local[args[0]] });
+                break;
+            case IL_JUMP:
+                // Also keep the block, for OSR.
+                emit(I_JUMP, { args[0] });
+                target(args[0]);
+                f.ins[start + 1]++;
+                break;
+            case IL_JUMPFAIL:
+            case IL_JUMPFAILR:
+            case IL_JUMPNOFAIL:
+            case IL_JUMPNOFAILR:
+            case IL_IFOR:
+            case IL_SFOR:
+            case IL_VFOR:
+                emit(opc, {});
+                target(args[0]);
+                f.ins[start + 1]++;
+                break;
+            case IL_JUMPIFUNWOUND:
+            case IL_JUMPIFSTATICLF:
+            case IL_JUMPIFMEMBERLF:
+                emit(opc, { args[0] });
+                target(args[1]);
+                f.ins[start + 1]++;
+                break;
+            case IL_JUMP_TABLE:
+            case IL_JUMP_TABLE_DISPATCH: {
+                auto t = args;
+                if (opc == IL_JUMP_TABLE) {
+                    emit(opc, { t[0], t[1] });
+                } else {
+                    emit(opc, { t[0], t[1], t[2] });
+                    t++;
+                }
+                auto n = t[1] - t[0] + 2;
+                for (int i = 0; i < n; i++) target(t[2 + i]);
+                f.ins[start + 1] += n;
+                break;
+            }
+            case IL_JUMP_TABLE_SPARSE: {
+                auto n = args[0];
+                emit(opc, { n });
+                f.ins.insert(f.ins.end(), args + 1, args + 1 + n);
+                for (int i = 0; i <= n; i++) target(args[1 + n + i]);
+                f.ins[start + 1] += n * 2 + 1;
+                break;
+            }
+            case IL_JUMP_TABLE_STRING:
+                // Returns bytecode offsets, looked up in block_pos.
+                emit(opc, { (int)(args - code) });
+                break;
+            case IL_BCALLRETV:
+            case IL_BCALLRET0:
+            case IL_BCALLRET1:
+            case IL_BCALLRET2:
+            case IL_BCALLRET3:
+            case IL_BCALLRET4:
+            case IL_BCALLRET5:
+            case IL_BCALLRET6:
+            case IL_BCALLRET7:
+                if (gen.natreg.nfuns[args[0]]->IsGLFrame()) emit(I_GLFRAME, {});
+                else emit(opc, { args[0], args[1] });
+                break;
+            case IL_RETURNLOCAL:
+            case IL_RETURNNONLOCAL:
+            case IL_RETURNANY:
+                emit(I_RETURN, { opc, args[0], opc == IL_RETURNNONLOCAL ? args[1] : 0 });
+                f.restore_defs = true;
+                break;
+            case IL_GOTOFUNEXIT:
+                emit(I_GOTOFUNEXIT, {});
+                break;
+            case IL_KEEPREF:
+            case IL_KEEPREFLOOP:
+                emit(opc == IL_KEEPREF ? I_KEEPREF : I_KEEPREFLOOP, { args[0], args[1] });
+                break;
+            case IL_PUSHFUN:
+                emit(I_PUSHFUN, { gen.fun_index[args[0]] });
+                break;
+            case IL_CALL:
+                emit(I_CALL, { gen.fun_index[args[0]] });
+                break;
+            case IL_CALLV:
+                emit(I_CALLV, {});
+                break;
+            case IL_DDCALL:
+                emit(I_DDCALL, { args[0], args[1] });
+                break;
+            default:
+                assert(ILArity()[opc] != ILUNKNOWN);
+                f.ins.push_back(opc);
+                f.ins.push_back(ILArity()[opc] + 3);
+                f.ins.push_back(regso);
+                f.ins.insert(f.ins.end(), args, args + ILArity()[opc]);
+                break;
+        }
+        if (ip == code + gen.len || *ip == IL_FUNSTART || ip == gen.starting_ip) break;
+    }
+    for (auto [i, offset] : fixups) f.ins[i] = f.block_pos[offset];
+    return f;
+}
+
+#define I_ARGS0
+#define I_ARGS1 , a[0]
+#define I_ARGS2 , a[0], a[1]
+#define I_ARGS3 , a[0], a[1], a[2]
+
+void LazyJIT::Interpret(VM &vm, int k, StackPtr psp) {
+    auto &f = Decode(k);
+    // Like the locals of generated code, which also helps when a VM error longjmps past us.
+    auto regs = (Value *)alloca(sizeof(Value) * (f.numregs + f.numlocals + f.nkeepvars));
+    auto locals = regs + f.numregs;
+    auto keepvar = locals + f.numlocals;
+    auto nargs = (int)f.args.size();
+    for (auto [i, v] : enumerate(f.args)) {
+        if (v.second < 0) SwapVars(vm, v.first, psp, nargs - (int)i);
+        else locals[v.second] = *(psp - (nargs - i));
+    }
+    for (auto [varidx, l] : f.defs) {
+        if (l < 0) BackupVar(vm, varidx);
+        else locals[l] = NilVal();
+    }
+    if (f.funstart && gen.runtime_checks >= RUNTIME_ASSERT_PLUS) {
+        PushFunId(vm, f.funstart, f.numlocals ? locals : nullptr);
+    }
+    for (int i = 0; i < f.nkeepvars; i++) keepvar[i] = NilVal();
+    auto ins = f.ins.data();
+    auto end = ins + f.ins.size();
+    for (auto pc = ins; pc < end; ) {
+        auto opc = pc[0];
+        auto sp = regs + pc[2];
+        auto a = pc + 3;
+        pc += pc[1];
+        switch (opc) {
+            #define F(N, A, USE, DEF) case IL_##N: U_##N(vm, sp I_ARGS##A); break;
+                ILBASENAMES
+            #undef F
+            case I_PUSHVARL:
+                *sp = locals[a[0]];
+                break;
+            case I_PUSHVARVL:
+                for (int i = 0; i < a[0]; i++) sp[i] = locals[a[1 + i]];
+                break;
+            case I_LVAL_VARL:
+                SetLVal(vm, &locals[a[0]]);
+                break;
+            case I_JUMP: {
+                auto to = ins + a[1];
+                if (to < pc && tiered && f.Heat(hot_threshold)) {
+                    // Hot loop: continue in compiled code, from the top of the loop. Compiled
+                    // once per loop, since frames that were already being interpreted (e.g.
+                    // recursive ones) will all get here.
+                    osr_t osr;
+                    {
+                        lock_guard<mutex> lock(mtx);
+                        auto &entry = f.osr_entries[a[0]];
+                        if (!entry) {
+                            entry = Compile(vm, k, a[0]);
+                            num_osr++;
+                        }
+                        osr = (osr_t)entry;
+                    }
+                    osr(vm, psp, regs, locals, keepvar);
+                    return;
+                }
+                pc = to;
+                break;
+            }
+            case IL_JUMPFAIL:
+            case IL_JUMPFAILR:
+            case IL_JUMPNOFAIL:
+            case IL_JUMPNOFAILR:
+            case IL_IFOR:
+            case IL_SFOR:
+            case IL_VFOR: {
+                bool cont;
+                switch (opc) {
+                    #define F(N, A, USE, DEF) case IL_##N: cont = U_##N(vm, sp); break;
+                        ILJUMPNAMES1
+                    #undef F
+                    default: cont = false; assert(false);
+                }
+                if (!cont) pc = ins + a[0];
+                break;
+            }
+            #define F(N, A, USE, DEF) \
+                case IL_##N: if (!U_##N(vm, sp, a[0])) pc = ins + a[1]; break;
+                ILJUMPNAMES2
+            #undef F
+            case IL_JUMP_TABLE: {
+                auto v = sp[-1].ival();
+                auto mini = a[0];
+                auto maxi = a[1];
+                pc = ins + a[2 + (v >= mini && v <= maxi ? v - mini : maxi - mini + 1)];
+                break;
+            }
+            case IL_JUMP_TABLE_DISPATCH: {
+                auto v = GetTypeSwitchID(vm, sp[-1], a[0]);
+                auto mini = a[1];
+                auto maxi = a[2];
+                pc = ins + a[3 + (v >= mini && v <= maxi ? v - mini : maxi - mini + 1)];
+                break;
+            }
+            case IL_JUMP_TABLE_SPARSE: {
+                auto v = sp[-1].ival();
+                auto n = a[0];
+                auto vals = a + 1;
+                auto it = std::lower_bound(vals, vals + n, v);
+                auto i = it < vals + n && *it == v ? it - vals : n;
+                pc = ins + vals[n + i];
+                break;
+            }
+            case IL_JUMP_TABLE_STRING:
+                pc = ins + f.block_pos[GetStringSwitchID(vm, sp[-1], gen.code + a[0])];
+                break;
+            #if LOBSTER_ENGINE
+            case I_GLFRAME:
+                GLFrame(sp, vm);
+                break;
+            #endif
+            case I_RETURN: {
+                auto ropc = a[0];
+                auto nrets = a[1];
+                if (ropc == IL_RETURNLOCAL) U_RETURNLOCAL(vm, nullptr, nrets);
+                else if (ropc == IL_RETURNNONLOCAL) U_RETURNNONLOCAL(vm, nullptr, nrets, a[2]);
+                else U_RETURNANY(vm, nullptr, nrets);
+                for (auto [varidx, l] : f.owned) {
+                    if (l < 0) DecOwned(vm, varidx);
+                    else DecVal(vm, locals[l]);
+                }
+                for (auto v = f.args.rbegin(); v != f.args.rend(); ++v) {
+                    if (v->second < 0) psp = PopArg(vm, v->first, psp);
+                    else Pop(psp);
+                }
+                auto rs = ropc == IL_RETURNANY ? RetSlots(vm) : nrets;
+                for (int i = 0; i < rs; i++) Push(psp, sp[i - nrets]);
+                if (ropc != IL_RETURNANY) pc = end;
+                break;
+            }
+            case I_GOTOFUNEXIT:
+                pc = end;
+                break;
+            case I_KEEPREFLOOP:
+                DecVal(vm, keepvar[a[1]]);
+                keepvar[a[1]] = TopM(sp, a[0]);
+                break;
+            case I_KEEPREF:
+                keepvar[a[1]] = TopM(sp, a[0]);
+                break;
+            case I_PUSHFUN:
+                U_PUSHFUN(vm, sp, 0, stubtab[a[0]]);
+                break;
+            case I_CALL: {
+                auto cf = funtab[a[0]].load(memory_order_acquire);
+                if (cf == stubtab[a[0]]) cf = LazyCompile(vm, this, a[0], sp);
+                if (cf) cf(vm, sp);
+                break;
+            }
+            case I_CALLV:
+                U_CALLV(vm, sp);
+                vm.next_call_target(vm, sp - 1);
+                break;
+            case I_DDCALL:
+                U_DDCALL(vm, sp, a[0], a[1]);
+                vm.next_call_target(vm, sp);
+                break;
+            default:
+                assert(false);
+        }
+    }
+    if (f.restore_defs) {
+        for (auto v = f.defs.rbegin(); v != f.defs.rend(); ++v) {
+            if (v->second < 0) RestoreBackup(vm, v->first);
+        }
+    }
+    for (int i = 0; i < f.nkeepvars; i++) DecVal(vm, keepvar[i]);
+    if (f.funstart && gen.runtime_checks >= RUNTIME_ASSERT_PLUS) PopFunId(vm);
+}
+
+#undef I_ARGS0
+#undef I_ARGS1
+#undef I_ARGS2
+#undef I_ARGS3
+
+LazyJIT *NewLazyJIT(NativeRegistry &nfr, string_view bytecode_buffer, string_view fn,
+                    int runtime_checks, bool tiered, string &sd, string &error) {
+    auto jit = make_unique<LazyJIT>(nfr, bytecode_buffer, fn, runtime_checks, tiered);
+    error = ToCLazyMain(jit->gen, sd);
+    if (!error.empty()) return nullptr;
+    jit->SetupImports();
+    const char *export_names[] = { "compiled_entry_point", "vtables", "lazy_stubs", nullptr };
+    auto unit = CompileC(sd.c_str(), error, jit->imports.data(), export_names, jit->exports);
+    if (!unit) return nullptr;
+    jit->units.push_back(unit);
+    jit->SetStubs((const fun_base_t *)jit->exports[2]);
+    return jit.release();
+}
+
+void **LazyJITExports(LazyJIT *jit) {
+    return jit->exports.data();
+}
+
+void DeleteLazyJIT(LazyJIT *jit) {
+    delete jit;
+}
+
+bool RunLazyJIT(NativeRegistry &nfr, string_view bytecode_buffer, string_view fn,
+                int runtime_checks, bool tiered, string &sd, string &error,
+                const function<void(void **)> &run) {
+    unique_ptr<LazyJIT> jit(NewLazyJIT(nfr, bytecode_buffer, fn, runtime_checks, tiered, sd,
+                                       error));
+    if (!jit) return false;
+    run(LazyJITExports(jit.get()));
+    return true;
+}
+
+}  // namespace lobster
+
+#endif  // VM_JIT_MODE
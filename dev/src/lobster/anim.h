@@ -0,0 +1,70 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LOBSTER_ANIM
+#define LOBSTER_ANIM
+
+// Skeletal animation that doesn't need graphics (see anim.cpp). Meshes use the same pose math,
+// and gl_render_mesh_pose renders with bones evaluated here.
+
+namespace lobster {
+
+// Interpolates between the two frames around frame (wrapping around), as a flat loop over all
+// floats so it vectorizes well.
+inline void PoseFrame(const float3x4 *mats, int numframes, int numbones, float frame,
+                      float3x4 *bones) {
+    int frame1 = ffloor(frame);
+    float t = frame - frame1;
+    frame1 = (frame1 % numframes + numframes) % numframes;
+    auto frame2 = (frame1 + 1) % numframes;
+    auto a = (const float *)&mats[frame1 * numbones];
+    auto b = (const float *)&mats[frame2 * numbones];
+    auto out = (float *)bones;
+    for (int i = 0; i < numbones * 12; i++) out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+// Bone matrices for each frame of an animation.
+struct AnimClip {
+    int numbones, numframes;
+    vector<float3x4> mats;
+
+    AnimClip(int numbones, int numframes, const float3x4 *m)
+        : numbones(numbones), numframes(numframes), mats(m, m + numbones * numframes) {}
+};
+
+// Bones for many instances of a clip, all evaluated at once by anim_evaluate.
+struct AnimPoses : Resource {
+    // Shared with the animclip resource, which may be freed before these.
+    shared_ptr<const AnimClip> clip;
+    vector<float3x4> bones;
+    // The frame, frame to blend towards, and blend weight each instance was last evaluated
+    // with, so unchanged instances can be skipped.
+    vector<float3> params;
+
+    AnimPoses(shared_ptr<const AnimClip> clip, iint count);
+
+    const float3x4 *Bones(iint instance) const { return &bones[instance * clip->numbones]; }
+
+    size_t2 MemoryUsage() {
+        return { sizeof(AnimPoses) + bones.size() * sizeof(float3x4) +
+                 params.size() * sizeof(float3), 0 };
+    }
+};
+
+extern Value NewAnimClip(VM &vm, int numbones, int numframes, const float3x4 *mats);
+extern AnimPoses &GetAnimPoses(const Value &res);
+
+}  // namespace lobster
+
+#endif  // LOBSTER_ANIM
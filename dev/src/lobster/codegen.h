@@ -120,8 +120,8 @@ struct CodeGen  {
         EmitOp(IL_BLOCK_START);
     }
 
-    const int ti_num_udt_fields = 6;
-    const int ti_num_udt_per_field = 3;
+    const int ti_num_udt_fields = 7;
+    const int ti_num_udt_per_field = 4;
 
     void PushFields(UDT *udt, vector<type_elem_t> &tt, type_elem_t parent = (type_elem_t)-1) {
         for (auto [i, sfield] : enumerate(udt->sfields)) {
@@ -145,6 +145,7 @@ struct CodeGen  {
                         tt.push_back((type_elem_t)0);  // or 0.0f
                         break;
                 }
+                tt.push_back((type_elem_t)0);  // Storage, filled in by caller.
             }
         }
     }
@@ -185,7 +186,12 @@ struct CodeGen  {
                     ? (type_elem_t)-1
                     : GetTypeTableOffset(&udt->ssuperclass->thistype));
                 tt.push_back((type_elem_t)udt->serializable_id);
+                tt.push_back((type_elem_t)udt->packed_size);
                 PushFields(udt, tt);
+                for (int i = 0; i < udt->numslots; i++) {
+                    tt[ti_num_udt_fields + i * ti_num_udt_per_field + 3] =
+                        (type_elem_t)(udt->g.is_struct ? i * 8 << 3 : udt->storage[i]);
+                }
                 assert(ssize(tt) == ttsize);
                 std::copy(tt.begin(), tt.end(), type_table.begin() + udt->typeinfo);
                 return udt->typeinfo;
@@ -699,9 +705,17 @@ struct CodeGen  {
             auto &sfield = stype->udt->sfields[idx];
             Gen(dot->child, 1);
             TakeTemp(take_temp + 1, true);
-            EmitOp(IL_LVAL_FLD);
-            Emit(sfield.slot);
-            GenLvalRet(sfield.type);
+            auto storage = stype->udt->storage[sfield.slot];
+            if ((storage & 7) != FS_VALUE) {
+                EmitOp(IL_LVAL_FLDN);
+                Emit(storage);
+                GenLvalRet(sfield.type);
+                EmitOp(IL_LV_STOREN);
+            } else {
+                EmitOp(IL_LVAL_FLD);
+                Emit(stype->udt->ValueSlot(sfield.slot));
+                GenLvalRet(sfield.type);
+            }
         } else if (auto indexing = Is<Indexing>(lval)) {
             Gen(indexing->object, 1);
             Gen(indexing->index, 1);
@@ -897,13 +911,18 @@ struct CodeGen  {
             }
             EmitWidthIfStruct(stype);
         } else {
+            auto udt = stype->udt;
+            auto storage = udt->storage[offset];
             if (IsStruct(ftype->t)) {
                 EmitOp(IL_PUSHFLD2V, 1, ValWidth(ftype));
-                Emit(offset);
+                Emit(udt->ValueSlot(offset));
                 EmitWidthIfStruct(ftype);
+            } else if ((storage & 7) != FS_VALUE) {
+                EmitOp(IL_PUSHFLDN);
+                Emit(storage);
             } else {
                 EmitOp(IL_PUSHFLD);
-                Emit(offset);
+                Emit(udt->ValueSlot(offset));
             }
         }
     }
@@ -1033,15 +1052,19 @@ void Member::Generate(CodeGen &cg, size_t retval) const {
         cg.EmitOp(IL_JUMPIFMEMBERLF);
         auto &f = *field();
         auto &sfield = this_sid->type->udt->sfields[field_idx];
-        cg.Emit(sfield.slot + ValWidth(sfield.type));  // It's the var after this one.
+        auto udt = this_sid->type->udt;
+        // It's the var after this one.
+        cg.Emit(udt->ValueSlot(sfield.slot + ValWidth(sfield.type)));
         cg.Emit(0);
         auto loc = cg.Pos();
         cg.Gen(child, 1);
         cg.GenPushVar(1, this_sid->type, this_sid->Idx(), this_sid->used_as_freevar);
         cg.TakeTemp(1, true);
-        cg.EmitOp(IL_LVAL_FLD);
-        cg.Emit(sfield.slot);
+        auto storage = udt->storage[sfield.slot];
+        cg.EmitOp((storage & 7) != FS_VALUE ? IL_LVAL_FLDN : IL_LVAL_FLD);
+        cg.Emit((storage & 7) != FS_VALUE ? storage : udt->ValueSlot(sfield.slot));
         cg.GenOpWithStructInfo(cg.AssignBaseOp({ *f.defaultval, 0 }), sfield.type);
+        if ((storage & 7) != FS_VALUE) cg.EmitOp(IL_LV_STOREN);
         cg.SetLabel(loc);
     }
     if (!retval) return;
@@ -1299,6 +1322,19 @@ void UDTRef::Generate(CodeGen &cg, size_t retval) const {
     cg.Dummy(retval);
 }
 
+// Returns the FBFieldKind of builtins that have an inline version in vmops.h, or -1.
+inline int FlatBuffersFieldKind(string_view name) {
+    static const char *names[] = {
+        "int64", "int32", "int16", "int8", "uint64", "uint32", "uint16", "uint8",
+        "float64", "float32", "present", "table", "struct", "vector", "vector_len"
+    };
+    const string_view prefix = "flatbuffers_field_";
+    if (name.substr(0, prefix.size()) != prefix) return -1;
+    name.remove_prefix(prefix.size());
+    for (auto [i, n] : enumerate(names)) if (name == n) return (int)i;
+    return -1;
+}
+
 void NativeCall::Generate(CodeGen &cg, size_t retval) const {
     if (nf->IsAssert()) {
         // FIXME: lift this into a language feature.
@@ -1344,10 +1380,16 @@ void NativeCall::Generate(CodeGen &cg, size_t retval) const {
     size_t nargs = children.size();
     cg.TakeTemp(nargs + numstructs, true);
     assert(nargs == nf->args.size() && (nf->fun.fnargs < 0 || nargs <= 7));
-    auto vmop = nf->fun.fnargs >= 0 ? GENOP(IL_BCALLRET0 + (int)nargs) : IL_BCALLRETV;
-    cg.EmitOp(vmop, inw, ValWidthMulti(nattype, nattype->NumValues()));
-    cg.Emit(nf->idx);
-    cg.Emit(!nf->retvals.empty());
+    if (auto fbkind = FlatBuffersFieldKind(nf->name); fbkind >= 0) {
+        // Reading generated FlatBuffers accessors is common in hot loops, so inline these.
+        cg.EmitOp(fbkind < FB_PRESENT ? IL_FBFIELD : IL_FBOFFSET, inw, 1);
+        cg.Emit(fbkind);
+    } else {
+        auto vmop = nf->fun.fnargs >= 0 ? GENOP(IL_BCALLRET0 + (int)nargs) : IL_BCALLRETV;
+        cg.EmitOp(vmop, inw, ValWidthMulti(nattype, nattype->NumValues()));
+        cg.Emit(nf->idx);
+        cg.Emit(!nf->retvals.empty());
+    }
     if (nf->retvals.size() > 0) {
         assert(nf->retvals.size() == nattype->NumValues());
         for (size_t i = 0; i < nattype->NumValues(); i++) {
@@ -1619,9 +1661,9 @@ void Switch::Generate(CodeGen &cg, size_t retval) const {
         return;
     }
     // See if we should do an integer jump table version.
-    if (GenerateJumpTable(cg, retval))
+    if (GenerateJumpTable(cg, retval) || GenerateStringJumpTable(cg, retval))
         return;
-    // Do slow default implementation for sparse integers, expressions and strings.
+    // Do slow default implementation for floats, expressions and the like.
     auto valtlt = TypeLT{ *value, 0 };
     vector<int> nextcase, thiscase, exitswitch;
     bool have_default = false;
@@ -1651,7 +1693,8 @@ void Switch::Generate(CodeGen &cg, size_t retval) const {
                 cg.GenMathOp(switchtype, c->exptype, switchtype, MOP_LE);
             } else {
                 // FIXME: if this is a string, will alloc a temp string object just for the sake of
-                // comparison. Better to create special purpose opcode to compare with const string.
+                // comparison. Switches on 3 or more constant strings avoid this by using
+                // IL_JUMP_TABLE_STRING instead, but smaller or non-constant ones still get here.
                 cg.Gen(c, 1);
                 cg.GenMathOp(switchtype, c->exptype, switchtype, MOP_EQ);
             }
@@ -1725,38 +1768,125 @@ bool Switch::GenerateJumpTable(CodeGen &cg, size_t retval) const {
     const int64_t min_load_factor = 5;
     int64_t range = maxi - mini + 1;
     if (num < min_vals ||
-        range / num > min_load_factor ||
         mini < INT32_MIN ||
         maxi >= INT32_MAX)
         return false;
+    if (range / num > min_load_factor)
+        return GenerateSparseJumpTable(cg, retval, num);
     // Emit jump table version.
     cg.EmitOp(IL_JUMP_TABLE);
     cg.Emit((int)mini);
     cg.Emit((int)maxi);
-    GenerateJumpTableMain(cg, retval, (int)range, (int)mini);
+    auto table_start = cg.Pos();
+    for (int i = 0; i < range + 1; i++) cg.Emit(-1);
+    vector<int> case_starts;
+    auto default_pos = GenerateJumpTableMain(cg, retval, case_starts);
+    for (auto [i, n] : enumerate(cases->children)) {
+        for (auto c : AssertIs<Case>(n)->pattern->children) {
+            auto [istart, iend] = get_range(c);
+            for (auto v = istart->integer; v <= iend->integer; v++) {
+                auto &target = cg.code[table_start + (int)(v - mini)];
+                // Like the comparison chain, the first case that matches a value wins.
+                if (target == -1) target = case_starts[i];
+            }
+        }
+    }
+    for (int i = 0; i < range + 1; i++) {
+        if (cg.code[table_start + i] == -1)
+            cg.code[table_start + i] = default_pos;
+    }
     return true;
 }
 
-void Switch::GenerateJumpTableMain(CodeGen & cg, size_t retval, int range, int mini) const {
+// For integer cases spread too thin for a jump table: emits the sorted values with their
+// targets, which the backend turns into a native switch (binary search or better).
+bool Switch::GenerateSparseJumpTable(CodeGen &cg, size_t retval, int64_t num) const {
+    const int64_t max_vals = 1024;  // Ranges get expanded, so don't let them blow up.
+    if (num > max_vals) return false;
+    vector<pair<int, int>> vals;  // (value, case index)
+    for (auto [i, n] : enumerate(cases->children)) {
+        for (auto c : AssertIs<Case>(n)->pattern->children) {
+            auto [istart, iend] = get_range(c);
+            for (auto v = istart->integer; v <= iend->integer; v++)
+                vals.push_back({ (int)v, (int)i });
+        }
+    }
+    // First case wins for duplicate values, same as the comparison chain.
+    std::stable_sort(vals.begin(), vals.end(),
+                     [](const pair<int, int> &a, const pair<int, int> &b) {
+                         return a.first < b.first;
+                     });
+    vals.erase(std::unique(vals.begin(), vals.end(),
+                           [](const pair<int, int> &a, const pair<int, int> &b) {
+                               return a.first == b.first;
+                           }), vals.end());
+    cg.EmitOp(IL_JUMP_TABLE_SPARSE);
+    cg.Emit((int)vals.size());
+    for (auto &v : vals) cg.Emit(v.first);
     auto table_start = cg.Pos();
-    for (int i = 0; i < range + 1; i++) cg.Emit(-1);
+    for (size_t i = 0; i < vals.size() + 1; i++) cg.Emit(-1);
+    vector<int> case_starts;
+    auto default_pos = GenerateJumpTableMain(cg, retval, case_starts);
+    for (auto [i, v] : enumerate(vals)) cg.code[table_start + (int)i] = case_starts[v.second];
+    cg.code[table_start + (int)vals.size()] = default_pos;
+    return true;
+}
+
+// For strings: entries sorted on (length, hash) such that the VM can find the candidate with a
+// binary search and a single compare against the constant, without creating any strings.
+bool Switch::GenerateStringJumpTable(CodeGen &cg, size_t retval) const {
+    if (value->exptype->t != V_STRING)
+        return false;
+    struct StrCase { int len; int hash; string_view str; int cas; };
+    vector<StrCase> strs;
+    for (auto [i, n] : enumerate(cases->children)) {
+        for (auto c : AssertIs<Case>(n)->pattern->children) {
+            auto sc = Is<StringConstant>(c);
+            if (!sc) return false;
+            strs.push_back({ (int)sc->str.size(), (int)FNV1A32(sc->str), sc->str, (int)i });
+        }
+    }
+    const size_t min_vals = 3;  // Below this, the comparison chain is just as fast.
+    if (strs.size() < min_vals)
+        return false;
+    auto less = [](const StrCase &a, const StrCase &b) {
+        return a.len != b.len ? a.len < b.len : a.hash != b.hash ? a.hash < b.hash : a.str < b.str;
+    };
+    std::stable_sort(strs.begin(), strs.end(), less);
+    strs.erase(std::unique(strs.begin(), strs.end(),
+                           [](const StrCase &a, const StrCase &b) { return a.str == b.str; }),
+               strs.end());
+    cg.EmitOp(IL_JUMP_TABLE_STRING);
+    cg.Emit(cg.ShouldDec(TypeLT { *value, 0 }));
+    cg.Emit((int)strs.size());
+    vector<int> targets;
+    for (auto &s : strs) {
+        cg.Emit(s.len);
+        cg.Emit(s.hash);
+        cg.Emit((int)cg.stringtable.size());
+        cg.stringtable.push_back(s.str);
+        targets.push_back(cg.Pos());
+        cg.Emit(-1);
+    }
+    auto default_target = cg.Pos();
+    cg.Emit(-1);
+    vector<int> case_starts;
+    auto default_pos = GenerateJumpTableMain(cg, retval, case_starts);
+    for (auto [i, s] : enumerate(strs)) cg.code[targets[i]] = case_starts[s.cas];
+    cg.code[default_target] = default_pos;
+    return true;
+}
+
+// Generates the case bodies, returns where each case starts in case_starts, and where to go
+// if no case matches. The caller patches these into its table.
+int Switch::GenerateJumpTableMain(CodeGen &cg, size_t retval, vector<int> &case_starts) const {
     vector<int> exitswitch;
     int default_pos = -1;
     CodeGen::BlockStack bs(cg.tstack);
-    for (auto [i, n] : enumerate(cases->children)) {
+    for (auto n : cases->children) {
         bs.Start();
         auto cas = AssertIs<Case>(n);
-        for (auto c : cas->pattern->children) {
-            if (value->exptype->t == V_CLASS) {
-                cg.code[table_start + (int)i] = cg.Pos();
-            } else {
-                auto [istart, iend] = get_range(c);
-                assert(istart && iend);
-                for (auto i = istart->integer; i <= iend->integer; i++) {
-                    cg.code[table_start + (int)i - mini] = cg.Pos();
-                }
-            }
-        }
+        case_starts.push_back(cg.Pos());
         if (cas->pattern->children.empty()) default_pos = cg.Pos();
         cg.EmitOp(IL_JUMP_TABLE_CASE_START);
         cg.Gen(cas->cbody, retval);
@@ -1771,11 +1901,8 @@ void Switch::GenerateJumpTableMain(CodeGen & cg, size_t retval, int range, int m
     cg.EmitOp(IL_JUMP_TABLE_END);
     cg.SetLabels(exitswitch);
     if (default_pos < 0) default_pos = cg.Pos();
-    for (int i = 0; i < range + 1; i++) {
-        if (cg.code[table_start + i] == -1)
-            cg.code[table_start + i] = default_pos;
-    }
     bs.Exit(cg);
+    return default_pos;
 }
 
 void Switch::GenerateTypeDispatch(CodeGen &cg, size_t retval) const {
@@ -1789,7 +1916,18 @@ void Switch::GenerateTypeDispatch(CodeGen &cg, size_t retval) const {
     cg.Emit(0);
     int range = (int)cases->children.size();
     cg.Emit(range - 1);
-    GenerateJumpTableMain(cg, retval, range, 0);
+    auto table_start = cg.Pos();
+    for (int i = 0; i < range + 1; i++) cg.Emit(-1);
+    vector<int> case_starts;
+    auto default_pos = GenerateJumpTableMain(cg, retval, case_starts);
+    for (auto [i, n] : enumerate(cases->children)) {
+        if (!AssertIs<Case>(n)->pattern->children.empty())
+            cg.code[table_start + (int)i] = case_starts[i];
+    }
+    for (int i = 0; i < range + 1; i++) {
+        if (cg.code[table_start + i] == -1)
+            cg.code[table_start + i] = default_pos;
+    }
 }
 
 void Case::Generate(CodeGen &/*cg*/, size_t /*retval*/) const {
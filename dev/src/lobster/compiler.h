@@ -21,7 +21,14 @@ namespace lobster {
 
 extern void Compile(NativeRegistry &natreg, string_view fn, string_view stringsource,
                     string &bytecode, string *parsedump, string *pakfile, bool return_value,
-                    int runtime_checks, Query *query, int max_errors, bool full_error);
+                    int runtime_checks, Query *query, int max_errors, bool full_error,
+                    vector<pair<string, string>> *filenames_out = nullptr);
+
+enum class JITMode {
+    EAGER,   // Compile the whole program before running it.
+    LAZY,    // Compile each function on first call.
+    TIERED,  // Interpret each function until it gets hot, then compile it.
+};
 
 extern pair<string, iint> RunTCC(NativeRegistry &nfr,
                           string_view bytecode_buffer,
@@ -32,7 +39,8 @@ extern pair<string, iint> RunTCC(NativeRegistry &nfr,
                           bool compile_only,
                           string &error,
                           int runtime_checks,
-                          bool dump_leaks);
+                          bool dump_leaks,
+                          JITMode jit_mode);
 
 extern bool LoadPakDir(const char *lpak);
 extern bool LoadByteCode(string &bytecode);
@@ -19,20 +19,16 @@ struct BitmapFont;
 struct OutlineFont {
     void *fthandle;
     string fbuf;
-    unordered_map<int, int> unicodemap;
-    vector<int> unicodetable;
     map<int, int> glyph_to_char;
 
     OutlineFont(void *fth, string &fb) : fthandle(fth) { fbuf.swap(fb); }
     ~OutlineFont();
 
-    bool EnsureCharsPresent(string_view utf8str);
     string GetName(int i);
     int GetCharCode(string_view_nt name);
 };
 
 struct BitmapFont {
-    Texture tex;
     struct Glyph {
         int x;
         int y;
@@ -41,11 +37,45 @@ struct BitmapFont {
         int top;  // From baseline.
         int width;
         int height;
+        int page;
     };
-    vector<Glyph> positions;
+    // Glyphs are rasterized on demand into atlas pages, packed into horizontal shelves.
+    struct Shelf {
+        int y;
+        int height;
+        int x;  // Next free x.
+    };
+    struct Page {
+        Texture tex;
+        vector<Shelf> shelves;
+        int lastused = 0;
+    };
+    // A laid out string, ready to be sent to the GPU, one batch per atlas page used.
+    struct TextRun {
+        struct PT { float2 p; float2 t; };
+        struct Batch {
+            int page;
+            vector<PT> vbuf;
+            vector<int> ibuf;
+        };
+        vector<Batch> batches;
+        int2 size = int2_0;
+        int generation = 0;
+    };
+    unordered_map<int, Glyph> glyphs;
+    vector<Page> pages;
+    int2 pagesize = int2_0;
+    // Incremented whenever glyphs are evicted, invalidating cached runs.
+    int generation = 0;
+    int usetick = 0;
+    unordered_map<string, TextRun> runs;
+    string run_key;
+    vector<byte4> scratch;
     int usedcount = 1;
     int font_height = 0;
     int max_ascent = 0;
+    int raw_ascent = 0;
+    int raw_descent = 0;
     float outlinesize = 0.0f;
     OutlineFont *font = nullptr;
 
@@ -56,6 +86,12 @@ struct BitmapFont {
     const int2 TextSize(string_view text);
 
     bool CacheChars(string_view text);
+    TextRun *Layout(string_view text);
+
+    private:
+    void RasterizeGlyph(int c, void *stroker);
+    bool AllocGlyph(int2 size, int &page, int2 &pos);
+    void EvictPage(int page);
 };
 
 extern OutlineFont *LoadFont(string_view name);
@@ -883,9 +883,9 @@ inline float3x4 invertortho(const float3x4 &o) {
                     float4(inv[2], -dot(inv[2], inv[3])));
 }
 
-inline float4x4 invert(const float4x4 &mat) {
+template<typename T> matrix<T,4,4> invert(const matrix<T,4,4> &mat) {
     auto m = mat.data();
-    float4x4 dest;
+    matrix<T,4,4> dest;
     auto inv = dest.data_mut();
 
     inv[0] =   m[5]  * m[10] * m[15] -
@@ -1000,12 +1000,12 @@ inline float4x4 invert(const float4x4 &mat) {
                m[8]  * m[1]  * m[6]  -
                m[8]  * m[2]  * m[5];
 
-    float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    T det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
     if (det == 0) {
         assert(false);
-        return float4x4_1;
+        return matrix<T,4,4>(1);
     }
-    det = 1.0f / det;
+    det = 1 / det;
     for (int i = 0; i < 16; i++)
         inv[i] = inv[i] * det;
     return dest;
@@ -84,7 +84,7 @@ struct Shader : lobster::Resource {
     string Link(string_view);
     void Activate();                            // Makes shader current;
     void Set();                                 // Activate + sets common uniforms.
-    void SetAnim(float3x4 *bones, int num);     // Optionally, after Activate().
+    void SetAnim(const float3x4 *bones, int num);  // Optionally, after Activate().
     void SetTextures(const vector<Texture> &textures);  // Optionally, after Activate().
     bool SetUniform(string_view_nt name,                // Optionally, after Activate().
                     const float *val,
@@ -201,16 +201,19 @@ struct Mesh : lobster::Resource {
     int numframes = 0, numbones = 0;
     float3x4 *mats = nullptr;
     float curanim = 0;
+    // Bones for curanim, recomputed only when it changes.
+    vector<float3x4> pose;
+    float posed = -1;
 
     Mesh(Geometry *_g, Primitive _prim = PRIM_FAN)
         : geom(_g), prim(_prim) {}
     ~Mesh();
 
-    void Render(Shader *sh);
+    void Render(Shader *sh, const float3x4 *bones = nullptr);
     bool SaveAsPLY(string_view filename);
 
     size_t2 MemoryUsage() {
-        auto usage = size_t2(sizeof(Mesh) + numframes * numbones * sizeof(float3x4), 0);
+        auto usage = size_t2(sizeof(Mesh) + (numframes + 1) * numbones * sizeof(float3x4), 0);
         usage += geom->MemoryUsage();
         for (auto s : surfs) usage += s->MemoryUsage();
         return usage;
@@ -276,6 +279,8 @@ extern Texture CreateBlankTexture(string_view name, const int3 &size, int tf = T
 extern Texture CreateColoredTexture(string_view name, const int3 &size, const float4 &color,
                                   int tf = TF_NONE);
 extern void DeleteTexture(Texture &id);
+extern void UpdateTexture(const Texture &tex, const uint8_t *buf, const int2 &pos,
+                          const int2 &size);
 extern void SetTexture(int textureunit, const Texture &tex);
 extern void GenerateTextureMipMap(const Texture &tex);
 extern uint8_t *ReadTexture(const Texture &tex);
@@ -35,6 +35,14 @@ struct SpecIdent;
 
 struct UDT;
 
+// AST nodes and SpecIdents get allocated and freed in large numbers during compilation, so they
+// come from a slab allocator instead of the heap. A compile happens entirely on one thread, so
+// each thread gets its own.
+inline SlabAlloc &CompilerAlloc() {
+    static thread_local SlabAlloc alloc;
+    return alloc;
+}
+
 struct Ident : Named {
     size_t scopelevel;
     Line line;
@@ -80,6 +88,8 @@ struct SpecIdent {
 
     SpecIdent(Ident *_id, TypeRef _type, int idx, bool withtype)
         : id(_id), type(_type), idx(idx), withtype(withtype) {}
+    static void *operator new(size_t size) { return CompilerAlloc().alloc_small((iint)size); }
+    static void operator delete(void *p) { CompilerAlloc().dealloc_small(p); }
     int Idx() const {
         assert(sidx >= 0);
         return sidx;
@@ -137,6 +147,7 @@ struct Field {
     bool isprivate;
     bool in_scope;  // For tracking scopes of ones declared by `member`.
     Line defined_in;
+    int storage = FS_VALUE;  // Declared as int8 etc.
 
     Field(SharedField *_id, TypeRef _type, Node *_defaultval, bool isprivate,
           bool in_scope, const Line &defined_in)
@@ -234,6 +245,9 @@ struct UDT : Named {
     TypeRef sametype = type_undefined;  // If all fields are int/float, this allows vector ops.
     type_elem_t typeinfo = (type_elem_t)-1;  // Runtime type.
     int numslots = -1;
+    // Classes only: byte offset << 3 | FieldStorage for each slot, see ComputeStorage.
+    vector<int> storage;
+    int packed_size = 0;  // 0 if all slots are plain Values.
     int vtable_start = -1;
     int serializable_id = -1;
     vector<UDT *> subudts;  // Including self.
@@ -271,9 +285,71 @@ struct UDT : Named {
             }
         }
         numslots = size;
+        if (!g.is_struct) ComputeStorage(depth);
         return true;
     }
 
+    static int StorageSize(int kind) {
+        switch (kind) {
+            case FS_INT8:    return 1;
+            case FS_INT16:   return 2;
+            case FS_INT32:
+            case FS_FLOAT32: return 4;
+            default:         return 8;
+        }
+    }
+
+    // Field i declared with a narrow type, or an enum that fits one in a packed class.
+    int NarrowKind(size_t i) {
+        if (g.fields[i].storage != FS_VALUE) return g.fields[i].storage;
+        auto type = sfields[i].type;
+        if (!g.attributes.count("packed") || type->t != V_INT || !type->e) return FS_VALUE;
+        int64_t lo = 0, hi = 0, all = 0;
+        for (auto &ev : type->e->vals) {
+            lo = std::min(lo, ev->val);
+            hi = std::max(hi, ev->val);
+            all |= ev->val;
+        }
+        if (type->e->flags) hi = std::max(hi, all);
+        if (lo >= INT8_MIN && hi <= INT8_MAX) return FS_INT8;
+        if (lo >= INT16_MIN && hi <= INT16_MAX) return FS_INT16;
+        if (lo >= INT32_MIN && hi <= INT32_MAX) return FS_INT32;
+        return FS_VALUE;
+    }
+
+    // Lays out fields in declaration order, each aligned to its own size, continuing after
+    // the superclass so its code can access subclass objects. Plain Value fields stay 8
+    // aligned, so without any narrow fields this is identical to the unpacked layout.
+    void ComputeStorage(int depth) {
+        storage.clear();
+        size_t first = 0;
+        int end = 0;
+        bool narrow = false;
+        if (ssuperclass && ssuperclass->ComputeSizes(depth + 1)) {
+            storage = ssuperclass->storage;
+            first = ssuperclass->sfields.size();
+            narrow = ssuperclass->packed_size != 0;
+            for (auto s : storage) end = std::max(end, (s >> 3) + StorageSize(s & 7));
+        }
+        for (size_t i = first; i < sfields.size(); i++) {
+            auto kind = NarrowKind(i);
+            auto sz = StorageSize(kind);
+            end = (end + sz - 1) & ~(sz - 1);
+            auto n = IsStruct(sfields[i].type->t) ? sfields[i].type->udt->numslots : 1;
+            for (int j = 0; j < n; j++) {
+                storage.push_back(end << 3 | kind);
+                end += sz;
+            }
+            if (kind != FS_VALUE) narrow = true;
+        }
+        packed_size = narrow ? (end + 7) & ~7 : 0;
+    }
+
+    // Index of slot i in the object as seen by the Value based field ops.
+    int ValueSlot(int i) {
+        return g.is_struct ? i : (storage[i] >> 3) / 8;
+    }
+
     flatbuffers::Offset<bytecode::UDT> Serialize(flatbuffers::FlatBufferBuilder &fbb) {
         vector<flatbuffers::Offset<bytecode::Field>> fieldoffsets;
         for (auto [i, sfield] : enumerate(sfields))
@@ -540,7 +616,7 @@ struct SymbolTable {
     unordered_map<string_view, SharedField *> fields;  // Key points to value!
     vector<SharedField *> fieldtable;
 
-    unordered_map<string, vector<Function *>> functions;
+    unordered_map<string_view, vector<Function *>> functions;  // Key points to value!
     unordered_map<string_view, Function *> operators;  // Key points to value!
     vector<Function *> functiontable;
     vector<SubFunction *> subfunctiontable;
@@ -567,6 +643,8 @@ struct SymbolTable {
     enum { NUM_VECTOR_TYPE_WRAPPINGS = 3 };
     vector<TypeRef> default_int_vector_types[NUM_VECTOR_TYPE_WRAPPINGS],
                     default_float_vector_types[NUM_VECTOR_TYPE_WRAPPINGS];
+    // Only if matrix.lobster is used.
+    TypeRef default_float4x4_types[NUM_VECTOR_TYPE_WRAPPINGS] = { nullptr, nullptr, nullptr };
     Enum *default_bool_type = nullptr;
 
     // Used during parsing.
@@ -782,9 +860,9 @@ struct SymbolTable {
     }
 
     void Unregister(const Function *f) {
-        auto &v = functions[f->name];
-        if (!v.empty() && v.back() == f) {
-            v.pop_back();
+        auto it = functions.find(f->name);
+        if (it != functions.end() && !it->second.empty() && it->second.back() == f) {
+            it->second.pop_back();
         }
     }
 
@@ -949,8 +1027,10 @@ struct SymbolTable {
     }
 
     Function &FunctionDecl(const string &name, size_t nargs) {
-        auto &v = functions[name];
-        if (!v.empty() && v.back()->scopelevel == scopelevels.size()) {
+        auto fit = functions.find(name);
+        if (fit != functions.end() && !fit->second.empty() &&
+            fit->second.back()->scopelevel == scopelevels.size()) {
+            auto &v = fit->second;
             for (auto f = v.back(); f; f = f->sibf) {
                 if (f->nargs() == nargs) {
                     return *f;
@@ -977,7 +1057,7 @@ struct SymbolTable {
             return f;
         } else {
             auto &f = CreateFunction(name);
-            v.push_back(&f);
+            functions[f.name /* must be in value */].push_back(&f);
             // Store top level functions, for now only operators needed.
             if (scopelevels.size() == 2 && name.substr(0, 8) == TName(T_OPERATOR)) {
                 operators[f.name /* must be in value */] = &f;
@@ -995,19 +1075,16 @@ struct SymbolTable {
         v.push_back(&f);
     }
 
-    Function *GetFirstFunction(const string &name) {
-        auto &v = functions[name];
-        return v.empty() ? nullptr : v.back();
+    Function *GetFirstFunction(string_view name) {
+        auto it = functions.find(name);
+        return it == functions.end() || it->second.empty() ? nullptr : it->second.back();
     }
 
     Function *FindFunction(string_view name) {
         if (!current_namespace.empty()) {
-            auto &v = functions[NameSpaced(name)];
-            if (!v.empty()) return v.back();
+            if (auto f = GetFirstFunction(NameSpaced(name))) return f;
         }
-        auto &v = functions[string(name)];
-        if (!v.empty()) return v.back();
-        return nullptr;
+        return GetFirstFunction(name);
     }
 
     SpecIdent *NewSid(Ident *id, SubFunction *sf, bool withtype, TypeRef type = nullptr) {
@@ -1106,6 +1183,7 @@ struct SymbolTable {
     }
 
     static const char *GetVectorName(TypeRef type, int flen) {
+        if (flen == 16 && type->t == V_FLOAT) return "float4x4";
         if (flen < 2 || flen > 4) return nullptr;
         if (type->t == V_INT) return DefaultIntVectorTypeNames()[flen - 2];
         if (type->t == V_FLOAT) return DefaultFloatVectorTypeNames()[flen - 2];
@@ -1121,12 +1199,23 @@ struct SymbolTable {
                 break;
             }
         }
+        // The 4x4 matrix type for "F}:16" builtin args is optional, since it lives in a module.
+        for (auto udt : udttable) {
+            if (udt->name == "float4x4" && default_float4x4_types[0].Null()) {
+                TypeRef vt = &udt->thistype;
+                for (size_t i = 0; i < NUM_VECTOR_TYPE_WRAPPINGS; i++) {
+                    default_float4x4_types[i] = vt;
+                    vt = Wrap(vt, V_VECTOR);
+                }
+            }
+        }
         return RegisterTypeVector(default_int_vector_types, DefaultIntVectorTypeNames()) &&
                RegisterTypeVector(default_float_vector_types, DefaultFloatVectorTypeNames()) &&
                default_bool_type;
     }
 
     TypeRef GetVectorType(TypeRef vt, size_t level, int arity) const {
+        if (arity == 16 && vt->sub->t == V_FLOAT) return default_float4x4_types[level];
         if (arity > 4) return nullptr;
         return vt->sub->t == V_INT
             ? default_int_vector_types[level][arity]
@@ -20,13 +20,20 @@
 
 namespace lobster {
 
-const int LOBSTER_BYTECODE_FORMAT_VERSION = 20;
+const int LOBSTER_BYTECODE_FORMAT_VERSION = 23;
 
 // Any type specialized ops below must always have this ordering.
 enum MathOp {
     MOP_ADD, MOP_SUB, MOP_MUL, MOP_DIV, MOP_MOD, MOP_LT, MOP_GT, MOP_LE, MOP_GE, MOP_EQ, MOP_NE
 };
 
+// Argument of IL_FBFIELD (first group) and IL_FBOFFSET.
+enum FBFieldKind {
+    FB_INT64, FB_INT32, FB_INT16, FB_INT8, FB_UINT64, FB_UINT32, FB_UINT16, FB_UINT8,
+    FB_FLOAT64, FB_FLOAT32,
+    FB_PRESENT, FB_TABLE, FB_STRUCT, FB_VECTOR, FB_VECTOR_LEN
+};
+
 #define ILUNKNOWN 999999
 
 #define ILBASENAMES \
@@ -50,6 +57,7 @@ enum MathOp {
     F(SPUSHIDXI,    0, 2, 1) \
     F(PUSHFLD,      1, 1, 1) \
     F(PUSHFLDMREF,  1, 1, 1) \
+    F(PUSHFLDN,     1, 1, 1) \
     F(PUSHFLDV,     2, ILUNKNOWN, 1) \
     F(PUSHFLD2V,    2, 1, ILUNKNOWN) \
     F(PUSHFLDV2V,   3, ILUNKNOWN, ILUNKNOWN) \
@@ -62,6 +70,8 @@ enum MathOp {
     F(BCALLRET5,    2, ILUNKNOWN, ILUNKNOWN) \
     F(BCALLRET6,    2, ILUNKNOWN, ILUNKNOWN) \
     F(BCALLRET7,    2, ILUNKNOWN, ILUNKNOWN) \
+    F(FBFIELD,      1, 4, 1) \
+    F(FBOFFSET,     1, 3, 1) \
     F(ASSERT,       3, 1, 0) \
     F(ASSERTR,      3, 1, 1) \
     F(STATEMENT,    2, 0, 0) \
@@ -123,6 +133,7 @@ enum MathOp {
     F(LVAL_VARF, 1, 0, 0) \
     F(LVAL_VARL, 1, 0, 0) \
     F(LVAL_FLD, 1, 1, 0) \
+    F(LVAL_FLDN, 1, 1, 0) \
     F(LVAL_IDXVI, 0, 2, 0) \
     F(LVAL_IDXVV, 1, ILUNKNOWN, 0) \
     F(LVAL_IDXNI, 0, 2, 0) \
@@ -146,7 +157,8 @@ enum MathOp {
     F(LV_FVSMOD, 1, 1, 0) \
     F(LV_SADD, 0, 1, 0) \
     F(LV_IPP, 0, 0, 0) F(LV_IMM, 0, 0, 0) \
-    F(LV_FPP, 0, 0, 0) F(LV_FMM, 0, 0, 0)
+    F(LV_FPP, 0, 0, 0) F(LV_FMM, 0, 0, 0) \
+    F(LV_STOREN, 0, 0, 0)
 
 #define ILCALLNAMES \
     F(PUSHFUN, 1, 0, 1)
@@ -154,6 +166,8 @@ enum MathOp {
 #define ILVARARGNAMES \
     F(JUMP_TABLE, ILUNKNOWN, 1, 0) \
     F(JUMP_TABLE_DISPATCH, ILUNKNOWN, 1, 0) \
+    F(JUMP_TABLE_SPARSE, ILUNKNOWN, 1, 0) \
+    F(JUMP_TABLE_STRING, ILUNKNOWN, 1, 0) \
     F(FUNSTART, ILUNKNOWN, 0, 0)
 
 #define ILJUMPNAMES1 \
@@ -19,6 +19,52 @@
 
 namespace lobster {
 
+// Imported files stay loaded between compiles in the same process (compile_run_code, or any
+// program that compiles many times), and are only read again if they changed on disk.
+// Keyed on the file an import resolved to, since the same name may resolve to a different file
+// in a later compile (e.g. with another main file directory).
+struct ImportCache {
+    struct File {
+        shared_ptr<string> source;
+        int64_t version;
+    };
+    mutex mtx;
+    map<string, File, less<>> files;
+    // Programs generating many different files to import shouldn't grow this forever.
+    static constexpr size_t max_files = 1024;
+
+    static ImportCache &Get() {
+        static ImportCache cache;
+        return cache;
+    }
+
+    // The path import fn would be loaded from, or empty if it is not on disk (e.g. in a pakfile).
+    static string Resolve(string_view fn) {
+        auto abspath = FindDataFile(cat("modules/", fn));
+        return abspath.empty() ? FindDataFile(fn) : abspath;
+    }
+
+    bool Find(string_view abspath, shared_ptr<string> &source) {
+        lock_guard<mutex> lock(mtx);
+        auto it = files.find(abspath);
+        if (it == files.end()) return false;
+        if (FileVersion(it->first) != it->second.version) {
+            files.erase(it);
+            return false;
+        }
+        source = it->second.source;
+        return true;
+    }
+
+    void Add(const string &abspath, const shared_ptr<string> &source) {
+        auto version = FileVersion(abspath);
+        if (version < 0) return;  // Can't tell when it changes.
+        lock_guard<mutex> lock(mtx);
+        if (files.size() >= max_files) files.clear();
+        files[abspath] = { source, version };
+    }
+};
+
 struct LoadedFile : Line {
     const char *p = nullptr;
     const char *linestart = nullptr;
@@ -47,11 +93,15 @@ struct LoadedFile : Line {
 
     string filename;
 
-    LoadedFile(string_view fn, vector<pair<string, string>> &fns, string_view stringsource)
+    LoadedFile(string_view fn, vector<pair<string, string>> &fns, string_view stringsource,
+               bool is_import = false)
         : Line(1, (int)fns.size()) {
+        string abspath;
+        auto cachepath = is_import && stringsource.empty() ? ImportCache::Resolve(fn) : string();
         if (!stringsource.empty()) {
             *source.get() = stringsource;
-        } else {
+            abspath = LastAbsPathLoaded();
+        } else if (cachepath.empty() || !ImportCache::Get().Find(cachepath, source)) {
             if (LoadFile("modules/" + fn, source.get()) < 0 &&
                 LoadFile(fn, source.get()) < 0) {
                 // Do specialized message for this file, since it always confuses people
@@ -60,12 +110,17 @@ struct LoadedFile : Line {
                     THROW_OR_ABORT("can't find the standard modules (../modules/) relative to the exe location (bin/)");
                 THROW_OR_ABORT("can't open file: " + fn);
             }
+            abspath = LastAbsPathLoaded();
+            // Not if it came from a pakfile instead.
+            if (abspath == cachepath) ImportCache::Get().Add(abspath, source);
+        } else {
+            abspath = std::move(cachepath);
         }
         prevtokenstart = prevtokenend = tokenstart = linestart = p = source.get()->c_str();
 
         indentstack.push_back({ 0, false });
 
-        fns.push_back({ string(fn), LastAbsPathLoaded() });
+        fns.push_back({ string(fn), std::move(abspath) });
         filename = fn;
     }
 };
@@ -115,14 +170,14 @@ struct Lex : LoadedFile {
             return;
         }
         allfiles.insert(string(_fn));
-        parentfiles.push_back(*this);
-        *((LoadedFile *)this) = LoadedFile(_fn, filenames, {});
+        parentfiles.push_back(std::move(*this));
+        *((LoadedFile *)this) = LoadedFile(_fn, filenames, {}, true);
         allsources.push_back(source);
         FirstToken();
     }
 
     void PopIncludeContinue() {
-        *((LoadedFile *)this) = parentfiles.back();
+        *((LoadedFile *)this) = std::move(parentfiles.back());
         parentfiles.pop_back();
     }
 
@@ -218,6 +273,55 @@ struct Lex : LoadedFile {
     static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
     static bool IsXDigit(char c) { return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
     static bool IsAlNum(char c) { return IsAlpha(c) || IsDigit(c); }
+    // Any bytes >= 128 are allowed in identifiers, to allow UTF-8.
+    static bool IsIdentStart(char c) { return IsAlpha(c) || c == '_' || c < 0; }
+    static bool IsIdentChar(char c) {
+        static const auto table = []() {
+            array<bool, 256> t {};
+            for (int i = 0; i < 256; i++) t[i] = IsIdentStart((char)i) || IsDigit((char)i);
+            return t;
+        }();
+        return table[(uint8_t)c];
+    }
+
+    // Open addressing table hashed on length and first and last character, such that most
+    // identifiers can be rejected without a string compare.
+    struct KeywordTable {
+        static const size_t size = 128;  // Must be ^2.
+        struct Entry { string_view name; TType t = T_IDENT; };
+        Entry entries[size];
+
+        static size_t Hash(string_view s) {
+            return (s.size() * 7 + (uint8_t)s[0] * 3 + (uint8_t)s.back()) & (size - 1);
+        }
+
+        KeywordTable() {
+            for (auto t : { T_AND, T_ANYTYPE, T_ATTRIBUTE, T_ABSTRACT, T_BREAK, T_CLASS, T_CASE,
+                            T_FUN, T_DEFAULT, T_ELSE, T_ELIF, T_ENUM, T_ENUM_FLAGS, T_FLOATTYPE,
+                            T_FOR, T_LAMBDA, T_FROM, T_INTTYPE, T_IF, T_INCLUDE, T_IS, T_CONST,
+                            T_MEMBER, T_MEMBER_FRAME, T_NIL, T_NOT, T_NAMESPACE, T_OR,
+                            T_OPERATOR, T_PROGRAM, T_PRIVATE, T_PAKFILE, T_RETURN, T_RESOURCE,
+                            T_STRUCT, T_STRTYPE, T_SWITCH, T_SUPER, T_STATIC, T_STATIC_FRAME,
+                            T_TYPEOF, T_VOIDTYPE, T_VAR, T_WHILE }) {
+                string_view name = TName(t);
+                auto h = Hash(name);
+                while (entries[h].t != T_IDENT) h = (h + 1) & (size - 1);
+                entries[h] = { name, t };
+            }
+        }
+
+        TType Lookup(string_view s) const {
+            for (auto h = Hash(s); entries[h].t != T_IDENT; h = (h + 1) & (size - 1)) {
+                if (entries[h].name == s) return entries[h].t;
+            }
+            return T_IDENT;
+        }
+    };
+
+    static const KeywordTable &Keywords() {
+        static const KeywordTable keywords;
+        return keywords;
+    }
 
     TType NextToken() {
         line = tokline;
@@ -361,90 +465,12 @@ struct Lex : LoadedFile {
                 return StringConstant(c == '\'', false);
 
             default: {
-                if (IsAlpha(c) || c == '_' || c < 0) {
-                    while (IsAlNum(*p) || *p == '_' || *p < 0) p++;
+                if (IsIdentStart(c)) {
+                    while (IsIdentChar(*p)) p++;
                     sattr = string_view(tokenstart, p - tokenstart);
-                    switch (sattr[0]) {
-                        case 'a':
-                            if (sattr == TName(T_AND)) { cont = true; return T_AND; }
-                            if (sattr == TName(T_ANYTYPE)) return T_ANYTYPE;
-                            if (sattr == TName(T_ATTRIBUTE)) return T_ATTRIBUTE;
-                            if (sattr == TName(T_ABSTRACT)) return T_ABSTRACT;
-                            break;
-                        case 'b':
-                            if (sattr == TName(T_BREAK)) return T_BREAK;
-                            break;
-                        case 'c':
-                            if (sattr == TName(T_CLASS)) return T_CLASS;
-                            if (sattr == TName(T_CASE)) return T_CASE;
-                            break;
-                        case 'd':
-                            if (sattr == TName(T_FUN)) return T_FUN;
-                            if (sattr == TName(T_DEFAULT)) return T_DEFAULT;
-                            break;
-                        case 'e':
-                            if (sattr == TName(T_ELSE)) return T_ELSE;
-                            if (sattr == TName(T_ELIF)) return T_ELIF;
-                            if (sattr == TName(T_ENUM)) return T_ENUM;
-                            if (sattr == TName(T_ENUM_FLAGS)) return T_ENUM_FLAGS;
-                            break;
-                        case 'f':
-                            if (sattr == TName(T_FLOATTYPE)) return T_FLOATTYPE;
-                            if (sattr == TName(T_FOR)) return T_FOR;
-                            if (sattr == TName(T_LAMBDA)) return T_LAMBDA;
-                            if (sattr == TName(T_FROM)) return T_FROM;
-                            break;
-                        case 'i':
-                            if (sattr == TName(T_INTTYPE)) return T_INTTYPE;
-                            if (sattr == TName(T_IF)) return T_IF;
-                            if (sattr == TName(T_INCLUDE)) return T_INCLUDE;
-                            if (sattr == TName(T_IS)) return T_IS;
-                            break;
-                        case 'l':
-                            if (sattr == TName(T_CONST)) return T_CONST;
-                            break;
-                        case 'm':
-                            if (sattr == TName(T_MEMBER)) return T_MEMBER;
-                            if (sattr == TName(T_MEMBER_FRAME)) return T_MEMBER_FRAME;
-                            break;
-                        case 'n':
-                            if (sattr == TName(T_NIL)) return T_NIL;
-                            if (sattr == TName(T_NOT)) return T_NOT;
-                            if (sattr == TName(T_NAMESPACE)) return T_NAMESPACE;
-                            break;
-                        case 'o':
-                            if (sattr == TName(T_OR)) { cont = true; return T_OR; }
-                            if (sattr == TName(T_OPERATOR)) { cont = true; return T_OPERATOR; }
-                            break;
-                        case 'p':
-                            if (sattr == TName(T_PROGRAM)) return T_PROGRAM;
-                            if (sattr == TName(T_PRIVATE)) return T_PRIVATE;
-                            if (sattr == TName(T_PAKFILE)) return T_PAKFILE;
-                            break;
-                        case 'r':
-                            if (sattr == TName(T_RETURN)) return T_RETURN;
-                            if (sattr == TName(T_RESOURCE)) return T_RESOURCE;
-                            break;
-                        case 's':
-                            if (sattr == TName(T_STRUCT)) return T_STRUCT;
-                            if (sattr == TName(T_STRTYPE)) return T_STRTYPE;
-                            if (sattr == TName(T_SWITCH)) return T_SWITCH;
-                            if (sattr == TName(T_SUPER)) return T_SUPER;
-                            if (sattr == TName(T_STATIC)) return T_STATIC;
-                            if (sattr == TName(T_STATIC_FRAME)) return T_STATIC_FRAME;
-                            break;
-                        case 't':
-                            if (sattr == TName(T_TYPEOF)) return T_TYPEOF;
-                            break;
-                        case 'v':
-                            if (sattr == TName(T_VOIDTYPE)) return T_VOIDTYPE;
-                            if (sattr == TName(T_VAR)) return T_VAR;
-                            break;
-                        case 'w':
-                            if (sattr == TName(T_WHILE)) return T_WHILE;
-                            break;
-                    }
-                    return T_IDENT;
+                    auto t = Keywords().Lookup(sattr);
+                    if (t == T_AND || t == T_OR || t == T_OPERATOR) cont = true;
+                    return t;
                 }
                 bool isfloat = c == '.' && *p != '.';
                 if (IsDigit(c) || (isfloat && IsDigit(*p))) {
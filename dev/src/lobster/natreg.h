@@ -299,6 +299,7 @@ struct Narg {
                     } else {
                         assert(*tid >= '/' && *tid <= '9');
                         char val = *tid++ - '0';
+                        while (*tid >= '0' && *tid <= '9') val = val * 10 + *tid++ - '0';
                         if (type->ElementIfNil()->Numeric())
                             default_val = val;
                         else
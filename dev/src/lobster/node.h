@@ -28,6 +28,9 @@ struct Node {
     TypeRef exptype;
     Lifetime lt = LT_UNDEF;
     virtual ~Node() {};
+    // Sized, since some nodes are too big for alloc_small.
+    static void *operator new(size_t size) { return CompilerAlloc().alloc((iint)size); }
+    static void operator delete(void *p, size_t size) { CompilerAlloc().dealloc(p, (iint)size); }
     virtual size_t Arity() const { return 0; }
     virtual Node **Children() { return nullptr; }
     virtual void ClearChildren() {}
@@ -283,7 +286,9 @@ BINARY_NODE_T(Switch, "switch", false, Node, value, List, cases, \
     RETURNSMETHOD \
     bool GenerateJumpTable(CodeGen &cg, size_t retval) const; \
     void GenerateTypeDispatch(CodeGen &cg, size_t retval) const; \
-    void GenerateJumpTableMain(CodeGen &cg, size_t retval, int range, int mini) const;)
+    bool GenerateSparseJumpTable(CodeGen &cg, size_t retval, int64_t num) const; \
+    bool GenerateStringJumpTable(CodeGen &cg, size_t retval) const; \
+    int GenerateJumpTableMain(CodeGen &cg, size_t retval, vector<int> &case_starts) const;)
 BINARY_NODE_T(Case, "case", false, List, pattern, Node, cbody, )
 BINARY_NODE(Range, "range", false, start, end, )
 ZERO_NODE(Break, "break", false, RETURNSMETHOD)
@@ -145,6 +145,20 @@ Node *Call::Optimize(Optimizer &opt) {
         (LOBSTER_FRAME_PROFILER && sf->attributes.find("profile") != sf->attributes.end())) {
         return this;
     }
+    // The args get assigned one by one to variables shared by all inlined copies of sf, so if
+    // a later arg contains such a copy itself, e.g. f(1, f(2, 3)), it would overwrite the
+    // earlier ones.
+    for (size_t i = 1; i < children.size(); i++) {
+        bool redefines = false;
+        children[i]->Iterate([&](Node *n) {
+            if (auto def = Is<Define>(n)) {
+                for (auto &p : def->sids)
+                    for (auto &arg : sf->args)
+                        if (p.first == arg.sid) redefines = true;
+            }
+        });
+        if (redefines) return this;
+    }
     auto AddToLocals = [&](const vector<Arg> &av) {
         for (auto &arg : av) {
             // We have to check if the sid already exists, since inlining the same function
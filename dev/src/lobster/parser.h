@@ -447,8 +447,23 @@ struct Parser {
         ExpectId();
         auto &sfield = st.FieldDecl(lastid, gudt);
         TypeRef type = nullptr;
+        int storage = FS_VALUE;
         if (IsNext(T_COLON)) {
-            type = ParseType(false);
+            // Narrow storage types are only valid here, they act as int/float otherwise.
+            if (lex.token == T_IDENT) {
+                auto sid = lex.sattr;
+                if (sid == "int8") storage = FS_INT8;
+                else if (sid == "int16") storage = FS_INT16;
+                else if (sid == "int32") storage = FS_INT32;
+                else if (sid == "float32") storage = FS_FLOAT32;
+            }
+            if (storage != FS_VALUE) {
+                if (gudt->is_struct) Error("narrow field types are only allowed in classes");
+                type = storage == FS_FLOAT32 ? type_float : type_int;
+                lex.Next();
+            } else {
+                type = ParseType(false);
+            }
         }
         Node *init = IsNext(T_ASSIGN) ? ParseExp() : nullptr;
         if (local_member && !init) {
@@ -463,6 +478,7 @@ struct Parser {
             }
         }
         gudt->fields.push_back(Field(&sfield, type, init, member_private, !local_member, lex));
+        gudt->fields.back().storage = storage;
     }
 
     pair<GUDT *, UDT *> ParseSup(bool is_struct) {
@@ -38,9 +38,18 @@ extern int64_t LoadFile(string_view relfilename, string *dest, int64_t start = 0
 // Full absolute path of last file attempted by LoadFile.
 extern string LastAbsPathLoaded();
 
+// Changes whenever the file at this absolute path gets written to (combines modification time
+// and size), or -1 if it can't be found. Useful to know when to reload cached file contents.
+extern int64_t FileVersion(string_view_nt absfilename);
+
 // fopen based implementation of FileLoader above to pass to InitPlatform if needed.
 extern int64_t DefaultLoadFile(string_view_nt absfilename, string *dest, int64_t start, int64_t len);
 
+// Returns the path of the file in the first data dir that has it (like LoadFile, but ignoring
+// pakfiles), for code that needs to open files itself, or empty if it can't be found.
+extern string FindDataFile(string_view relfilename);
+
+extern FILE *OpenFor(string_view filename, const char *mode, bool allow_absolute);
 extern FILE *OpenForWriting(string_view relfilename, bool binary, bool allow_absolute);
 extern FILE *OpenForReading(string_view relfilename, bool binary, bool allow_absolute);
 extern bool WriteFile(string_view relfilename, bool binary, string_view contents, bool allow_absolute);
@@ -57,6 +66,33 @@ extern bool ScanDirAbs(string_view absdir, vector<pair<string, int64_t>> &dest);
 
 extern iint LaunchSubProcess(const char **cmdl, const char *stdins, string &out);
 
+// Lets whoever waits for any of a group of sub processes be woken up when one finishes.
+struct SubProcessSignal {
+    mutex mtx;
+    condition_variable cv;
+    int64_t finished = 0;  // Incremented (while holding mtx) every time one is done.
+};
+
+// A sub process whose output is collected by background threads, so it can be polled and
+// waited on without blocking the caller. See StartSubProcess.
+struct SubProcess {
+    virtual ~SubProcess() {}
+    // Moves any output received so far to the end of out / err. Never blocks.
+    virtual void TakeOutput(string &out, string &err) = 0;
+    // Only possible until CloseStdin is called.
+    virtual bool WriteStdin(string_view data) = 0;
+    virtual void CloseStdin() = 0;
+    // Done means it has exited and all its output was received.
+    virtual bool Done() = 0;
+    // Returns -1 if not done yet.
+    virtual iint ExitCode() = 0;
+    virtual void Kill() = 0;
+};
+
+// Returns nullptr if the process couldn't be launched. signal is notified whenever it is done,
+// which may be on another thread.
+extern SubProcess *StartSubProcess(const char **cmdl, shared_ptr<SubProcessSignal> signal);
+
 extern void QueueTextToSpeech(string_view text);
 extern bool TextToSpeechInit();
 extern bool TextToSpeechUpdate();
@@ -99,6 +135,35 @@ template<typename ...Ts> void LogOutput(OutputType ot, const Ts&... args) {
 // Time:
 extern double SecondsSinceStart();
 
+// Timing instrumentation that is always compiled in (unlike LOBSTER_FRAME_PROFILER, which
+// needs Tracy): named timers whose totals are kept per frame in a ring buffer, and optionally
+// recorded as individual events for a Chrome trace. All of these are thread-safe.
+// Returns the id for this name, creating the timer if needed.
+extern int RegisterTimer(string_view name);
+extern void TimerAdd(int id, double start, double end);
+// Moves this frame's totals into the history of each timer, and also records the time since
+// the last call as timer "frame".
+extern void TimingFrameEnd();
+// Percentiles (0..100) over the recorded frames, false if there's no such timer or no frames.
+extern bool TimerPercentiles(string_view name, const vector<double> &percentiles,
+                             vector<double> &results);
+extern vector<string> TimerNames();
+extern void TimingTrace(bool on);
+// Writes all events recorded since tracing was turned on in Chrome trace event format, for
+// chrome://tracing or Perfetto, and clears them.
+extern bool TimingSaveTrace(string_view filename);
+
+struct ScopedTimer {
+    int id;
+    double start;
+    ScopedTimer(int id) : id(id), start(SecondsSinceStart()) {}
+    ~ScopedTimer() { TimerAdd(id, start, SecondsSinceStart()); }
+};
+
+#define LOBSTER_TIMED_SCOPE(name) \
+    static int lobster_timer_id = RegisterTimer(name); \
+    ScopedTimer lobster_scoped_timer(lobster_timer_id)
+
 // CPU:
 extern int NumHWThreads();
 extern int NumHWCores();
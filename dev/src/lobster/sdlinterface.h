@@ -47,7 +47,13 @@ extern bool SDLGrab(bool on);
 extern void SDLMessageBox(string_view_nt title, string_view_nt msg);
 
 enum SoundType { SOUND_WAV, SOUND_SFXR, SOUND_OGG };
+extern bool SDLSoundInit();
 extern int SDLLoadSound(string_view filename, SoundType st);
+// Split version of SDLLoadSound for background loading: decoding is thread-safe (after
+// SDLSoundInit), adding the result to the set of playable sounds must happen on the main thread.
+extern void *SDLDecodeSound(string_view filename, SoundType st);
+extern bool SDLAddDecodedSound(string_view filename, void *chunk);
+extern void SDLFreeDecodedSound(void *chunk);
 extern int SDLPlaySound(string_view filename, SoundType st, float vol, int loops, int pri);
 extern void SDLHaltSound(int ch);
 extern void SDLPauseSound(int ch);
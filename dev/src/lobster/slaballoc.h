@@ -109,6 +109,7 @@ class SlabAlloc {
     int64_t stats[MAXBUCKETS] = { 0 };
     #endif
     int64_t statbig = 0;
+    int64_t statsmall = 0;
 
     void putinbuckets(char *start, char *end, iint b, iint size) {
         assert(isizeof<DLNodeRaw>() <= size);
@@ -193,6 +194,7 @@ class SlabAlloc {
         #ifdef COLLECT_STATS
             stats[b]++;
         #endif
+        statsmall++;
         if (reuse[b].Empty()) newpage(b);
         auto r = reuse[b].Get();
         ppage(r)->refc++;
@@ -377,6 +379,9 @@ class SlabAlloc {
         return leaks;
     }
 
+    // Total allocations made so far, cheap enough to always be tracked.
+    int64_t num_allocs() { return statsmall + statbig; }
+
     void printstats(bool full = false) {
         iint totalwaste = 0;
         long long totalallocs = 0;
@@ -0,0 +1,176 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Scanning kernels for the string builtins: substring search, searching for characters in a
+// set, ASCII case mapping, and skipping ASCII runs in and validating UTF-8.
+// These look at 16 bytes at a time using SSE2 where available (always on x64), and finish
+// (or do all the work on other platforms) with a plain byte loop.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define LOBSTER_SSE2 1
+    #include <emmintrin.h>
+#else
+    #define LOBSTER_SSE2 0
+#endif
+
+#if LOBSTER_SSE2
+inline __m128i Load16(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+inline uint32_t Mask16(__m128i m) { return (uint32_t)_mm_movemask_epi8(m); }
+#endif
+
+// Same as string_view::find, including returning npos if not found.
+// Candidates are found by comparing the first and last char of sub at 16 positions at once,
+// which rules out nearly all of them before having to do a full compare.
+inline size_t FindSubstring(string_view s, string_view sub, size_t i = 0) {
+    auto n = sub.size();
+    if (n > s.size() || i > s.size() - n) return string_view::npos;
+    if (!n) return i;
+    auto d = s.data();
+    #if LOBSTER_SSE2
+        auto first = _mm_set1_epi8(sub[0]);
+        auto last = _mm_set1_epi8(sub[n - 1]);
+        for (; i + n - 1 + 16 <= s.size(); i += 16) {
+            auto mask = Mask16(_mm_and_si128(_mm_cmpeq_epi8(Load16(d + i), first),
+                                             _mm_cmpeq_epi8(Load16(d + i + n - 1), last)));
+            for (; mask; mask &= mask - 1) {
+                auto j = i + LowZeroBits(mask);
+                if (!memcmp(d + j + 1, sub.data() + 1, n - 1)) return j;
+            }
+        }
+    #endif
+    for (; i + n <= s.size(); i++) {
+        if (d[i] == sub[0] && !memcmp(d + i + 1, sub.data() + 1, n - 1)) return i;
+    }
+    return string_view::npos;
+}
+
+// A set of bytes as a 256 bit bitmap, for find_first_of style searches in O(1) per byte no matter
+// the size of the set. Small sets (the common case, e.g. delimiters or whitespace) are also kept
+// as a list of members, so the SSE2 path can compare against each of them directly.
+class CharSet {
+    uint64_t bits[4] = { 0, 0, 0, 0 };
+    static const int max_members = 8;
+    char members[max_members];
+    int nmembers = 0;  // -1 if too many for the SSE2 path.
+
+    public:
+    explicit CharSet(string_view set) {
+        for (auto c : set) {
+            if (Has(c)) continue;
+            bits[(uint8_t)c >> 6] |= 1ULL << ((uint8_t)c & 63);
+            if (nmembers >= 0) {
+                if (nmembers < max_members) members[nmembers++] = c;
+                else nmembers = -1;
+            }
+        }
+    }
+
+    bool Has(char c) const { return (bits[(uint8_t)c >> 6] >> ((uint8_t)c & 63)) & 1; }
+
+    // Index of the first char at or after i that is in the set (or with IN == false, is not),
+    // or s.size() if none.
+    template<bool IN> size_t Find(string_view s, size_t i = 0) const {
+        auto d = s.data();
+        #if LOBSTER_SSE2
+            if (nmembers >= 0) {
+                __m128i m[max_members];
+                for (int k = 0; k < nmembers; k++) m[k] = _mm_set1_epi8(members[k]);
+                for (; i + 16 <= s.size(); i += 16) {
+                    auto c = Load16(d + i);
+                    auto eq = _mm_setzero_si128();
+                    for (int k = 0; k < nmembers; k++) eq = _mm_or_si128(eq, _mm_cmpeq_epi8(c, m[k]));
+                    auto mask = Mask16(eq);
+                    if (!IN) mask ^= 0xFFFF;
+                    if (mask) return i + LowZeroBits(mask);
+                }
+            }
+        #endif
+        for (; i < s.size(); i++) if (Has(d[i]) == IN) return i;
+        return s.size();
+    }
+
+    // One past the index of the last char not in the set, or 0 if none.
+    size_t FindLastNot(string_view s) const {
+        auto i = s.size();
+        while (i && Has(s[i - 1])) i--;
+        return i;
+    }
+
+    size_t Count(string_view s) const {
+        size_t n = 0;
+        for (size_t i = 0; (i = Find<true>(s, i)) < s.size(); i++) n++;
+        return n;
+    }
+};
+
+// Copies len bytes from src to dest, adding delta to any that are in the ASCII range lo..hi.
+// This is safe on UTF-8, since all multi-byte sequences consist of bytes >= 128.
+inline void ShiftASCIIRange(const char *src, char *dest, size_t len, char lo, char hi, char delta) {
+    assert(lo > 0 && hi < 127);
+    size_t i = 0;
+    #if LOBSTER_SSE2
+        // Signed compares, so bytes >= 128 are negative and never in range.
+        auto vlo = _mm_set1_epi8(char(lo - 1));
+        auto vhi = _mm_set1_epi8(char(hi + 1));
+        auto vdelta = _mm_set1_epi8(delta);
+        for (; i + 16 <= len; i += 16) {
+            auto c = Load16(src + i);
+            auto in = _mm_and_si128(_mm_cmpgt_epi8(c, vlo), _mm_cmplt_epi8(c, vhi));
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_add_epi8(c, _mm_and_si128(in, vdelta)));
+        }
+    #endif
+    for (; i < len; i++) {
+        auto c = src[i];
+        dest[i] = c >= lo && c <= hi ? char(c + delta) : c;
+    }
+}
+
+// Length of the run of ASCII chars s starts with, which need no UTF-8 decoding.
+inline size_t ASCIIPrefix(string_view s) {
+    auto d = s.data();
+    size_t i = 0;
+    #if LOBSTER_SSE2
+        for (; i + 16 <= s.size(); i += 16) {
+            auto mask = Mask16(Load16(d + i));
+            if (mask) return i + LowZeroBits(mask);
+        }
+    #endif
+    while (i < s.size() && !(d[i] & 0x80)) i++;
+    return i;
+}
+
+// Length of the longest prefix of s made of whole, well formed UTF-8 sequences (of up to 6 bytes,
+// as FromUTF8 decodes them), so decoding that prefix needs no further checks. ASCII runs, the
+// bulk of most text, are skipped 16 bytes at a time.
+inline size_t ValidUTF8Prefix(string_view s) {
+    auto d = (const uint8_t *)s.data();
+    size_t i = 0;
+    for (;;) {
+        i += ASCIIPrefix(s.substr(i));
+        if (i == s.size()) return i;
+        // Continuation bytes that should follow the leading one, or -1 if it can't lead.
+        auto c = d[i];
+        auto n = c < 0xC0 ? -1 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF8 ? 3 : c < 0xFC ? 4
+                                                                 : c < 0xFE ? 5 : -1;
+        if (n < 0 || (size_t)n >= s.size() - i) return i;
+        for (int k = 1; k <= n; k++) if ((d[i + k] & 0xC0) != 0x80) return i;
+        i += n + 1;
+    }
+}
+
+// Number of bytes ToUTF8 will write for u, not counting the terminator.
+inline int UTF8Len(int u) {
+    assert(u >= 0);
+    return u < 0x80 ? 1 : u < 0x800 ? 2 : u < 0x10000 ? 3 : u < 0x200000 ? 4 : u < 0x4000000 ? 5 : 6;
+}
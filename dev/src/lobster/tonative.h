@@ -22,6 +22,46 @@ namespace lobster {
 extern string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bool cpp,
                     int runtime_checks, string_view custom_pre_init_name);
 
+// Generates C/C++ for a whole program (ToCPP), or function by function for the lazy JIT, where
+// all direct calls go thru `funtab` (indexed by position in fun_ids) instead.
+class CGenerator {
+  public:
+    NativeRegistry &natreg;
+    string_view bytecode_buffer;
+    bool cpp;
+    int runtime_checks;
+    bool lazy;
+    const bytecode::BytecodeFile *bcf = nullptr;
+    const int *code = nullptr;
+    const type_elem_t *typetable = nullptr;
+    map<int, const bytecode::Function *> function_lookup;
+    const flatbuffers::Vector<const bytecode::SpecIdent *> *specidents = nullptr;
+    size_t len = 0;
+    const int *starting_ip = nullptr;
+    int starting_point = -1;
+    vector<int> var_to_local;
+    vector<int> funstarttables;
+    vector<int> fun_ids;  // Bytecode offsets of all functions, in order.
+    unordered_map<int, int> fun_index;
+    int osr_block = -1;  // If set, emit an entry point that continues at this loop block.
+
+    CGenerator(NativeRegistry &natreg, string_view bytecode_buffer, bool cpp, int runtime_checks,
+               bool lazy);
+    string Init();
+    string FunCall(int id);
+    string FunValue(int id);
+    // If used is given, only declares the ops it refers to.
+    void Prelude(string &sd, string_view used = {});
+    // Emits the function starting at ip, and leaves ip past its end.
+    void Function(string &sd, const int *&ip);
+    void VTables(string &sd);
+    void FunInfoTable(string &sd);
+};
+
+extern string ToCLazyMain(CGenerator &gen, string &sd);
+// With osr_block, emits `osr_<id>` instead, which takes the interpreter's regs/locals/keepvars.
+extern void ToCLazyFunction(CGenerator &gen, string &sd, int fun_idx, int osr_block = -1);
+
 extern bool RunC(const char *source,
                  const char *object_name /* save instead of run if non-null */,
                  string &error,
@@ -29,6 +69,27 @@ extern bool RunC(const char *source,
                  const char **export_names,
                  function<bool (void **)> runf);
 
+// Compiles and relocates source in memory, for code that must stay around after this call
+// (the lazy JIT). Returns the state to pass to FreeC, or nullptr on error.
+extern void *CompileC(const char *source, string &error, const void **imports,
+                      const char **export_names, vector<void *> &exports);
+extern void FreeC(void *state);
+
+// Runs the program with functions compiled on first call, or if tiered, interpreted until they
+// get hot (see jit.cpp). run gets the exports of the main unit, like with RunC.
+extern bool RunLazyJIT(NativeRegistry &nfr, string_view bytecode_buffer, string_view fn,
+                       int runtime_checks, bool tiered, string &sd, string &error,
+                       const function<void(void **)> &run);
+
+// The same, split up such that the program can be run any number of times (each in its own VM),
+// keeping all functions compiled by earlier runs. bytecode_buffer must outlive it.
+// Returns nullptr on error.
+struct LazyJIT;
+extern LazyJIT *NewLazyJIT(NativeRegistry &nfr, string_view bytecode_buffer, string_view fn,
+                           int runtime_checks, bool tiered, string &sd, string &error);
+extern void **LazyJITExports(LazyJIT *jit);
+extern void DeleteLazyJIT(LazyJIT *jit);
+
 inline int ParseOpAndGetArity(int opc, const int *&ip, int &regso) {
     regso = *ip++;
     auto arity = ILArity()[opc];
@@ -56,6 +117,19 @@ inline int ParseOpAndGetArity(int opc, const int *&ip, int &regso) {
             arity = int(ip - ips);
             break;
         }
+        case IL_JUMP_TABLE_SPARSE: {
+            auto n = *ip++;
+            ip += n * 2 + 1;  // values, targets, default.
+            arity = int(ip - ips);
+            break;
+        }
+        case IL_JUMP_TABLE_STRING: {
+            ip++;  // owned.
+            auto n = *ip++;
+            ip += n * 4 + 1;  // (len, hash, stringidx, target) per string, default.
+            arity = int(ip - ips);
+            break;
+        }
         case IL_FUNSTART: {
             ip++;  // function idx.
             ip++;  // max regs.
@@ -328,6 +328,22 @@ class Xoshiro256SS {
         }
     }
 
+    // Equivalent to 2^128 calls to Random(), used to create non-overlapping streams from a
+    // single seed, e.g. one per thread.
+    void Jump() {
+        static const uint64_t jump[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                         0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+        uint64_t t[4] = { 0, 0, 0, 0 };
+        for (auto j : jump) {
+            for (int b = 0; b < 64; b++) {
+                if (j & (uint64_t(1) << b)) {
+                    for (int i = 0; i < 4; i++) t[i] ^= s[i];
+                }
+                Random();
+            }
+        }
+        for (int i = 0; i < 4; i++) s[i] = t[i];
+    }
 };
 
 template<typename T> struct RandomNumberGenerator {
@@ -335,6 +351,13 @@ template<typename T> struct RandomNumberGenerator {
 
     void seed(typename T::rnd_type s) {
         rnd.ReSeed(s);
+        n2_cached = false;
+    }
+
+    // Only available for generators that implement Jump().
+    void jump() {
+        rnd.Jump();
+        n2_cached = false;
     }
 
     int rnd_int(int max) {
@@ -902,6 +925,17 @@ inline int HighZeroBits(uint64_t val) {
     #endif
 }
 
+inline int LowZeroBits(uint32_t val) {
+    assert(val);
+    #ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, val);
+        return (int)i;
+    #else
+        return __builtin_ctz(val);
+    #endif
+}
+
 
 // string & string_view helpers.
 
@@ -122,10 +122,16 @@ enum type_elem_t : int {  // Strongly typed element of typetable.
 
 struct VM;
 
+// How a class field is stored. Fields declared as e.g. `hp:int16` are narrow, and classes
+// that have any are packed: their fields are laid out in declaration order, each aligned to
+// its own size, rather than being an array of Value.
+enum FieldStorage { FS_VALUE, FS_INT8, FS_INT16, FS_INT32, FS_FLOAT32 };
+
 struct TIField {
     type_elem_t type;
     type_elem_t parent;
     int defval;
+    int storage;  // Byte offset << 3 | FieldStorage.
 };
 
 struct TypeInfo {
@@ -138,6 +144,7 @@ struct TypeInfo {
             int vtable_start_or_bitmask;
             type_elem_t superclass;
             int serializable_id;
+            int packed_size;       // Size of the fields if packed, 0 otherwise.
             TIField elemtypes[1];  // len elems.
         };
         int enumidx;       // V_INT, -1 if not an enum.
@@ -156,6 +163,8 @@ struct TypeInfo {
         return pti >= 0 ? pti : elemtypes[i].type;
     }
 
+    iint ObjectBytes() const;
+
     type_elem_t SingleType() const {
         if (!len) return TYPE_ELEM_ANY;
         for (int i = 1; i < len; i++)
@@ -650,6 +659,39 @@ template<typename T, int N> struct InlineVec {
 template<typename T> inline T *AllocSubBuf(VM &vm, iint size, type_elem_t tti);
 template<typename T> inline void DeallocSubBuf(VM &vm, T *v, iint size);
 
+// Offsets and sizes of packed classes are in bytes as laid out by the compiler, which
+// assumes 8 byte Values. Builds where Value carries a type tag scale them up accordingly.
+inline iint FieldOffset(int storage) {
+    return (storage >> 3) * ssizeof<Value>() / 8;
+}
+
+inline iint TypeInfo::ObjectBytes() const {
+    return packed_size ? packed_size * ssizeof<Value>() / 8 : len * ssizeof<Value>();
+}
+
+// Loads a field with the given FieldStorage, widened to a Value.
+inline Value LoadField(const uint8_t *p, int kind) {
+    switch (kind) {
+        case FS_INT8:    { int8_t  x; memcpy(&x, p, sizeof(x)); return Value((iint)x); }
+        case FS_INT16:   { int16_t x; memcpy(&x, p, sizeof(x)); return Value((iint)x); }
+        case FS_INT32:   { int32_t x; memcpy(&x, p, sizeof(x)); return Value((iint)x); }
+        case FS_FLOAT32: { float   x; memcpy(&x, p, sizeof(x)); return Value(x); }
+        default:         { Value   x; memcpy(&x, p, sizeof(x)); return x; }
+    }
+}
+
+// Stores v narrowed to the given FieldStorage, returns false if it didn't fit (and got
+// truncated). Floats are just rounded.
+inline bool StoreField(uint8_t *p, int kind, Value v) {
+    switch (kind) {
+        case FS_INT8:    { auto x = (int8_t)v.ival();  memcpy(p, &x, sizeof(x)); return x == v.ival(); }
+        case FS_INT16:   { auto x = (int16_t)v.ival(); memcpy(p, &x, sizeof(x)); return x == v.ival(); }
+        case FS_INT32:   { auto x = (int32_t)v.ival(); memcpy(p, &x, sizeof(x)); return x == v.ival(); }
+        case FS_FLOAT32: { auto x = (float)v.fval();   memcpy(p, &x, sizeof(x)); return true; }
+        default:         { memcpy(p, &v, sizeof(v)); return true; }
+    }
+}
+
 struct LObject : RefObj {
     LObject(type_elem_t _tti) : RefObj(_tti) {}
 
@@ -659,10 +701,22 @@ struct LObject : RefObj {
     Value *Elems() const { return (Value *)(this + 1); }
 
     // This may only be called from a context where i < len has already been ensured/asserted.
+    // For packed classes, i must be the Value index of the field (its byte offset / 8).
     Value &AtS(iint i) const {
         return Elems()[i];
     }
 
+    uint8_t *Bytes() const { return (uint8_t *)(this + 1); }
+
+    // Slot access that works for any class, widening/narrowing fields as needed.
+    Value GetSlot(const TypeInfo &ti, iint i) const;
+    // Does not change refcounts.
+    void SetSlot(VM &vm, const TypeInfo &ti, iint i, Value v);
+    // Like CopyElemsShallow, but for any class, from one Value per slot.
+    void InitSlots(VM &vm, const TypeInfo &ti, const Value *from);
+    // Elems() for generic code that iterates over slots: unpacks into buf if packed.
+    const Value *ElemsUnpacked(const TypeInfo &ti, vector<Value> &buf) const;
+
     void DeleteSelf(VM &vm);
 
     // This may only be called from a context where i < len has already been ensured/asserted.
@@ -675,20 +729,22 @@ struct LObject : RefObj {
 
     bool Equal(VM &vm, const LObject &o) {
         // RefObj::Equal has already guaranteed the typeoff's are the same.
-        auto len = Len(vm);
+        auto &sti = ti(vm);
+        auto len = sti.len;
         assert(len == o.Len(vm));
         for (iint i = 0; i < len; i++) {
             auto et = ElemTypeS(vm, i).t;
-            if (!AtS(i).Equal(vm, et, o.AtS(i), et, true))
+            if (!GetSlot(sti, i).Equal(vm, et, o.GetSlot(sti, i), et, true))
                 return false;
         }
         return true;
     }
 
     uint64_t Hash(VM &vm) {
-        auto hash = SplitMix64Hash((uint64_t)Len(vm));
-        for (iint i = 0; i < Len(vm); i++) {
-            hash = hash * 31 + AtS(i).Hash(vm, ElemTypeS(vm, i).t);
+        auto &sti = ti(vm);
+        auto hash = SplitMix64Hash((uint64_t)sti.len);
+        for (iint i = 0; i < sti.len; i++) {
+            hash = hash * 31 + GetSlot(sti, i).Hash(vm, ElemTypeS(vm, i).t);
         }
         return hash;
     }
@@ -697,30 +753,45 @@ struct LObject : RefObj {
         t_memcpy(Elems(), from, len);
     }
 
+    // Only fields that can be refs are affected, and those are never narrow, so these work
+    // for packed classes as well.
+    Value &RefSlot(const TypeInfo &ti, iint i) const {
+        return *(Value *)(Bytes() + FieldOffset(ti.elemtypes[i].storage));
+    }
+
     void IncRefElems(VM &vm, iint len) {
+        auto &sti = ti(vm);
         for (iint i = 0; i < len; i++) {
-            AtS(i).LTINCTYPE(ElemTypeS(vm, i).t);
+            auto et = ElemTypeS(vm, i).t;
+            if (IsRefNil(et)) RefSlot(sti, i).LTINCTYPE(et);
         }
     }
 
     void CopyRefElemsDeep(VM &vm, iint len, iint depth) {
+        auto &sti = ti(vm);
         for (iint i = 0; i < len; i++) {
-            if (IsRefNil(ElemTypeS(vm, i).t)) AtS(i) = AtS(i).CopyRef(vm, depth);
+            if (IsRefNil(ElemTypeS(vm, i).t)) {
+                auto &v = RefSlot(sti, i);
+                v = v.CopyRef(vm, depth);
+            }
         }
     }
 
     size_t MemoryUsage(VM &vm) {
-        return sizeof(LObject) + Len(vm) * sizeof(iint);
+        return sizeof(LObject) + ti(vm).ObjectBytes();
     }
 };
 
 struct LVector : RefObj {
     iint len;    // has to match the Value integer type, since we allow the length to be obtained
-    iint maxl;
+    iint maxl;   // Capacity starting at v.
     iint width;  // TODO: would be great to not have to store this.
 
     private:
     Value *v;   // use At()
+    // Capacity before v. Removing from / inserting near the front moves v instead of the rest
+    // of the elements, so using a vector as a queue or deque is amortized O(1) at both ends.
+    iint front = 0;
 
     public:
     LVector(VM &vm, iint _initial, iint _max, type_elem_t _tti);
@@ -730,7 +801,7 @@ struct LVector : RefObj {
     ssize_t SLen() { return (ssize_t)len; }
 
     void DeallocBuf(VM &vm) {
-        if (v) DeallocSubBuf(vm, v, maxl * width);
+        if (v) DeallocSubBuf(vm, v - front * width, (front + maxl) * width);
     }
 
     void DestructElementRange(VM &vm, iint from, iint to);
@@ -741,6 +812,8 @@ struct LVector : RefObj {
     const TypeInfo &ElemType(VM &vm) const;
 
     void Resize(VM &vm, iint newmax);
+    void GrowFront(VM &vm);
+    void RemoveGap(iint i, iint n);
 
     void MinCapacity(VM& vm, iint newmax) {
         if (newmax > maxl) Resize(vm, newmax);
@@ -779,8 +852,17 @@ struct LVector : RefObj {
 
     void Insert(VM &vm, const Value *vals, iint i) {
         assert(i >= 0 && i <= len); // note: insertion right at the end is legal, hence <=
-        if (len + 1 > maxl) Resize(vm, std::max(len + 1, maxl ? maxl * 2 : 4));
-        t_memmove(v + (i + 1) * width, v + i * width, (len - i) * width);
+        if (i < len / 2) {
+            // Closer to the front, so move the elements before i down instead.
+            if (!front) GrowFront(vm);
+            v -= width;
+            front--;
+            maxl++;
+            t_memmove(v, v + width, i * width);
+        } else {
+            if (len + 1 > maxl) Resize(vm, std::max(len + 1, maxl ? maxl * 2 : 4));
+            t_memmove(v + (i + 1) * width, v + i * width, (len - i) * width);
+        }
         len++;
         tsnz_memcpy(v + i * width, vals, width);
     }
@@ -911,6 +993,10 @@ struct VM : VMArgs {
     SlabAlloc pool;
 
     Value *temp_lval = nullptr;
+    // Lvalue ops on a narrow field work on narrow_lval, and LV_STOREN writes it back.
+    Value narrow_lval;
+    uint8_t *narrow_ptr = nullptr;
+    int narrow_storage = 0;
 
     fun_base_t next_call_target = 0;
 
@@ -956,6 +1042,11 @@ struct VM : VMArgs {
     vector<thread> workers;
     TupleSpace *tuple_space = nullptr;
 
+    // Owned by each VM, such that workers don't share generator state. Workers get their
+    // stream by jumping ahead from the parent's, see StartWorkers.
+    RandomNumberGenerator<MersenneTwister> rndm;
+    RandomNumberGenerator<Xoshiro256SS> rndx;
+
     // A runtime error triggers code that does extensive stack trace & variable dumping, which
     // for certain errors could trigger yet more errors. This vars ensures that we don't.
     bool error_has_occured = false;  // Don't error again.
@@ -1054,6 +1145,7 @@ struct VM : VMArgs {
     void DivErr(iint divisor) { Error(divisor ? "integer overflow" : "division by zero"); }
     void DivErr(double) { assert(false); }
     void IDXErr(iint i, iint n, const RefObj *v);
+    void NarrowErr(Value v, int storage);
     void BCallRetCheck(StackPtr sp, const NativeFun *nf);
     iint GrabIndex(StackPtr &sp, int len);
 
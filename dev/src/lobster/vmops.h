@@ -1,4 +1,5 @@
 #include "lobster/geom.h"
+#include "lobster/il.h"
 #include "lobster/vmdata.h"
 #include "lobster/natreg.h"
 #include "lobster/bytecode_generated.h"
@@ -283,6 +284,59 @@ BCALLOP(5, auto a4 = Pop(sp);auto a3 = Pop(sp);auto a2 = Pop(sp);auto a1 = Pop(s
 BCALLOP(6, auto a5 = Pop(sp);auto a4 = Pop(sp);auto a3 = Pop(sp);auto a2 = Pop(sp);auto a1 = Pop(sp);auto a0 = Pop(sp), (sp, vm, a0, a1, a2, a3, a4, a5));
 BCALLOP(7, auto a6 = Pop(sp);auto a5 = Pop(sp);auto a4 = Pop(sp);auto a3 = Pop(sp);auto a2 = Pop(sp);auto a1 = Pop(sp);auto a0 = Pop(sp), (sp, vm, a0, a1, a2, a3, a4, a5, a6));
 
+// Inline versions of the flatbuffers_field_* builtins (see file.cpp), which codegen emits
+// instead of a builtin call, such that reading a field is just a few bounds checked loads.
+template<typename T> VM_INLINE T FBRead(VM &vm, const LString *s, iint i) {
+    if ((uint64_t)i + sizeof(T) > (uint64_t)s->len) vm.IDXErr(i, s->len - ssizeof<T>(), s);
+    return ReadValLE<T, false>(s, i);
+}
+
+// Returns the position of the field, or 0 if not present.
+VM_INLINE iint FBFieldPos(VM &vm, const LString *s, iint i, iint vo) {
+    auto vi = i - FBRead<flatbuffers::soffset_t>(vm, s, i);
+    auto vtable_size = FBRead<flatbuffers::voffset_t>(vm, s, vi);
+    if ((uint64_t)vo >= (uint64_t)vtable_size) return 0;
+    auto field_offset = FBRead<flatbuffers::voffset_t>(vm, s, vi + vo);
+    return field_offset ? i + field_offset : 0;
+}
+
+VM_INLINE void U_FBFIELD(VM &vm, StackPtr sp, int kind) {
+    auto def = Pop(sp);
+    auto vo = Pop(sp).ival();
+    auto i = Pop(sp).ival();
+    auto s = Pop(sp).sval();
+    auto fi = FBFieldPos(vm, s, i, vo);
+    if (!fi) { Push(sp, def); return; }
+    switch (kind) {
+        case FB_INT64:   Push(sp, FBRead<int64_t>(vm, s, fi)); break;
+        case FB_INT32:   Push(sp, FBRead<int32_t>(vm, s, fi)); break;
+        case FB_INT16:   Push(sp, FBRead<int16_t>(vm, s, fi)); break;
+        case FB_INT8:    Push(sp, FBRead<int8_t>(vm, s, fi)); break;
+        case FB_UINT64:  Push(sp, (iint)FBRead<uint64_t>(vm, s, fi)); break;
+        case FB_UINT32:  Push(sp, FBRead<uint32_t>(vm, s, fi)); break;
+        case FB_UINT16:  Push(sp, FBRead<uint16_t>(vm, s, fi)); break;
+        case FB_UINT8:   Push(sp, FBRead<uint8_t>(vm, s, fi)); break;
+        case FB_FLOAT64: Push(sp, FBRead<double>(vm, s, fi)); break;
+        default:         Push(sp, FBRead<float>(vm, s, fi)); break;
+    }
+}
+
+VM_INLINE void U_FBOFFSET(VM &vm, StackPtr sp, int kind) {
+    auto vo = Pop(sp).ival();
+    auto i = Pop(sp).ival();
+    auto s = Pop(sp).sval();
+    auto fi = FBFieldPos(vm, s, i, vo);
+    if (kind == FB_PRESENT) { Push(sp, fi != 0); return; }
+    if (!fi) { Push(sp, 0); return; }
+    if (kind == FB_STRUCT) { Push(sp, fi); return; }
+    auto target = fi + FBRead<flatbuffers::uoffset_t>(vm, s, fi);
+    switch (kind) {
+        case FB_TABLE: Push(sp, target); break;
+        case FB_VECTOR: Push(sp, target + ssizeof<flatbuffers::uoffset_t>()); break;
+        default: Push(sp, FBRead<flatbuffers::uoffset_t>(vm, s, target)); break;
+    }
+}
+
 VM_INLINE void U_ASSERTR(VM &vm, StackPtr sp, int line, int fileidx, int stringidx) {
     if (Top(sp).False()) {
         vm.last_line = line;
@@ -307,9 +361,10 @@ VM_INLINE void U_NEWVEC(VM &vm, StackPtr sp, int ty, int len) {
 
 VM_INLINE void U_NEWOBJECT(VM &vm, StackPtr sp, int ty) {
     auto type = (type_elem_t)ty;
-    auto len = vm.GetTypeInfo(type).len;
+    auto &ti = vm.GetTypeInfo(type);
+    auto len = ti.len;
     auto vec = vm.NewObject(len, type);
-    if (len) vec->CopyElemsShallow(TopPtr(sp) - len, len);
+    if (len) vec->InitSlots(vm, ti, TopPtr(sp) - len);
     PopN(sp, len);
     Push(sp, Value(vec));
 }
@@ -651,6 +706,12 @@ VM_INLINE void U_PUSHFLDMREF(VM &vm, StackPtr sp, int i) {
         Push(sp, r.oval()->AtS(i));
     }
 }
+// Narrow field of a packed class, storage as in TIField.
+VM_INLINE void U_PUSHFLDN(VM &vm, StackPtr sp, int storage) {
+    Value r = Pop(sp);
+    VMASSERT(vm, r.ref());
+    Push(sp, LoadField(r.oval()->Bytes() + FieldOffset(storage), storage & 7));
+}
 VM_INLINE void U_PUSHFLD2V(VM &vm, StackPtr sp, int i, int l) {
     Value r = Pop(sp);
     VMASSERT(vm, r.ref());
@@ -772,6 +833,44 @@ VM_INLINE void U_JUMP_TABLE_DISPATCH(VM &, StackPtr, const int *) {
     assert(false);
 }
 
+VM_INLINE void U_JUMP_TABLE_SPARSE(VM &, StackPtr, const int *) {
+    assert(false);
+}
+
+VM_INLINE void U_JUMP_TABLE_STRING(VM &, StackPtr, const int *) {
+    assert(false);
+}
+
+// Returns the target for a string switch, table is the IL_JUMP_TABLE_STRING args, which are
+// sorted on (length, hash) so we only ever compare against a single candidate (barring hash
+// collisions).
+VM_INLINE int GetStringSwitchID(VM &vm, Value self, const int *table) {
+    auto owned = table[0];
+    auto n = table[1];
+    auto entries = table + 2;
+    auto sv = self.sval()->strv();
+    auto len = (int)sv.size();
+    auto hash = (int)FNV1A32(sv);
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        auto mid = (lo + hi) / 2;
+        auto e = entries + mid * 4;
+        if (e[0] < len || (e[0] == len && e[1] < hash)) lo = mid + 1;
+        else hi = mid;
+    }
+    auto id = entries[n * 4];  // Default.
+    for (; lo < n; lo++) {
+        auto e = entries + lo * 4;
+        if (e[0] != len || e[1] != hash) break;
+        if (vm.bcf->stringtable()->Get(e[2])->string_view() == sv) {
+            id = e[3];
+            break;
+        }
+    }
+    if (owned) self.LTDECRTNIL(vm);
+    return id;
+}
+
 VM_INLINE void U_ISTYPE(VM &vm, StackPtr sp, int ty) {
     auto to = (type_elem_t)ty;
     auto v = Pop(sp);
@@ -796,6 +895,15 @@ VM_INLINE void U_LVAL_FLD(VM &vm, StackPtr sp, int i) {
     vm.temp_lval = &GetFieldLVal(vm, sp, i);
 }
 
+VM_INLINE void U_LVAL_FLDN(VM &vm, StackPtr sp, int storage) {
+    Value r = Pop(sp);
+    VMASSERT(vm, r.ref());
+    vm.narrow_ptr = r.oval()->Bytes() + FieldOffset(storage);
+    vm.narrow_storage = storage;
+    vm.narrow_lval = LoadField(vm.narrow_ptr, storage & 7);
+    vm.temp_lval = &vm.narrow_lval;
+}
+
 VM_INLINE void U_LVAL_IDXVI(VM &vm, StackPtr sp) {
     auto x = Pop(sp).ival();
     vm.temp_lval = &GetVecLVal(vm, sp, x);
@@ -945,6 +1053,14 @@ VM_INLINE void U_LV_FMM(VM & vm, StackPtr) {
     a.setfval(a.fval() - 1);
 }
 
+// Ends any lvalue op on a narrow field.
+VM_INLINE void U_LV_STOREN(VM &vm, StackPtr) {
+    if (!StoreField(vm.narrow_ptr, vm.narrow_storage & 7, vm.narrow_lval) &&
+        vm.runtime_checks >= RUNTIME_ASSERT) {
+        vm.NarrowErr(vm.narrow_lval, vm.narrow_storage);
+    }
+}
+
 VM_INLINE void U_PROFILE(VM &, StackPtr, int) {
     assert(false);
 }
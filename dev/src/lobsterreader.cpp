@@ -82,7 +82,7 @@ struct Deserializer {
                 }
                 if (ti.t == V_CLASS) {
                     auto vec = vm.NewObject(ti.len, typeoff);
-                    if (ti.len) vec->CopyElemsShallow(&stack[stack.size() - (size_t)ti.len], ti.len);
+                    if (ti.len) vec->InitSlots(vm, ti, &stack[stack.size() - (size_t)ti.len]);
                     PopVN(ti.len);
                     PushV(vec, true);
                 }
@@ -113,64 +113,337 @@ struct Deserializer {
     }
 };
 
-struct ValueParser : Deserializer {
-    vector<pair<string, string>> filenames;
-    Lex lex;
+// Tokenizer for just the subset of Lobster syntax that parse_data accepts. Much simpler than
+// Lex, since data has no indentation, keywords (besides nil) or string interpolation, so it
+// doesn't need to track brackets or lines (we compute the line only when reporting an error).
+struct DataLexer {
+    const char *src, *end, *p, *tokenstart;
+    TType token = T_NONE;
+    int64_t ival = 0;
+    double fval = 0.0;
+    string sval;
+    string_view sattr;
+
+    // src must be 0-terminated.
+    DataLexer(string_view _src) : src(_src.data()), end(_src.data() + _src.size()), p(src),
+                                  tokenstart(src) {
+        Next();
+    }
+
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f';
+    }
+
+    // Any character that ends a run of plain characters in a string constant.
+    static bool IsStrSpecial(char c) {
+        static const auto table = []() {
+            array<bool, 256> t {};
+            for (int i = 0; i < ' '; i++) t[i] = true;
+            t['\"'] = t['\''] = t['\\'] = t[127] = true;
+            return t;
+        }();
+        return table[(uint8_t)c];
+    }
+
+    // Same test for 8 characters at once, see "Determine if a word has a byte less than n"
+    // in Bit Twiddling Hacks. May have false positives past the first special char.
+    static bool HasStrSpecial(uint64_t w) {
+        const uint64_t ones = ~0ULL / 255, highs = ones * 128;
+        auto has_less = [&](uint64_t x, uint64_t n) { return (x - ones * n) & ~x & highs; };
+        auto has_byte = [&](uint8_t b) { return has_less(w ^ (ones * b), 1); };
+        return has_less(w, ' ') | has_byte('\"') | has_byte('\'') | has_byte('\\') |
+               has_byte(127);
+    }
+
+    void Next() {
+        for (;;) {
+            while (IsSpace(*p)) p++;
+            if (*p != '/') break;
+            if (p[1] == '/') {
+                while (*p != '\n' && *p != '\0') p++;
+            } else if (p[1] == '*') {
+                auto close = strstr(p + 2, "*/");
+                if (!close) {
+                    tokenstart = p;
+                    Error("end of file in multi-line comment");
+                }
+                p = close + 2;
+            } else {
+                break;
+            }
+        }
+        tokenstart = p;
+        token = NextToken();
+        sattr = string_view(tokenstart, p - tokenstart);
+    }
+
+    TType NextToken() {
+        auto c = *p++;
+        switch (c) {
+            case '\0': p--; return T_ENDOFFILE;
+            case '[': return T_LEFTBRACKET;
+            case ']': return T_RIGHTBRACKET;
+            case '{': return T_LEFTCURLY;
+            case '}': return T_RIGHTCURLY;
+            case ',': return T_COMMA;
+            case '-':
+                // Fold the sign into the literal, saves the parser from having to patch it.
+                if (Lex::IsDigit(*p) || (*p == '.' && Lex::IsDigit(p[1]))) {
+                    auto t = Number(p);
+                    if (t == T_INT) ival = -ival; else fval = -fval;
+                    return t;
+                }
+                return T_MINUS;
+            case '\"':
+            case '\'':
+                return StringConstant(c == '\'');
+            default:
+                if (Lex::IsIdentStart(c)) {
+                    while (Lex::IsIdentChar(*p)) p++;
+                    return string_view(tokenstart, p - tokenstart) == "nil" ? T_NIL : T_IDENT;
+                }
+                if (Lex::IsDigit(c) || (c == '.' && Lex::IsDigit(*p))) return Number(p - 1);
+                Error(c < ' ' || c >= 127 ? cat("illegal token: [ascii ", int(c), "]")
+                                          : cat("illegal token: \'", string(1, c), "\'"));
+                return T_NONE;
+        }
+    }
+
+    TType Number(const char *start) {
+        p = start;
+        if (p[0] == '0' && p[1] == 'x') {
+            p += 2;
+            while (Lex::IsXDigit(*p)) p++;
+            ival = parse_int<int64_t>(string_view(start + 2, p - start - 2), 16);
+            return T_INT;
+        }
+        uint64_t acc = 0;
+        while (Lex::IsDigit(*p)) acc = acc * 10 + uint64_t(*p++ - '0');
+        auto isfloat = false;
+        if (*p == '.' && p[1] != '.' && !Lex::IsAlpha(p[1])) {
+            p++;
+            isfloat = true;
+            while (Lex::IsDigit(*p)) p++;
+        }
+        if (isfloat && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (*p == '+' || *p == '-') p++;
+            while (Lex::IsDigit(*p)) p++;
+        }
+        auto num = string_view(start, p - start);
+        if (isfloat) {
+            fval = parse_float<double>(num);
+            return T_FLOAT;
+        }
+        // Past 18 digits acc may have overflowed, let parse_int deal with it like Lex does.
+        ival = num.size() <= 18 ? (int64_t)acc : parse_int<int64_t>(num);
+        return T_INT;
+    }
+
+    TType StringConstant(bool character_constant) {
+        sval.clear();
+        if (!character_constant && p[0] == '\"' && p[1] == '\"') {
+            p += 2;
+            if (*p == '\r') p++;
+            if (*p == '\n') p++;
+            auto close = strstr(p, "\"\"\"");
+            if (!close) Error("end of file found in multi-line string constant");
+            for (; p < close; p++) if (*p != '\r') sval += *p;
+            p += 3;
+            return T_STR;
+        }
+        for (;;) {
+            // Bulk copy runs of plain characters, which is most of any string.
+            auto run = p;
+            while (end - p >= 8) {
+                uint64_t w;
+                memcpy(&w, p, sizeof(w));
+                if (HasStrSpecial(w)) break;
+                p += 8;
+            }
+            while (!IsStrSpecial(*p)) p++;
+            sval.append(run, p - run);
+            switch (auto c = *p++) {
+                case '\"':
+                    if (character_constant)
+                        Error("\" should be prefixed with a \\ in a character constant");
+                    return T_STR;
+                case '\'':
+                    if (!character_constant)
+                        Error("\' should be prefixed with a \\ in a string constant");
+                    if (sval.size() > 8) Error("character constant too long");
+                    ival = 0;
+                    for (auto ch : sval) ival = (ival << 8) + ch;
+                    return T_INT;
+                case '\\':
+                    Escape();
+                    break;
+                default:
+                    p--;
+                    if (c == '\0' || c == '\r' || c == '\n')
+                        Error("end of line found in string constant");
+                    Error("unprintable character in string constant");
+            }
+        }
+    }
+
+    void Escape() {
+        auto HexDigit = [](char c) -> char {
+            if (Lex::IsDigit(c)) return c - '0';
+            return c - (c < 'a' ? 'A' : 'a') + 10;
+        };
+        auto c = *p++;
+        switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case '\\':
+            case '\"':
+            case '\'':
+            case '{':
+            case '}':
+                break;
+            case 'x':
+                if (!Lex::IsXDigit(*p) || !Lex::IsXDigit(p[1]))
+                    Error("illegal hexadecimal escape code in string constant");
+                c = HexDigit(*p++) << 4;
+                c |= HexDigit(*p++);
+                break;
+            case 'u': {
+                for (int i = 0; i < 4; i++)
+                    if (!Lex::IsXDigit(p[i]))
+                        Error("illegal unicode escape code in string constant");
+                int i = 0;
+                for (int j = 0; j < 4; j++) i = (i << 4) | HexDigit(*p++);
+                char buf[7];
+                ToUTF8(i, buf);
+                sval += buf;
+                return;
+            }
+            default:
+                p--;
+                Error("unknown control code in string constant");
+        }
+        sval += c;
+    }
+
+    string_view TokStr(TType t) {
+        return TName(t);
+    }
 
-    ValueParser(VM &vm, string_view _src) : Deserializer(vm), lex("string", filenames, _src) {
-        lex.do_string_interpolation = false;
+    string_view TokStr() {
+        switch (token) {
+            case T_IDENT:
+            case T_FLOAT:
+            case T_INT:
+            case T_STR:
+                return sattr;
+            default:
+                return TName(token);
+        }
     }
 
+    // Same format as Lex::Error.
+    void Error(string_view msg) {
+        auto line = 1 + std::count(src, tokenstart, '\n');
+        auto err = cat("string(", line, "): error: ", msg);
+        auto begin = tokenstart;
+        auto lend = max(p, tokenstart);
+        while (begin > src && *(begin - 1) != '\n') begin--;
+        while (*lend && *lend != '\n' && *lend != '\r') lend++;
+        if (lend - begin > 0) {
+            append(err, "\nin: ", string_view(begin, lend - begin));
+            if (p > tokenstart) {
+                append(err, "\nat: ");
+                for (; begin < tokenstart; begin++) err.push_back(' ');
+                for (; begin < p && *begin != '\n'; begin++) err.push_back('^');
+            }
+        }
+        THROW_OR_ABORT(err);
+    }
+};
+
+struct ValueParser : Deserializer {
+    DataLexer lex;
+
+    ValueParser(VM &vm, string_view _src) : Deserializer(vm), lex(_src) {}
+
     void Parse(StackPtr &sp, type_elem_t typeoff) {
         ParseFactor(typeoff, true);
-        Gobble(T_LINEFEED);
         Expect(T_ENDOFFILE);
         assert(stack.size() == 1);
         Push(sp, PopV());
     }
 
-    // Vector or struct.
-    void ParseElems(TType end, type_elem_t typeoff, iint numelems, bool push) {
-        Gobble(T_LINEFEED);
+    // Calls f for each element, up to and including the end token.
+    template<typename F> void ParseList(TType end, F f) {
+        if (lex.token == end) {
+            lex.Next();
+            return;
+        }
+        for (;;) {
+            f();
+            if (lex.token == end) break;
+            Expect(T_COMMA);
+        }
+        lex.Next();
+    }
+
+    // A guess at the number of elements of a vector of scalars starting at the current
+    // token, so we can allocate it at its final size. Only has to be right in the common case.
+    iint EstimateScalars() {
+        if (lex.token == T_RIGHTBRACKET) return 0;
+        auto close = (const char *)memchr(lex.p, ']', lex.end - lex.p);
+        return close ? std::count(lex.p, close, ',') + 1 : 0;
+    }
+
+    // Vectors are built in place (rather than collecting all elements on the stack first),
+    // and scalar elements don't go through the stack at all.
+    void ParseVector(type_elem_t typeoff, bool push) {
+        auto &ti = vm.GetTypeInfo(typeoff);
+        if (!push) {
+            auto subt = ti.t == V_VECTOR ? ti.subt : TYPE_ELEM_ANY;
+            ParseList(T_RIGHTBRACKET, [&]() { ParseFactor(subt, false); });
+            return;
+        }
+        auto &sti = vm.GetTypeInfo(ti.subt);
+        auto width = IsStruct(sti.t) ? sti.len : 1;
+        auto scalar = (sti.t == V_INT && sti.enumidx < 0) || sti.t == V_FLOAT;
+        auto vec = vm.NewVec(0, scalar ? EstimateScalars() : 0, typeoff);
+        // On the stack, so it gets freed on error.
+        PushV(vec, true);
+        ParseList(T_RIGHTBRACKET, [&]() {
+            if (scalar && lex.token == (sti.t == V_INT ? T_INT : T_FLOAT)) {
+                vec->Push(vm, sti.t == V_INT ? Value(lex.ival) : Value(lex.fval));
+                lex.Next();
+                return;
+            }
+            ParseFactor(ti.subt, true);
+            // Ownership of any refs moves to the vector.
+            vec->PushVW(vm, stack.data() + stack.size() - width);
+            PopVN(width);
+        });
+    }
+
+    // Struct or class fields.
+    void ParseFields(type_elem_t typeoff, bool push) {
         auto &ti = vm.GetTypeInfo(typeoff);
         auto stack_start = stack.size();
         auto NumElems = [&]() { return iint(stack.size() - stack_start); };
-        if (lex.token == end) lex.Next();
-        else {
-            for (;;) {
-                if (NumElems() == numelems) {
-                    ParseFactor(TYPE_ELEM_ANY, false);
-                } else {
-                    auto eti = ti.t == V_VECTOR ? ti.subt : ti.GetElemOrParent(NumElems());
-                    ParseFactor(eti, push);
-                }
-                bool haslf = lex.token == T_LINEFEED;
-                if (haslf) lex.Next();
-                if (lex.token == end) break;
-                if (!haslf) Expect(T_COMMA);
-            }
-            lex.Next();
-        }
+        ParseList(T_RIGHTCURLY, [&]() {
+            // Elements past the end of the current definition get parsed but dropped.
+            if (!push || NumElems() == ti.len) ParseFactor(TYPE_ELEM_ANY, false);
+            else ParseFactor(ti.GetElemOrParent(NumElems()), true);
+        });
         if (!push) return;
-        if (numelems >= 0) {
-            while (NumElems() < numelems) {
-                if (!PushDefault(ti.elemtypes[NumElems()].type, ti.elemtypes[NumElems()].defval))
-                    lex.Error("no default value exists for missing struct elements");
-            }
+        while (NumElems() < ti.len) {
+            if (!PushDefault(ti.elemtypes[NumElems()].type, ti.elemtypes[NumElems()].defval))
+                lex.Error("no default value exists for missing struct elements");
         }
         if (ti.t == V_CLASS) {
             auto len = NumElems();
             auto vec = vm.NewObject(len, typeoff);
-            if (len) vec->CopyElemsShallow(stack.size() - len + stack.data(), len);
-            PopVN(len);
-            PushV(vec, true);
-        } else if (ti.t == V_VECTOR) {
-            auto &sti = vm.GetTypeInfo(ti.subt);
-            auto width = IsStruct(sti.t) ? sti.len : 1;
-            auto len = NumElems();
-            auto n = len / width;
-            auto vec = vm.NewVec(n, n, typeoff);
-            if (len) vec->CopyElemsShallow(stack.size() - len + stack.data());
+            if (len) vec->InitSlots(vm, ti, stack.size() - len + stack.data());
             PopVN(len);
             PushV(vec, true);
         }
@@ -210,12 +483,11 @@ struct ValueParser : Deserializer {
             }
             case T_STR: {
                 ExpectType(V_STRING, vt);
-                string s = std::move(lex.sval);
-                lex.Next();
                 if (push) {
-                    auto str = vm.NewString(s);
+                    auto str = vm.NewString(lex.sval);
                     PushV(str, true);
                 }
+                lex.Next();
                 break;
             }
             case T_NIL: {
@@ -239,13 +511,13 @@ struct ValueParser : Deserializer {
             case T_LEFTBRACKET: {
                 ExpectType(V_VECTOR, vt);
                 lex.Next();
-                ParseElems(T_RIGHTBRACKET, typeoff, -1, push);
+                ParseVector(typeoff, push);
                 break;
             }
             case T_IDENT: {
                 if (vt == V_INT && ti->enumidx >= 0) {
                     auto opt = vm.LookupEnum(lex.sattr, ti->enumidx);
-                    if (!opt) lex.Error("unknown enum value " + lex.sattr);
+                    if (!opt) lex.Error(cat("unknown enum value ", lex.sattr));
                     lex.Next();
                     if (push) PushV(*opt);
                     break;
@@ -255,19 +527,22 @@ struct ValueParser : Deserializer {
                 auto sname = lex.sattr;
                 lex.Next();
                 Expect(T_LEFTCURLY);
-                auto name = vm.StructName(*ti);
-                if (name != sname) {
-                    auto p = LookupSubClass(sname, ti, typeoff);
-                    if (!p.first)
-                        lex.Error("class/struct type " + name + " required, " + sname + " given");
-                    ti = p.first;
-                    typeoff = p.second;
+                if (vt != V_ANY) {
+                    auto name = vm.StructName(*ti);
+                    if (name != sname) {
+                        auto p = LookupSubClass(sname, ti, typeoff);
+                        if (!p.first)
+                            lex.Error(cat("class/struct type ", name, " required, ", sname,
+                                          " given"));
+                        ti = p.first;
+                        typeoff = p.second;
+                    }
                 }
-                ParseElems(T_RIGHTCURLY, typeoff, ti->len, push);
+                ParseFields(typeoff, push);
                 break;
             }
             default:
-                lex.Error("illegal start of expression: " + lex.TokStr());
+                lex.Error(cat("illegal start of expression: ", lex.TokStr()));
                 PushV(NilVal());
                 break;
         }
@@ -275,13 +550,9 @@ struct ValueParser : Deserializer {
 
     void Expect(TType t) {
         if (lex.token != t)
-            lex.Error(lex.TokStr(t) + " expected, found: " + lex.TokStr());
+            lex.Error(cat(lex.TokStr(t), " expected, found: ", lex.TokStr()));
         lex.Next();
     }
-
-    void Gobble(TType t) {
-        if (lex.token == t) lex.Next();
-    }
 };
 
 static void ParseData(StackPtr &sp, VM &vm, type_elem_t typeoff, string_view inp) {
@@ -402,7 +673,7 @@ struct FlexBufferParser : Deserializer {
                 if (vt == V_CLASS) {
                     auto len = NumElems();
                     auto vec = vm.NewObject(len, typeoff);
-                    if (len) vec->CopyElemsShallow(stack.size() - len + stack.data(), len);
+                    if (len) vec->InitSlots(vm, *ti, stack.size() - len + stack.data());
                     PopVN(len);
                     PushV(vec, true);
                 }
@@ -534,7 +805,7 @@ struct LobsterBinaryParser : Deserializer {
                     }
                     auto len = NumElems();
                     auto vec = vm.NewObject(len, typeoff);
-                    if (len) vec->CopyElemsShallow(stack.size() - len + stack.data(), len);
+                    if (len) vec->InitSlots(vm, *ti, stack.size() - len + stack.data());
                     PopVN(len);
                     PushV(vec, true);
                 }
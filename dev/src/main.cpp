@@ -66,6 +66,10 @@ int main(int argc, char* argv[]) {
         bool compile_only = false;
         bool non_interactive_test = false;
         bool full_error = false;
+        bool bench = false;
+        string bench_json;
+        string bench_baseline;
+        double bench_threshold = 5;
         int runtime_checks = RUNTIME_ASSERT;
         int max_errors = 1;
         const char *default_lpak = "default.lpak";
@@ -76,6 +80,7 @@ int main(int argc, char* argv[]) {
         vector<string> imports;
         auto trace = TraceMode::OFF;
         auto jit_mode = true;
+        auto jit_tier = JITMode::EAGER;
         Query query;
         string helptext = "\nUsage:\n"
             "lobster [ OPTIONS ] [ FILE ] [ -- ARGS ]\n"
@@ -103,7 +108,13 @@ int main(int argc, char* argv[]) {
             "--trace                Log bytecode instructions (SLOW, Debug only).\n"
             "--trace-tail           Show last 50 bytecode instructions on error.\n"
             "--tcc-out              Output tcc .o file instead of running.\n"
+            "--jit-lazy             JIT compile each function on first call.\n"
+            "--jit-tiered           Interpret each function until it is hot, then JIT it.\n"
             "--wait                 Wait for input before exiting.\n"
+            "--bench                Time the run_test tests in FILE (see benchmark.lobster).\n"
+            "--bench-json FILE      Also write benchmark results to FILE as JSON.\n"
+            "--bench-baseline FILE  Compare against JSON results from an earlier run.\n"
+            "--bench-threshold PCT  Slowdown vs baseline that counts as regression (default 5).\n"
             "--query QUERY_ARGS     Queries about definitions in the program being compiled.\n"
             "--errors N             Output up to N errors (default 1).\n";
             int arg = 1;
@@ -113,6 +124,8 @@ int main(int argc, char* argv[]) {
                 if      (a == "--wait") { wait = true; }
                 else if (a == "--pak") { lpak = default_lpak; }
                 else if (a == "--cpp") { jit_mode = false; }
+                else if (a == "--jit-lazy") { jit_tier = JITMode::LAZY; }
+                else if (a == "--jit-tiered") { jit_tier = JITMode::TIERED; }
                 else if (a == "--parsedump") { parsedump = true; }
                 else if (a == "--disasm") { disasm = true; }
                 else if (a == "--verbose") { min_output_level = OUTPUT_INFO; }
@@ -142,6 +155,18 @@ int main(int argc, char* argv[]) {
                     if (arg >= argc) THROW_OR_ABORT("missing main file");
                     if (!mainfile.empty()) THROW_OR_ABORT("--main specified twice");
                     mainfile = SanitizePath(argv[arg]);
+                } else if (a == "--bench") {
+                    bench = true;
+                } else if (a == "--bench-json" || a == "--bench-baseline") {
+                    arg++;
+                    if (arg >= argc) THROW_OR_ABORT("missing file name for " + a);
+                    bench = true;
+                    (a == "--bench-json" ? bench_json : bench_baseline) = argv[arg];
+                } else if (a == "--bench-threshold") {
+                    arg++;
+                    if (arg >= argc) THROW_OR_ABORT("missing benchmark threshold");
+                    bench = true;
+                    bench_threshold = strtod(argv[arg], nullptr);
                 } else if (a == "--") {
                     arg++;
                     break;
@@ -214,10 +239,30 @@ int main(int argc, char* argv[]) {
             auto start_time = SecondsSinceStart();
             dump.clear();
             pakfile.clear();
+            // In bench mode, FILE is imported by a generated main program instead, so the
+            // benchmark module can collect its tests and then time them.
+            string bench_source;
+            if (bench) {
+                string_view ext = ".lobster";
+                if (fn.size() <= ext.size() || fn.substr(fn.size() - ext.size()) != ext)
+                    THROW_OR_ABORT("--bench requires a .lobster file");
+                auto quoted = [](const string &s) {
+                    string q;
+                    EscapeAndQuote(s, q);
+                    return q;
+                };
+                // Imported by file name, since it may not be a valid module name (e.g. have a
+                // "-" in it, or be outside of the import path).
+                bench_source = cat("import benchmark\ncollect_benchmarks()\nimport ", quoted(fn),
+                                   "\nbenchmark_main(", quoted(bench_json), ", ",
+                                   quoted(bench_baseline), ", ", to_string(bench_threshold),
+                                   ")\n");
+            }
             for (;;) {
                 bytecode_buffer.clear();
-                Compile(nfr, fn, {}, bytecode_buffer, parsedump ? &dump : nullptr,
-                        lpak ? &pakfile : nullptr, false, runtime_checks,
+                Compile(nfr, bench_source.empty() ? fn : "(bench)", bench_source, bytecode_buffer,
+                        parsedump ? &dump : nullptr, lpak ? &pakfile : nullptr, false,
+                        runtime_checks,
                         !query.kind.empty() ? &query : nullptr, max_errors, full_error);
                 if (mainfile.empty()) break;
                 if (!FileExists(mainfile, true)) {
@@ -256,7 +301,8 @@ int main(int argc, char* argv[]) {
                               compile_only,
                               error,
                               runtime_checks,
-                              !non_interactive_test);
+                              !non_interactive_test,
+                              jit_tier);
             if (!error.empty())
                 THROW_OR_ABORT(error);
             return (int)ret.second;
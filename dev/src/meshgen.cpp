@@ -646,6 +646,7 @@ Value AddShape(ImplicitFunction *f) {
 }
 
 Value eval_and_polygonize(VM &vm, int targetgridsize, int zoffset, bool do_poly) {
+    LOBSTER_TIMED_SCOPE("meshgen");
     auto scenesize = root->Size() * 2;
     float biggestdim = max(scenesize.x, max(scenesize.y, scenesize.z));
     auto gridscale = targetgridsize / biggestdim;
@@ -18,6 +18,8 @@
 
 #include "lobster/glinterface.h"
 
+#include "ThreadPool/ThreadPool.h"
+
 #undef new
 
 #include "Box2D/Box2D.h"
@@ -28,14 +30,23 @@
 
 using namespace lobster;
 
+// The shader is only looked up when first rendered, so physics can run without graphics (e.g.
+// on a server).
 struct Renderable : Textured {
     float4 color = float4_1;
-    Shader *sh;
+    const char *shname;
+    Shader *sh = nullptr;
+
+    Renderable(const char *shname) : shname(shname) {}
 
-    Renderable(const char *shname) : sh(LookupShader(shname)) { assert(sh); }
+    Shader *GetShader() {
+        if (!sh) sh = LookupShader(shname);
+        assert(sh);
+        return sh;
+    }
 
     void Set() {
-        sh->Set();
+        GetShader()->Set();
         sh->SetTextures(textures);
     }
 };
@@ -44,6 +55,32 @@ b2World *world = nullptr;
 b2ParticleSystem *particlesystem = nullptr;
 Renderable *particlematerial = nullptr;
 
+// Runs the parts of the particle step that can be split up on a thread pool, with the calling
+// thread doing the first task.
+struct ParticleTaskExecutor : b2ParticleTaskExecutor {
+    int threads = 0;  // 0 = all hardware threads.
+    unique_ptr<ThreadPool> pool;
+
+    int32 GetThreadCount() const override {
+        return threads > 0 ? threads : NumHWThreads();
+    }
+
+    void Run(int32 taskcount, const std::function<void(int32)> &task) override {
+        if (!pool) pool.reset(new ThreadPool((size_t)std::max(1, NumHWThreads() - 1)));
+        vector<future<void>> results;
+        for (int32 i = 1; i < taskcount; i++)
+            results.push_back(pool->enqueue([&task, i]() { task(i); }));
+        task(0);
+        for (auto &r : results) r.wait();
+    }
+};
+
+ParticleTaskExecutor particleexecutor;
+
+// Changes whenever bodies, fixtures or particle groups are added or removed, since snapshots
+// can only be restored into a world with exactly the same ones.
+uint64_t physics_generation = 0;
+
 b2Vec2 Float2ToB2(const float2 &v) { return b2Vec2(v.x, v.y); }
 float2 B2ToFloat2(const b2Vec2 &v) { return float2(v.x, v.y); }
 
@@ -58,8 +95,12 @@ struct PhysicsObject : Resource {
     vector<int> *particle_contacts;
 
     PhysicsObject(const Renderable &_r, b2Fixture *_f)
-        : r(_r), fixture(_f), particle_contacts(nullptr) {}
+        : r(_r), fixture(_f), particle_contacts(nullptr) {
+        physics_generation++;
+    }
     ~PhysicsObject() {
+        physics_generation++;
+        if (!fixture) return;  // World was already deleted.
         auto body = fixture->GetBody();
         body->DestroyFixture(fixture);
         if (!body->GetFixtureList()) world->DestroyBody(body);
@@ -83,7 +124,13 @@ PhysicsObject &GetObject(const Value &res) {
 }
 
 void CleanPhysics() {
-    if (world) delete world;
+    if (world) {
+        // Objects may outlive the world they were created in.
+        for (auto b = world->GetBodyList(); b; b = b->GetNext())
+            for (auto f = b->GetFixtureList(); f; f = f->GetNext())
+                ((PhysicsObject *)f->GetUserData())->fixture = nullptr;
+        delete world;
+    }
     world = nullptr;
     particlesystem = nullptr;
     delete particlematerial;
@@ -91,9 +138,9 @@ void CleanPhysics() {
 }
 
 void InitPhysics(const float2 &gv) {
-    // FIXME: check that shaders are initialized, since renderables depend on that
     CleanPhysics();
     world = new b2World(b2Vec2(gv.x, gv.y));
+    physics_generation++;
 }
 
 void CheckPhysics() {
@@ -106,6 +153,8 @@ void CheckParticles(float size = 0.1f) {
         b2ParticleSystemDef psd;
         psd.radius = size;
         particlesystem = world->CreateParticleSystem(&psd);
+        particlesystem->SetTaskExecutor(&particleexecutor);
+        physics_generation++;
         particlematerial = new Renderable("color_attr");
     }
 }
@@ -140,6 +189,457 @@ Renderable &GetRenderable(VM &, const Value &id) {
 
 extern int GetSampler(VM &vm, Value &i);  // from graphics
 
+// Saves all state that changes while stepping the world (bodies, broadphase, contacts including
+// their warm starting impulses, particles) into a flat binary blob, and restores it in place.
+// Contacts are recreated in their original order, and the broadphase tree is copied wholesale,
+// such that stepping after a restore gives exactly the same results as it did the first time.
+// Pointers are stored as-is, so a snapshot can only be restored into the world it came from,
+// and only as long as no bodies, fixtures or particle groups were added or removed since (it
+// checks this).
+class b2WorldSnapshot {
+    static constexpr uint32_t magic = 0x5348504C;  // "LPHS"
+
+    string &buf;
+    size_t pos = 0;
+    const char *p = nullptr, *end = nullptr;
+
+    // Writes directly into buf, which keeps its size between snapshots, since appending to it
+    // piecemeal is a lot slower.
+    void PutBytes(const void *v, size_t n) {
+        if (pos + n > buf.size()) buf.resize(std::max(buf.size() * 2, pos + n));
+        memcpy(&buf[pos], v, n);
+        pos += n;
+    }
+    template<typename T> void Put(const T &v) { PutBytes(&v, sizeof(T)); }
+    template<typename T> void PutArray(const T *v, int32 n) {
+        Put(n);
+        PutBytes(v, n * sizeof(T));
+    }
+    // Only for optional particle buffers, which are allocated on demand.
+    template<typename T> void PutOptional(const T *v, int32 n) {
+        Put(v != nullptr);
+        if (v) PutBytes(v, n * sizeof(T));
+    }
+
+    template<typename T> T Get() {
+        T v;
+        if (p + sizeof(T) > end) { p = end + 1; return T(); }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+    template<typename T> void Get(T &v) { v = Get<T>(); }
+    // Whether n items of the given size are left to read. If not (or n is negative), p is moved
+    // past end, such that Matches fails.
+    bool Fits(int32 n, size_t size) {
+        if (p > end || n < 0 || (size_t)n > (size_t)(end - p) / size) {
+            p = end + 1;
+            return false;
+        }
+        return true;
+    }
+    void Skip(int32 n, size_t size) {
+        if (Fits(n, size)) p += n * size;
+    }
+    template<typename T> void Skip(const T &) { Skip(1, sizeof(T)); }
+    // These take the buffer being skipped over just for its type.
+    template<typename T> void SkipOptional(const T *, int32 n) {
+        if (Get<bool>()) Skip(n, sizeof(T));
+    }
+    template<typename T> void SkipBuffer(const b2GrowableBuffer<T> &) {
+        Skip(Get<int32>(), sizeof(T));
+    }
+    // These cast to void * since some particle buffers hold types with (trivial) constructors.
+    template<typename T> void GetArray(T *v, int32 n) {
+        if (!Fits(n, sizeof(T))) return;
+        memcpy((void *)v, p, n * sizeof(T));
+        p += n * sizeof(T);
+    }
+    template<typename T> void GetOptional(T *v, int32 n) {
+        if (!Get<bool>() || !Fits(n, sizeof(T))) return;
+        if (v) memcpy((void *)v, p, n * sizeof(T));
+        p += n * sizeof(T);
+    }
+    template<typename T> void GetBuffer(b2GrowableBuffer<T> &b) {
+        auto n = Get<int32>();
+        if (!Fits(n, sizeof(T))) return;
+        b.SetCount(0);
+        b.Reserve(n);
+        GetArray(b.Data(), n);
+        b.SetCount(n);
+    }
+
+    // Sizes of what Save() writes for each body (between its pointer and its fixtures), contact
+    // and particle group (after its pointer), so Matches can skip over them.
+    static constexpr size_t bodysize = sizeof(b2BodyType) + sizeof(uint16) +
+                                       2 * sizeof(b2Transform) + sizeof(b2Sweep) +
+                                       2 * sizeof(b2Vec2) + 7 * sizeof(float32);
+    static constexpr size_t contactsize = 2 * sizeof(b2Fixture *) + 3 * sizeof(int32) +
+                                          sizeof(uint32) + sizeof(b2Manifold) +
+                                          4 * sizeof(float32);
+    static constexpr size_t groupsize = 3 * sizeof(int32) + sizeof(uint32) + 4 * sizeof(float32) +
+                                        2 * sizeof(b2Vec2) + sizeof(b2Transform);
+    // Fixtures of the world, sorted, to check the ones contacts refer to.
+    vector<b2Fixture *> fixtures;
+
+    public:
+    b2WorldSnapshot(string &buf) : buf(buf) {}
+
+    // Returns the size of the snapshot, which is at the start of buf.
+    size_t Save() {
+        pos = 0;
+        Put(magic);
+        Put(physics_generation);
+        Put(world);
+        Put(world->m_flags);
+        Put(world->m_inv_dt0);
+        Put(world->m_stepComplete);
+        Put(world->m_bodyCount);
+        for (auto b = world->m_bodyList; b; b = b->m_next) {
+            Put(b);
+            Put(b->m_type);
+            Put(b->m_flags);
+            Put(b->m_xf);
+            Put(b->m_xf0);
+            Put(b->m_sweep);
+            Put(b->m_linearVelocity);
+            Put(b->m_angularVelocity);
+            Put(b->m_force);
+            Put(b->m_torque);
+            Put(b->m_mass);
+            Put(b->m_invMass);
+            Put(b->m_I);
+            Put(b->m_invI);
+            Put(b->m_sleepTime);
+            Put(b->m_fixtureCount);
+            for (auto f = b->m_fixtureList; f; f = f->m_next) {
+                Put(f);
+                Put(f->m_proxyCount);
+                for (int32 i = 0; i < f->m_proxyCount; i++) Put(f->m_proxies[i].aabb);
+            }
+        }
+        auto &bp = world->m_contactManager.m_broadPhase;
+        auto &tree = bp.m_tree;
+        Put(bp.m_proxyCount);
+        PutArray(bp.m_moveBuffer, bp.m_moveCount);
+        Put(tree.m_root);
+        Put(tree.m_nodeCount);
+        Put(tree.m_freeList);
+        Put(tree.m_path);
+        Put(tree.m_insertionCount);
+        PutArray(tree.m_nodes, tree.m_nodeCapacity);
+        Put(world->m_contactManager.m_contactCount);
+        for (auto c = world->m_contactManager.m_contactList; c; c = c->m_next) {
+            Put(c->m_fixtureA);
+            Put(c->m_indexA);
+            Put(c->m_fixtureB);
+            Put(c->m_indexB);
+            Put(c->m_flags);
+            Put(c->m_manifold);
+            Put(c->m_toiCount);
+            Put(c->m_toi);
+            Put(c->m_friction);
+            Put(c->m_restitution);
+            Put(c->m_tangentSpeed);
+        }
+        auto ps = particlesystem;
+        Put(ps);
+        if (ps) {
+            Put(ps->m_groupCount);
+            for (auto g = ps->m_groupList; g; g = g->m_next) {
+                Put(g);
+                Put(g->m_firstIndex);
+                Put(g->m_lastIndex);
+                Put(g->m_groupFlags);
+                Put(g->m_strength);
+                Put(g->m_timestamp);
+                Put(g->m_mass);
+                Put(g->m_inertia);
+                Put(g->m_center);
+                Put(g->m_linearVelocity);
+                Put(g->m_angularVelocity);
+                Put(g->m_transform);
+            }
+            auto n = ps->m_count;
+            Put(n);
+            Put(ps->m_timestamp);
+            Put(ps->m_allParticleFlags);
+            Put(ps->m_needsUpdateAllParticleFlags);
+            Put(ps->m_allGroupFlags);
+            Put(ps->m_needsUpdateAllGroupFlags);
+            Put(ps->m_hasForce);
+            Put(ps->m_timeElapsed);
+            Put(ps->m_expirationTimeBufferRequiresSorting);
+            PutBytes(ps->m_flagsBuffer.data, n * sizeof(uint32));
+            PutBytes(ps->m_positionBuffer.data, n * sizeof(b2Vec2));
+            PutBytes(ps->m_velocityBuffer.data, n * sizeof(b2Vec2));
+            PutBytes(ps->m_groupBuffer, n * sizeof(b2ParticleGroup *));
+            PutOptional(ps->m_forceBuffer, n);
+            PutOptional(ps->m_staticPressureBuffer, n);
+            PutOptional(ps->m_depthBuffer, n);
+            PutOptional(ps->m_colorBuffer.data, n);
+            PutOptional(ps->m_userDataBuffer.data, n);
+            PutOptional(ps->m_expirationTimeBuffer.data, n);
+            PutOptional(ps->m_indexByExpirationTimeBuffer.data, n);
+            PutArray(ps->m_proxyBuffer.Data(), ps->m_proxyBuffer.GetCount());
+            PutArray(ps->m_pairBuffer.Data(), ps->m_pairBuffer.GetCount());
+            PutArray(ps->m_triadBuffer.Data(), ps->m_triadBuffer.GetCount());
+        }
+        return pos;
+    }
+
+    // Checks that all objects are the same as when the snapshot was taken, and that all counts
+    // and the contacts' fixtures are valid and fit in the blob, before anything is modified.
+    bool Matches() {
+        if (Get<uint32_t>() != magic || Get<uint64_t>() != physics_generation ||
+            Get<b2World *>() != world)
+            return false;
+        Skip(world->m_flags);
+        Skip(world->m_inv_dt0);
+        Skip(world->m_stepComplete);
+        if (Get<int32>() != world->m_bodyCount || world->m_jointCount) return false;
+        fixtures.clear();
+        for (auto b = world->m_bodyList; b; b = b->m_next) {
+            if (Get<b2Body *>() != b) return false;
+            Skip(1, bodysize);
+            if (Get<int32>() != b->m_fixtureCount) return false;
+            for (auto f = b->m_fixtureList; f; f = f->m_next) {
+                if (Get<b2Fixture *>() != f || Get<int32>() != f->m_proxyCount) return false;
+                Skip(f->m_proxyCount, sizeof(b2AABB));
+                fixtures.push_back(f);
+            }
+        }
+        std::sort(fixtures.begin(), fixtures.end());
+        auto &bp = world->m_contactManager.m_broadPhase;
+        auto &tree = bp.m_tree;
+        Skip(bp.m_proxyCount);
+        Skip(Get<int32>(), sizeof(int32));
+        Skip(tree.m_root);
+        Skip(tree.m_nodeCount);
+        Skip(tree.m_freeList);
+        Skip(tree.m_path);
+        Skip(tree.m_insertionCount);
+        if (Get<int32>() != tree.m_nodeCapacity) return false;
+        Skip(tree.m_nodeCapacity, sizeof(b2TreeNode));
+        auto ncontacts = Get<int32>();
+        if (!Fits(ncontacts, contactsize)) return false;
+        for (int32 i = 0; i < ncontacts; i++) {
+            auto valid = [&]() {
+                auto f = Get<b2Fixture *>();
+                auto index = Get<int32>();
+                return std::binary_search(fixtures.begin(), fixtures.end(), f) && index >= 0 &&
+                       index < f->m_proxyCount;
+            };
+            if (!valid() || !valid()) return false;
+            Skip(1, contactsize - 2 * (sizeof(b2Fixture *) + sizeof(int32)));
+        }
+        auto ps = particlesystem;
+        if (Get<b2ParticleSystem *>() != ps) return false;
+        if (ps) {
+            if (Get<int32>() != ps->m_groupCount) return false;
+            for (auto g = ps->m_groupList; g; g = g->m_next) {
+                if (Get<b2ParticleGroup *>() != g) return false;
+                Skip(1, groupsize);
+            }
+            auto n = Get<int32>();
+            if (n < 0 || n > ps->m_internalAllocatedCapacity) return false;
+            Skip(ps->m_timestamp);
+            Skip(ps->m_allParticleFlags);
+            Skip(ps->m_needsUpdateAllParticleFlags);
+            Skip(ps->m_allGroupFlags);
+            Skip(ps->m_needsUpdateAllGroupFlags);
+            Skip(ps->m_hasForce);
+            Skip(ps->m_timeElapsed);
+            Skip(ps->m_expirationTimeBufferRequiresSorting);
+            Skip(n, sizeof(uint32));
+            Skip(n, sizeof(b2Vec2));
+            Skip(n, sizeof(b2Vec2));
+            Skip(n, sizeof(b2ParticleGroup *));
+            SkipOptional(ps->m_forceBuffer, n);
+            SkipOptional(ps->m_staticPressureBuffer, n);
+            SkipOptional(ps->m_depthBuffer, n);
+            SkipOptional(ps->m_colorBuffer.data, n);
+            SkipOptional(ps->m_userDataBuffer.data, n);
+            SkipOptional(ps->m_expirationTimeBuffer.data, n);
+            SkipOptional(ps->m_indexByExpirationTimeBuffer.data, n);
+            SkipBuffer(ps->m_proxyBuffer);
+            SkipBuffer(ps->m_pairBuffer);
+            SkipBuffer(ps->m_triadBuffer);
+        }
+        return p <= end;
+    }
+
+    bool Restore(string_view blob) {
+        p = blob.data();
+        end = p + blob.size();
+        if (!Matches()) return false;
+        // Destroying a touching contact wakes up its bodies, so this must happen before their
+        // awake flags and sleep times are restored.
+        auto &cm = world->m_contactManager;
+        while (cm.m_contactList) cm.Destroy(cm.m_contactList);
+        p = blob.data() + sizeof(magic) + sizeof(uint64_t) + sizeof(b2World *);
+        Get(world->m_flags);
+        Get(world->m_inv_dt0);
+        Get(world->m_stepComplete);
+        Get<int32>();
+        for (auto b = world->m_bodyList; b; b = b->m_next) {
+            Get<b2Body *>();
+            Get(b->m_type);
+            Get(b->m_flags);
+            Get(b->m_xf);
+            Get(b->m_xf0);
+            Get(b->m_sweep);
+            Get(b->m_linearVelocity);
+            Get(b->m_angularVelocity);
+            Get(b->m_force);
+            Get(b->m_torque);
+            Get(b->m_mass);
+            Get(b->m_invMass);
+            Get(b->m_I);
+            Get(b->m_invI);
+            Get(b->m_sleepTime);
+            Get<int32>();
+            for (auto f = b->m_fixtureList; f; f = f->m_next) {
+                Get<b2Fixture *>();
+                Get<int32>();
+                for (int32 i = 0; i < f->m_proxyCount; i++) Get(f->m_proxies[i].aabb);
+            }
+        }
+        auto &bp = world->m_contactManager.m_broadPhase;
+        auto &tree = bp.m_tree;
+        Get(bp.m_proxyCount);
+        auto movecount = Get<int32>();
+        if (movecount > bp.m_moveCapacity) {
+            b2Free(bp.m_moveBuffer);
+            bp.m_moveCapacity = movecount;
+            bp.m_moveBuffer = (int32 *)b2Alloc(movecount * sizeof(int32));
+        }
+        GetArray(bp.m_moveBuffer, movecount);
+        bp.m_moveCount = movecount;
+        Get(tree.m_root);
+        Get(tree.m_nodeCount);
+        Get(tree.m_freeList);
+        Get(tree.m_path);
+        Get(tree.m_insertionCount);
+        Get<int32>();
+        GetArray(tree.m_nodes, tree.m_nodeCapacity);
+        RestoreContacts();
+        auto ps = particlesystem;
+        Get<b2ParticleSystem *>();
+        if (ps) {
+            Get<int32>();
+            for (auto g = ps->m_groupList; g; g = g->m_next) {
+                Get<b2ParticleGroup *>();
+                Get(g->m_firstIndex);
+                Get(g->m_lastIndex);
+                Get(g->m_groupFlags);
+                Get(g->m_strength);
+                Get(g->m_timestamp);
+                Get(g->m_mass);
+                Get(g->m_inertia);
+                Get(g->m_center);
+                Get(g->m_linearVelocity);
+                Get(g->m_angularVelocity);
+                Get(g->m_transform);
+            }
+            auto n = Get<int32>();
+            ps->m_count = n;
+            Get(ps->m_timestamp);
+            Get(ps->m_allParticleFlags);
+            Get(ps->m_needsUpdateAllParticleFlags);
+            Get(ps->m_allGroupFlags);
+            Get(ps->m_needsUpdateAllGroupFlags);
+            Get(ps->m_hasForce);
+            Get(ps->m_timeElapsed);
+            Get(ps->m_expirationTimeBufferRequiresSorting);
+            GetArray(ps->m_flagsBuffer.data, n);
+            GetArray(ps->m_positionBuffer.data, n);
+            GetArray(ps->m_velocityBuffer.data, n);
+            GetArray(ps->m_groupBuffer, n);
+            GetOptional(ps->m_forceBuffer, n);
+            GetOptional(ps->m_staticPressureBuffer, n);
+            GetOptional(ps->m_depthBuffer, n);
+            GetOptional(ps->m_colorBuffer.data, n);
+            GetOptional(ps->m_userDataBuffer.data, n);
+            GetOptional(ps->m_expirationTimeBuffer.data, n);
+            GetOptional(ps->m_indexByExpirationTimeBuffer.data, n);
+            GetBuffer(ps->m_proxyBuffer);
+            GetBuffer(ps->m_pairBuffer);
+            GetBuffer(ps->m_triadBuffer);
+            // Derived from the particle contacts, which are found again before they are used.
+            ps->m_contactBuffer.SetCount(0);
+            ps->m_bodyContactBuffer.SetCount(0);
+        }
+        return true;
+    }
+
+    // Contacts are recreated oldest first: both the world's and each body's list of contacts have
+    // the newest first, so this reproduces their order exactly, which the solver depends on.
+    void RestoreContacts() {
+        auto &cm = world->m_contactManager;
+        auto n = Get<int32>();
+        auto start = p;
+        for (auto i = n - 1; i >= 0; i--) {
+            p = start + i * contactsize;
+            auto fa = Get<b2Fixture *>();
+            auto ia = Get<int32>();
+            auto fb = Get<b2Fixture *>();
+            auto ib = Get<int32>();
+            auto c = b2Contact::Create(fa, ia, fb, ib, cm.m_allocator);
+            assert(c && c->m_fixtureA == fa);
+            Get(c->m_flags);
+            Get(c->m_manifold);
+            Get(c->m_toiCount);
+            Get(c->m_toi);
+            Get(c->m_friction);
+            Get(c->m_restitution);
+            Get(c->m_tangentSpeed);
+            auto ba = fa->m_body, bb = fb->m_body;
+            c->m_prev = nullptr;
+            c->m_next = cm.m_contactList;
+            if (cm.m_contactList) cm.m_contactList->m_prev = c;
+            cm.m_contactList = c;
+            c->m_nodeA = { bb, c, nullptr, ba->m_contactList };
+            if (ba->m_contactList) ba->m_contactList->prev = &c->m_nodeA;
+            ba->m_contactList = &c->m_nodeA;
+            c->m_nodeB = { ba, c, nullptr, bb->m_contactList };
+            if (bb->m_contactList) bb->m_contactList->prev = &c->m_nodeB;
+            bb->m_contactList = &c->m_nodeB;
+            cm.m_contactCount++;
+        }
+        p = start + n * contactsize;
+    }
+};
+
+string snapshot_buf;
+
+// For the batched builtins below, which read or write state for a vector of fixtures (or all
+// particles) at once, to/from a vector the caller allocated.
+
+b2Body *GetBatchBody(const LVector *ids, iint i) {
+    return GetObject(ids->At(i)).fixture->GetBody();
+}
+
+void CheckBatch(VM &vm, const LVector *ids, const LVector *vals, const char *name) {
+    CheckPhysics();
+    if (ids->len != vals->len)
+        vm.BuiltinError(cat(name, ": vectors must be of the same length"));
+}
+
+float2 GetBatchFloat2(const LVector *vals, iint i) {
+    return ValueToFLT<2>(vals->AtSt(i), vals->width);
+}
+
+void SetBatchFloat2(LVector *vals, iint i, const b2Vec2 &v) {
+    auto e = vals->AtSt(i);
+    e[0] = Value(v.x);
+    e[1] = Value(v.y);
+}
+
+iint ParticleBatchSize(const LVector *vals) {
+    return particlesystem ? std::min(vals->len, (iint)particlesystem->GetParticleCount()) : 0;
+}
+
 void AddPhysics(NativeRegistry &nfr) {
 
 nfr("ph_initialize", "gravityvector", "F}:2", "",
@@ -267,6 +767,73 @@ nfr("ph_get_position", "id", "R:fixture", "F}:2",
         PushVec(sp, GetObject(id).Pos());
     });
 
+nfr("ph_get_positions", "ids,positions", "R:fixture]F}:2]", "",
+    "gets the positions of many shapes at once, into positions, which must be of the same"
+    " length as ids.",
+    [](StackPtr &, VM &vm, Value &ids, Value &positions) {
+        auto iv = ids.vval(), pv = positions.vval();
+        CheckBatch(vm, iv, pv, "ph_get_positions");
+        for (iint i = 0; i < iv->len; i++)
+            SetBatchFloat2(pv, i, GetBatchBody(iv, i)->GetPosition());
+        return NilVal();
+    });
+
+nfr("ph_get_linear_velocities", "ids,velocities", "R:fixture]F}:2]", "",
+    "gets the linear velocities of many shapes at once, into velocities, which must be of the"
+    " same length as ids.",
+    [](StackPtr &, VM &vm, Value &ids, Value &velocities) {
+        auto iv = ids.vval(), vv = velocities.vval();
+        CheckBatch(vm, iv, vv, "ph_get_linear_velocities");
+        for (iint i = 0; i < iv->len; i++)
+            SetBatchFloat2(vv, i, GetBatchBody(iv, i)->GetLinearVelocity());
+        return NilVal();
+    });
+
+nfr("ph_get_angles", "ids,angles", "R:fixture]F]", "",
+    "gets the rotation (in degrees) of many shapes at once, into angles, which must be of the"
+    " same length as ids.",
+    [](StackPtr &, VM &vm, Value &ids, Value &angles) {
+        auto iv = ids.vval(), av = angles.vval();
+        CheckBatch(vm, iv, av, "ph_get_angles");
+        for (iint i = 0; i < iv->len; i++)
+            av->At(i) = Value(GetBatchBody(iv, i)->GetAngle() / RAD);
+        return NilVal();
+    });
+
+nfr("ph_set_positions", "ids,positions", "R:fixture]F}:2]", "",
+    "moves many shapes at once (keeping their rotation).",
+    [](StackPtr &, VM &vm, Value &ids, Value &positions) {
+        auto iv = ids.vval(), pv = positions.vval();
+        CheckBatch(vm, iv, pv, "ph_set_positions");
+        for (iint i = 0; i < iv->len; i++) {
+            auto body = GetBatchBody(iv, i);
+            body->SetTransform(Float2ToB2(GetBatchFloat2(pv, i)), body->GetAngle());
+        }
+        return NilVal();
+    });
+
+nfr("ph_set_linear_velocities", "ids,velocities", "R:fixture]F}:2]", "",
+    "sets the linear velocities of many shapes at once.",
+    [](StackPtr &, VM &vm, Value &ids, Value &velocities) {
+        auto iv = ids.vval(), vv = velocities.vval();
+        CheckBatch(vm, iv, vv, "ph_set_linear_velocities");
+        for (iint i = 0; i < iv->len; i++)
+            GetBatchBody(iv, i)->SetLinearVelocity(Float2ToB2(GetBatchFloat2(vv, i)));
+        return NilVal();
+    });
+
+nfr("ph_set_angles", "ids,angles", "R:fixture]F]", "",
+    "sets the rotation (in degrees) of many shapes at once (keeping their position).",
+    [](StackPtr &, VM &vm, Value &ids, Value &angles) {
+        auto iv = ids.vval(), av = angles.vval();
+        CheckBatch(vm, iv, av, "ph_set_angles");
+        for (iint i = 0; i < iv->len; i++) {
+            auto body = GetBatchBody(iv, i);
+            body->SetTransform(body->GetPosition(), av->At(i).fltval() * RAD);
+        }
+        return NilVal();
+    });
+
 nfr("ph_get_mass", "id", "R:fixture", "F",
     "gets a shape's mass.",
     [](StackPtr &sp, VM &) {
@@ -274,6 +841,12 @@ nfr("ph_get_mass", "id", "R:fixture", "F",
         Push(sp, GetObject(id).fixture->GetBody()->GetMass());
     });
 
+nfr("ph_is_awake", "id", "R:fixture", "B",
+    "whether a shape's body is awake, i.e. not resting and skipped by the simulation.",
+    [](StackPtr &, VM &, Value &id) {
+        return Value(GetObject(id).fixture->GetBody()->IsAwake());
+    });
+
 nfr("ph_create_particle", "position,velocity,color,flags", "F}:2F}:2F}:4I?", "I",
     "creates an individual particle. For flags, see include/physics.lobster",
     [](StackPtr &sp, VM &) {
@@ -300,6 +873,7 @@ nfr("ph_create_particle_circle", "position,radius,color,flags", "F}:2FF}:4I?", "
         shape.m_radius = Pop(sp).fltval();
         pgd.position = PopB2(sp);
         particlesystem->CreateParticleGroup(pgd);
+        physics_generation++;
     });
 
 nfr("ph_initialize_particles", "radius", "F", "",
@@ -309,11 +883,20 @@ nfr("ph_initialize_particles", "radius", "F", "",
         return NilVal();
     });
 
+nfr("ph_set_particle_threads", "n", "I", "",
+    "sets how many threads stepping large particle systems may use, 0 for all hardware threads"
+    " (the default), 1 to not use any additional threads. results are the same regardless.",
+    [](StackPtr &, VM &, Value &n) {
+        particleexecutor.threads = std::max(0, n.intval());
+        return NilVal();
+    });
+
 nfr("ph_step", "seconds,viter,piter", "FII", "",
     "simulates the physical world for the given period (try: gl_delta_time()). You can specify"
     " the amount of velocity/position iterations per step, more means more accurate but also"
     " more expensive computationally (try 8 and 3).",
     [](StackPtr &, VM &, Value &delta, Value &viter, Value &piter) {
+        LOBSTER_TIMED_SCOPE("physics_step");
         CheckPhysics();
         world->Step(min(delta.fltval(), 0.1f), viter.intval(), piter.intval());
         if (particlesystem) {
@@ -391,6 +974,81 @@ nfr("ph_getparticle_position", "i", "I", "F}:2",
         PushVec(sp, pos);
     });
 
+nfr("ph_particle_count", "", "", "I",
+    "returns the amount of particles (indices are 0 to this amount).",
+    [](StackPtr &, VM &) {
+        CheckPhysics();
+        return Value(particlesystem ? particlesystem->GetParticleCount() : 0);
+    });
+
+nfr("ph_get_particle_positions", "positions", "F}:2]", "I",
+    "gets the positions of particles 0 onwards into positions, as many as fit. returns how many"
+    " were written.",
+    [](StackPtr &, VM &, Value &positions) {
+        CheckPhysics();
+        auto pv = positions.vval();
+        auto n = ParticleBatchSize(pv);
+        for (iint i = 0; i < n; i++)
+            SetBatchFloat2(pv, i, particlesystem->GetPositionBuffer()[i]);
+        return Value(n);
+    });
+
+nfr("ph_get_particle_velocities", "velocities", "F}:2]", "I",
+    "gets the velocities of particles 0 onwards into velocities, as many as fit. returns how"
+    " many were written.",
+    [](StackPtr &, VM &, Value &velocities) {
+        CheckPhysics();
+        auto vv = velocities.vval();
+        auto n = ParticleBatchSize(vv);
+        for (iint i = 0; i < n; i++)
+            SetBatchFloat2(vv, i, particlesystem->GetVelocityBuffer()[i]);
+        return Value(n);
+    });
+
+nfr("ph_set_particle_positions", "positions", "F}:2]", "I",
+    "moves particles 0 onwards to positions, for as many as it contains. returns how many were"
+    " moved.",
+    [](StackPtr &, VM &, Value &positions) {
+        CheckPhysics();
+        auto pv = positions.vval();
+        auto n = ParticleBatchSize(pv);
+        for (iint i = 0; i < n; i++)
+            particlesystem->GetPositionBuffer()[i] = Float2ToB2(GetBatchFloat2(pv, i));
+        return Value(n);
+    });
+
+nfr("ph_set_particle_velocities", "velocities", "F}:2]", "I",
+    "sets the velocities of particles 0 onwards from velocities, for as many as it contains."
+    " returns how many were set.",
+    [](StackPtr &, VM &, Value &velocities) {
+        CheckPhysics();
+        auto vv = velocities.vval();
+        auto n = ParticleBatchSize(vv);
+        for (iint i = 0; i < n; i++)
+            particlesystem->GetVelocityBuffer()[i] = Float2ToB2(GetBatchFloat2(vv, i));
+        return Value(n);
+    });
+
+nfr("ph_snapshot", "", "", "S",
+    "saves the complete state of the physics world (bodies, contacts and particles) into a"
+    " binary string, such that ph_restore can later return to it exactly, e.g. for rollback."
+    " only valid for this world, and only while no shapes or particle groups get created or"
+    " deleted.",
+    [](StackPtr &, VM &vm) {
+        CheckPhysics();
+        auto len = b2WorldSnapshot(snapshot_buf).Save();
+        return Value(vm.NewString(string_view(snapshot_buf.data(), len)));
+    });
+
+nfr("ph_restore", "snapshot", "S", "B",
+    "restores the physics world to the state saved by ph_snapshot. returns false (and leaves"
+    " the world unchanged) if the snapshot is not for this world, or if shapes or particle"
+    " groups were created or deleted since.",
+    [](StackPtr &, VM &, Value &snapshot) {
+        CheckPhysics();
+        return Value(b2WorldSnapshot(snapshot_buf).Restore(snapshot.sval()->strv()));
+    });
+
 nfr("ph_render", "", "", "",
     "renders all rigid body objects.",
     [](StackPtr &, VM &) {
@@ -416,10 +1074,11 @@ nfr("ph_render", "", "", "",
                         break;
                     }
                     case b2Shape::e_circle: {
-                        r.sh->SetTextures(r.textures);  // FIXME
+                        auto sh = r.GetShader();
+                        sh->SetTextures(r.textures);  // FIXME
                         auto polyshape = (b2CircleShape *)fixture->GetShape();
                         Transform(translation(float3(B2ToFloat2(polyshape->m_p), 0)), [&]() {
-                            geomcache->RenderCircle(r.sh, PRIM_FAN, 20, polyshape->m_radius);
+                            geomcache->RenderCircle(sh, PRIM_FAN, 20, polyshape->m_radius);
                         });
                         break;
                     }
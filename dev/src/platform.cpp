@@ -29,6 +29,7 @@
     #include <intrin.h>
     #include <sapi.h>
     #include <comdef.h>
+    #include <sys/stat.h>
 #else
     #include <sys/time.h>
 	#ifndef PLATFORM_ES3
@@ -109,6 +110,125 @@ double SecondsSinceStart() {
     return double(end.QuadPart - time_start.QuadPart) / double(time_frequency.QuadPart);
 }
 
+struct TimerData {
+    string name;
+    double frame_total = 0;
+    vector<float> history;  // Ring buffer of per frame totals.
+    size_t history_pos = 0;
+};
+
+struct TraceEvent {
+    int id;
+    int tid;
+    double start, end;
+};
+
+static const size_t timer_history_frames = 256;
+static const size_t max_trace_events = 1 << 22;
+static mutex timing_mtx;
+static vector<TimerData> timers;
+static double last_frame_end = -1;
+static bool tracing = false;
+static vector<TraceEvent> trace_events;
+static atomic<int> trace_thread_ids(0);
+
+static int FindTimer(string_view name) {
+    for (auto [i, t] : enumerate(timers)) if (t.name == name) return (int)i;
+    return -1;
+}
+
+int RegisterTimer(string_view name) {
+    lock_guard<mutex> lock(timing_mtx);
+    auto id = FindTimer(name);
+    if (id >= 0) return id;
+    timers.push_back({ string(name) });
+    return (int)timers.size() - 1;
+}
+
+// Needs timing_mtx to be held.
+static void TimerAddLocked(int id, double start, double end) {
+    timers[id].frame_total += end - start;
+    if (tracing && trace_events.size() < max_trace_events) {
+        thread_local int tid = trace_thread_ids++;
+        trace_events.push_back({ id, tid, start, end });
+    }
+}
+
+void TimerAdd(int id, double start, double end) {
+    lock_guard<mutex> lock(timing_mtx);
+    TimerAddLocked(id, start, end);
+}
+
+void TimingFrameEnd() {
+    static int frame_id = RegisterTimer("frame");
+    auto now = SecondsSinceStart();
+    lock_guard<mutex> lock(timing_mtx);
+    if (last_frame_end >= 0) TimerAddLocked(frame_id, last_frame_end, now);
+    last_frame_end = now;
+    for (auto &t : timers) {
+        if (t.history.size() < timer_history_frames) {
+            t.history.push_back((float)t.frame_total);
+        } else {
+            t.history[t.history_pos] = (float)t.frame_total;
+            t.history_pos = (t.history_pos + 1) % timer_history_frames;
+        }
+        t.frame_total = 0;
+    }
+}
+
+bool TimerPercentiles(string_view name, const vector<double> &percentiles,
+                      vector<double> &results) {
+    vector<float> sorted;
+    {
+        lock_guard<mutex> lock(timing_mtx);
+        auto id = FindTimer(name);
+        if (id < 0) return false;
+        sorted = timers[id].history;
+    }
+    if (sorted.empty()) return false;
+    sort(sorted.begin(), sorted.end());
+    for (auto p : percentiles) {
+        // Nearest rank.
+        auto rank = (size_t)ceil(std::clamp(p, 0.0, 100.0) / 100.0 * sorted.size());
+        results.push_back(sorted[rank ? rank - 1 : 0]);
+    }
+    return true;
+}
+
+vector<string> TimerNames() {
+    lock_guard<mutex> lock(timing_mtx);
+    vector<string> names;
+    for (auto &t : timers) names.push_back(t.name);
+    return names;
+}
+
+void TimingTrace(bool on) {
+    lock_guard<mutex> lock(timing_mtx);
+    tracing = on;
+}
+
+bool TimingSaveTrace(string_view filename) {
+    string json = "{\"traceEvents\":[\n";
+    {
+        lock_guard<mutex> lock(timing_mtx);
+        for (auto [i, e] : enumerate(trace_events)) {
+            // Timer names are identifiers chosen by the programmer, so quote only the basics.
+            string name;
+            for (auto c : timers[e.id].name) {
+                if (c == '"' || c == '\\') name += '\\';
+                if ((uint8_t)c >= ' ') name += c;
+            }
+            append(json, i ? ",\n" : "", "{\"name\":\"", name,
+                   "\",\"ph\":\"X\",\"pid\":0,\"tid\":", e.tid,
+                   ",\"ts\":", to_string_float(e.start * 1000000.0, 3),
+                   ",\"dur\":", to_string_float((e.end - e.start) * 1000000.0, 3), "}");
+        }
+        trace_events.clear();
+    }
+    json += "\n]}\n";
+    return WriteFile(filename, true, json, true);
+}
+
 int hwthreads = 2, hwcores = 1;
 void InitCPU() {
     // This can fail and return 0, so default to 2 threads:
@@ -313,9 +433,30 @@ void AddPakFileEntry(string_view pakfilename, string_view relfilename, int64_t o
     pakfile_registry[string(relfilename)] = make_tuple(pakfilename, off, len, uncompressed);
 }
 
-string last_abs_path_loaded;
+// Per thread, since files may be loaded from background threads.
+thread_local string last_abs_path_loaded;
 string LastAbsPathLoaded() { return last_abs_path_loaded; }
 
+int64_t FileVersion(string_view_nt absfilename) {
+    #if defined(_WIN32)
+        struct _stat64 st;
+        if (_stat64(absfilename.c_str(), &st)) return -1;
+    #elif !defined(PLATFORM_ES3)
+        struct stat st;
+        if (stat(absfilename.c_str(), &st)) return -1;
+    #else
+        (void)absfilename;
+        return -1;
+    #endif
+    #if !defined(PLATFORM_ES3)
+        auto mtime = (int64_t)st.st_mtime * 1000000000;
+        #ifdef __linux__
+            mtime += st.st_mtim.tv_nsec;
+        #endif
+        return mtime ^ ((int64_t)st.st_size << 1);
+    #endif
+}
+
 int64_t LoadFileFromAny(string_view filename, string *dest, int64_t start, int64_t len) {
     if (IsAbsolute(filename)) {
         // Absolute filename.
@@ -329,6 +470,21 @@ int64_t LoadFileFromAny(string_view filename, string *dest, int64_t start, int64
     return -1;
 }
 
+string FindDataFile(string_view relfilename) {
+    auto exists = [](const string &path) {
+        auto f = fopen(path.c_str(), "rb");
+        if (f) fclose(f);
+        return f != nullptr;
+    };
+    auto fn = SanitizePath(relfilename);
+    if (IsAbsolute(fn)) return exists(fn) ? fn : string();
+    for (auto &dir : data_dirs) {
+        auto path = dir + fn;
+        if (exists(path)) return path;
+    }
+    return {};
+}
+
 // We don't generally load in ways that allow stdio text mode conversions, so this function
 // emulates them at best effort.
 void TextModeConvert(string &s, bool binary) {
@@ -339,6 +495,7 @@ void TextModeConvert(string &s, bool binary) {
 }
 
 int64_t LoadFile(string_view relfilename, string *dest, int64_t start, int64_t len, bool binary) {
+    LOBSTER_TIMED_SCOPE("file_load");
     assert(cur_loader);
     auto it = pakfile_registry.find(relfilename);
     if (it != pakfile_registry.end()) {
@@ -630,6 +787,178 @@ iint LaunchSubProcess(const char **cmdl, const char *stdins, string &out) {
     #endif
 }
 
+#ifndef PLATFORM_ES3
+
+struct SubProcessImpl : SubProcess {
+    subprocess_s proc = {};
+    bool started = false;
+    shared_ptr<SubProcessSignal> signal;
+    mutex mtx;  // Guards the fields below, and reaping the child.
+    string out, err;
+    bool reaped = false;
+    bool done = false;
+    iint exit_code = -1;
+    thread out_reader, err_reader;
+    // Stdin is written by its own thread, since writing blocks whenever the child isn't
+    // reading, which may be because it is waiting for us to take its output.
+    mutex stdin_mtx;  // Guards the fields below, not proc.stdin_file (only used by in_writer).
+    condition_variable stdin_cv;
+    string stdin_queue;
+    bool stdin_closing = false;
+    bool stdin_failed = false;
+    thread in_writer;
+
+    SubProcessImpl(shared_ptr<SubProcessSignal> signal) : signal(signal) {}
+
+    ~SubProcessImpl() {
+        if (started) {
+            Kill();
+            out_reader.join();
+        }
+        subprocess_destroy(&proc);
+    }
+
+    void Start() {
+        started = true;
+        // Each pipe needs its own reader, or a child blocked on a full stderr pipe would never
+        // close stdout.
+        auto read = [this](unsigned int (*subprocess_read)(subprocess_s *, char *const, unsigned),
+                           string &dest) {
+            char buf[4096];
+            for (;;) {
+                auto len = subprocess_read(&proc, buf, sizeof(buf));
+                if (!len) break;
+                lock_guard<mutex> lock(mtx);
+                dest.append(buf, len);
+            }
+        };
+        in_writer = thread([this]() {
+            string data;
+            for (;;) {
+                {
+                    unique_lock<mutex> lock(stdin_mtx);
+                    stdin_cv.wait(lock, [&]() { return !stdin_queue.empty() || stdin_closing; });
+                    if (stdin_queue.empty()) break;
+                    data.clear();
+                    data.swap(stdin_queue);
+                }
+                if (fwrite(data.data(), 1, data.size(), proc.stdin_file) != data.size() ||
+                    fflush(proc.stdin_file)) {
+                    // The child stopped reading, no point in keeping anything else around.
+                    lock_guard<mutex> lock(stdin_mtx);
+                    stdin_failed = true;
+                    stdin_queue.clear();
+                    stdin_queue.shrink_to_fit();
+                }
+            }
+            fclose(proc.stdin_file);
+            proc.stdin_file = nullptr;
+        });
+        err_reader = thread([this, read]() { read(subprocess_read_stderr, err); });
+        out_reader = thread([this, read]() {
+            read(subprocess_read_stdout, out);
+            err_reader.join();
+            CloseStdin();
+            WaitForExit();
+            // Once the child is gone, writes fail rather than block, so this can't hang. Must
+            // be done before subprocess_join, which closes stdin itself.
+            in_writer.join();
+            {
+                // Reaping and Kill are under the same lock, so Kill can never signal a pid
+                // that has been reused already.
+                lock_guard<mutex> lock(mtx);
+                int ret = -1;
+                if (subprocess_join(&proc, &ret)) ret = -1;
+                exit_code = ret;
+                reaped = true;
+            }
+            {
+                lock_guard<mutex> lock(signal->mtx);
+                done = true;
+                signal->finished++;
+            }
+            signal->cv.notify_all();
+        });
+    }
+
+    // Blocks until the child has exited, but leaves it to be reaped by subprocess_join (on
+    // Windows the process handle keeps it around instead).
+    void WaitForExit() {
+        #ifndef _WIN32
+            siginfo_t info;
+            while (waitid(P_PID, (id_t)proc.child, &info, WEXITED | WNOWAIT) < 0 &&
+                   errno == EINTR) {}
+        #endif
+    }
+
+    void TakeOutput(string &o, string &e) {
+        lock_guard<mutex> lock(mtx);
+        o += out;
+        e += err;
+        out.clear();
+        err.clear();
+    }
+
+    bool WriteStdin(string_view data) {
+        {
+            lock_guard<mutex> lock(stdin_mtx);
+            if (stdin_closing || stdin_failed) return false;
+            stdin_queue += data;
+        }
+        stdin_cv.notify_one();
+        return true;
+    }
+
+    void CloseStdin() {
+        {
+            lock_guard<mutex> lock(stdin_mtx);
+            stdin_closing = true;
+        }
+        stdin_cv.notify_one();
+    }
+
+    bool Done() {
+        lock_guard<mutex> lock(signal->mtx);
+        return done;
+    }
+
+    iint ExitCode() {
+        lock_guard<mutex> lock(mtx);
+        return exit_code;
+    }
+
+    void Kill() {
+        lock_guard<mutex> lock(mtx);
+        if (started && !reaped) subprocess_terminate(&proc);
+    }
+};
+
+#endif
+
+SubProcess *StartSubProcess(const char **cmdl, shared_ptr<SubProcessSignal> signal) {
+    #ifndef PLATFORM_ES3
+        #ifndef _WIN32
+            // Writing stdin of a child that already exited should fail, not kill us.
+            ::signal(SIGPIPE, SIG_IGN);
+        #endif
+        auto sp = new SubProcessImpl(signal);
+        if (subprocess_create(cmdl, subprocess_option_inherit_environment |
+                                    subprocess_option_enable_async |
+                                    subprocess_option_search_user_path, &sp->proc)) {
+            // subprocess_create doesn't leave anything that is safe to destroy on failure.
+            sp->proc = {};
+            delete sp;
+            return nullptr;
+        }
+        sp->Start();
+        return sp;
+    #else
+        (void)cmdl;
+        (void)signal;
+        return nullptr;
+    #endif
+}
+
 vector<string> text_to_speech_q;
 void QueueTextToSpeech(string_view text) {
     text_to_speech_q.emplace_back(string(text));
@@ -0,0 +1,817 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Regular expressions over strings, for when modules/match.lobster (one Lobster call per char)
+// is too slow, e.g. scanning logs or parsing config files.
+
+// Patterns compile to an NFA program, which is shared between all regex resources compiled
+// from the same pattern. Matching with captures runs it as a Pike VM: all threads in lock-step,
+// so time is linear in the input no matter the pattern (no backtracking blowups), with
+// leftmost-first (Perl-like) semantics. When all that is needed is whether there is a match,
+// a DFA is built lazily from the NFA (one state per set of NFA threads, transitions filled in
+// as they are first taken) and cached in the resource, which is then one table lookup per byte.
+
+// Matching is on bytes: UTF-8 chars in patterns match as the sequence of bytes they are, but
+// . and [] only match single bytes.
+
+#include "lobster/stdafx.h"
+
+#include "lobster/natreg.h"
+
+namespace lobster {
+
+struct ByteClass {
+    uint64_t bits[4] = { 0, 0, 0, 0 };
+
+    bool Has(uint8_t c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+    void Set(uint8_t c) { bits[c >> 6] |= 1ULL << (c & 63); }
+    void SetRange(uint8_t lo, uint8_t hi) { for (int c = lo; c <= hi; c++) Set((uint8_t)c); }
+    void Add(const ByteClass &o) { for (int i = 0; i < 4; i++) bits[i] |= o.bits[i]; }
+    void Invert() { for (auto &b : bits) b = ~b; }
+};
+
+static bool IsWordChar(uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+enum RegexOp : uint8_t {
+    RX_CLASS,   // x: index into classes, consumes a byte.
+    RX_MATCH,
+    RX_JMP,     // x: target.
+    RX_SPLIT,   // x: preferred target, y: other target.
+    RX_SAVE,    // x: capture slot.
+    RX_BOL,     // Assertions: start / end of input, (not) at a word boundary.
+    RX_EOL,
+    RX_WORDB,
+    RX_NWORDB,
+};
+
+struct RegexInst {
+    RegexOp op;
+    int x = 0, y = 0;
+};
+
+struct RegexProg {
+    vector<RegexInst> insts;
+    vector<ByteClass> classes;
+    int ngroups = 0;  // Not counting the whole match, group 0.
+    bool has_word_assertions = false;
+
+    int NumSlots() const { return (ngroups + 1) * 2; }
+};
+
+// Parses into a tree first, since counted repetition needs to emit its operand several times.
+struct RegexNode {
+    enum Kind { CLASS, CAT, ALT, REPEAT, GROUP, ASSERT } kind;
+    int x = 0;  // CLASS: class index. GROUP: capture index or -1. ASSERT: RegexOp.
+    int min = 0, max = -1;  // REPEAT, max -1 is unbounded.
+    bool greedy = true;
+    vector<unique_ptr<RegexNode>> kids;
+
+    RegexNode(Kind k, int x = 0) : kind(k), x(x) {}
+};
+
+class RegexCompiler {
+    string_view p;
+    size_t pos = 0;
+    RegexProg &prog;
+    int depth = 0;  // Of groups and repeats, since parsing, code generation and freeing the
+                    // tree all recurse through them.
+
+    static constexpr size_t max_insts = 100000;
+    static constexpr int max_repeat = 1000;
+    static constexpr int max_depth = 250;
+
+    void Error(string_view msg) {
+        THROW_OR_ABORT(cat("regex: ", msg, " at position ", pos, " in: ", p));
+    }
+
+    void Nest() {
+        if (++depth > max_depth) Error(cat("nesting deeper than ", max_depth));
+    }
+
+    bool AtEnd() { return pos >= p.size(); }
+    char Peek() { return AtEnd() ? 0 : p[pos]; }
+
+    unique_ptr<RegexNode> NewClass(const ByteClass &bc) {
+        prog.classes.push_back(bc);
+        return make_unique<RegexNode>(RegexNode::CLASS, (int)prog.classes.size() - 1);
+    }
+
+    // \d \w \s and their inverses, usable both inside and outside of [].
+    bool ShorthandClass(char c, ByteClass &bc) {
+        ByteClass s;
+        switch (tolower(c)) {
+            case 'd': s.SetRange('0', '9'); break;
+            case 'w': s.SetRange('a', 'z'); s.SetRange('A', 'Z'); s.SetRange('0', '9'); s.Set('_');
+                      break;
+            case 's': for (auto w : string_view(" \t\n\r\f\v")) s.Set((uint8_t)w); break;
+            default: return false;
+        }
+        if (isupper(c)) s.Invert();
+        bc.Add(s);
+        return true;
+    }
+
+    int HexDigit() {
+        auto c = Peek();
+        pos++;
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        Error("\\x must be followed by 2 hex digits");
+        return 0;
+    }
+
+    // Escaped single byte, after the \ has been consumed.
+    uint8_t EscapedByte() {
+        auto c = p[pos++];
+        switch (c) {
+            case 'n': return '\n';
+            case 'r': return '\r';
+            case 't': return '\t';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            case '0': return 0;
+            case 'x': { auto hi = HexDigit(); return uint8_t(hi * 16 + HexDigit()); }
+        }
+        if (isalnum((uint8_t)c)) {
+            pos--;
+            Error(cat("unknown escape \\", c));
+        }
+        return (uint8_t)c;
+    }
+
+    unique_ptr<RegexNode> ParseBracket() {
+        ByteClass bc;
+        bool negate = Peek() == '^';
+        if (negate) pos++;
+        for (bool first = true;; first = false) {
+            if (AtEnd()) Error("unterminated [");
+            auto c = p[pos++];
+            if (c == ']' && !first) break;
+            uint8_t lo = (uint8_t)c;
+            if (c == '\\') {
+                if (AtEnd()) Error("unterminated [");
+                if (ShorthandClass(Peek(), bc)) { pos++; continue; }
+                lo = EscapedByte();
+            }
+            if (Peek() == '-' && pos + 1 < p.size() && p[pos + 1] != ']') {
+                pos++;
+                auto hc = p[pos++];
+                auto hi = hc == '\\' && !AtEnd() ? EscapedByte() : (uint8_t)hc;
+                if (hi < lo) Error("range out of order in []");
+                bc.SetRange(lo, hi);
+            } else {
+                bc.Set(lo);
+            }
+        }
+        if (negate) bc.Invert();
+        return NewClass(bc);
+    }
+
+    unique_ptr<RegexNode> ParseAtom() {
+        auto c = p[pos];
+        if (c == '*' || c == '+' || c == '?') Error("nothing to repeat");
+        pos++;
+        ByteClass bc;
+        switch (c) {
+            case '.': bc.Set('\n'); bc.Invert(); return NewClass(bc);
+            case '[': return ParseBracket();
+            case '^': return make_unique<RegexNode>(RegexNode::ASSERT, RX_BOL);
+            case '$': return make_unique<RegexNode>(RegexNode::ASSERT, RX_EOL);
+            case '(': {
+                Nest();
+                auto n = make_unique<RegexNode>(RegexNode::GROUP, -1);
+                if (Peek() == '?') {
+                    if (pos + 1 >= p.size() || p[pos + 1] != ':') Error("unknown group type (?");
+                    pos += 2;
+                } else {
+                    n->x = ++prog.ngroups;
+                }
+                n->kids.push_back(ParseAlt());
+                if (Peek() != ')') Error("missing )");
+                pos++;
+                depth--;
+                return n;
+            }
+            case '\\': {
+                if (AtEnd()) Error("trailing \\");
+                auto e = Peek();
+                if (e == 'b' || e == 'B') {
+                    pos++;
+                    prog.has_word_assertions = true;
+                    return make_unique<RegexNode>(RegexNode::ASSERT, e == 'b' ? RX_WORDB : RX_NWORDB);
+                }
+                if (ShorthandClass(e, bc)) { pos++; return NewClass(bc); }
+                bc.Set(EscapedByte());
+                return NewClass(bc);
+            }
+            default: bc.Set((uint8_t)c); return NewClass(bc);
+        }
+    }
+
+    bool ParseInt(int &i) {
+        auto start = pos;
+        i = 0;
+        while (isdigit((uint8_t)Peek())) {
+            i = i * 10 + (p[pos++] - '0');
+            if (i > max_repeat) Error(cat("repeat count over ", max_repeat));
+        }
+        return pos > start;
+    }
+
+    // {n} {n,} {n,m}. Returns false (consuming nothing) if it isn't one, in which case the {
+    // is taken literally.
+    bool ParseCount(int &min, int &max) {
+        auto start = pos;
+        pos++;
+        if (ParseInt(min)) {
+            max = min;
+            if (Peek() == ',') {
+                pos++;
+                if (!ParseInt(max)) max = -1;
+            }
+            if (Peek() == '}') {
+                pos++;
+                if (max >= 0 && max < min) Error("repeat count range out of order");
+                return true;
+            }
+        }
+        pos = start;
+        return false;
+    }
+
+    unique_ptr<RegexNode> ParseRepeat() {
+        auto n = ParseAtom();
+        // Each repeat of a repeat (e.g. a**) nests one deeper.
+        auto outer = depth;
+        for (;;) {
+            int min, max;
+            auto c = Peek();
+            if (c == '*') { pos++; min = 0; max = -1; }
+            else if (c == '+') { pos++; min = 1; max = -1; }
+            else if (c == '?') { pos++; min = 0; max = 1; }
+            else if (c == '{' && ParseCount(min, max)) {}
+            else { depth = outer; return n; }
+            if (n->kind == RegexNode::ASSERT) Error("can\'t repeat an assertion");
+            Nest();
+            auto r = make_unique<RegexNode>(RegexNode::REPEAT);
+            r->min = min;
+            r->max = max;
+            if (Peek() == '?') { pos++; r->greedy = false; }
+            r->kids.push_back(std::move(n));
+            n = std::move(r);
+        }
+    }
+
+    unique_ptr<RegexNode> ParseCat() {
+        auto n = make_unique<RegexNode>(RegexNode::CAT);
+        while (!AtEnd() && Peek() != '|' && Peek() != ')') n->kids.push_back(ParseRepeat());
+        return n;
+    }
+
+    unique_ptr<RegexNode> ParseAlt() {
+        auto n = make_unique<RegexNode>(RegexNode::ALT);
+        n->kids.push_back(ParseCat());
+        while (Peek() == '|') {
+            pos++;
+            n->kids.push_back(ParseCat());
+        }
+        return n;
+    }
+
+    int Emit(RegexOp op, int x = 0, int y = 0) {
+        if (prog.insts.size() >= max_insts) Error("pattern too large");
+        prog.insts.push_back({ op, x, y });
+        return (int)prog.insts.size() - 1;
+    }
+
+    int Here() { return (int)prog.insts.size(); }
+
+    void Gen(const RegexNode &n) {
+        switch (n.kind) {
+            case RegexNode::CLASS:
+                Emit(RX_CLASS, n.x);
+                break;
+            case RegexNode::ASSERT:
+                Emit((RegexOp)n.x);
+                break;
+            case RegexNode::CAT:
+                for (auto &k : n.kids) Gen(*k);
+                break;
+            case RegexNode::GROUP:
+                if (n.x >= 0) Emit(RX_SAVE, n.x * 2);
+                Gen(*n.kids[0]);
+                if (n.x >= 0) Emit(RX_SAVE, n.x * 2 + 1);
+                break;
+            case RegexNode::ALT: {
+                vector<int> jumps;
+                for (size_t i = 0; i < n.kids.size(); i++) {
+                    if (i + 1 == n.kids.size()) {
+                        Gen(*n.kids[i]);
+                        break;
+                    }
+                    auto split = Emit(RX_SPLIT, Here() + 1);
+                    Gen(*n.kids[i]);
+                    jumps.push_back(Emit(RX_JMP));
+                    prog.insts[split].y = Here();
+                }
+                for (auto j : jumps) prog.insts[j].x = Here();
+                break;
+            }
+            case RegexNode::REPEAT: {
+                auto &k = *n.kids[0];
+                // Orders the two targets of a split by greediness.
+                auto split = [&](int split, int body, int exit) {
+                    prog.insts[split].x = n.greedy ? body : exit;
+                    prog.insts[split].y = n.greedy ? exit : body;
+                };
+                for (int i = 0; i < n.min; i++) Gen(k);
+                if (n.max < 0) {
+                    auto loop = Emit(RX_SPLIT);
+                    Gen(k);
+                    Emit(RX_JMP, loop);
+                    split(loop, loop + 1, Here());
+                } else {
+                    vector<int> splits;
+                    for (int i = n.min; i < n.max; i++) {
+                        splits.push_back(Emit(RX_SPLIT));
+                        Gen(k);
+                    }
+                    for (auto s : splits) split(s, s + 1, Here());
+                }
+                break;
+            }
+        }
+    }
+
+    public:
+    RegexCompiler(string_view pattern, RegexProg &prog) : p(pattern), prog(prog) {}
+
+    void Compile() {
+        auto root = ParseAlt();
+        if (!AtEnd()) Error("unmatched )");
+        Emit(RX_SAVE, 0);
+        Gen(*root);
+        Emit(RX_SAVE, 1);
+        Emit(RX_MATCH);
+    }
+};
+
+// Runs a program as a Pike VM. Keeps its thread lists around between calls.
+class PikeVM {
+    const RegexProg &prog;
+    string_view s;
+    bool full = false;  // Only accept matches that end at the end of s.
+    int nslots;
+
+    struct ThreadList {
+        vector<int> pcs;
+        vector<iint> caps;  // nslots per thread.
+        vector<size_t> mark;  // Per instruction, == gen if already added this step.
+        size_t gen = 1;
+
+        void Clear() {
+            pcs.clear();
+            caps.clear();
+            gen++;
+        }
+    } lists[2];
+
+    vector<iint> scratch;
+
+    // Pending work for AddThread: follow pc, or if pc < 0, restore caps[slot] to old.
+    struct Job {
+        int pc;
+        int slot;
+        iint old;
+    };
+    vector<Job> jobs;
+
+    bool AssertionHolds(RegexOp op, size_t i) {
+        switch (op) {
+            case RX_BOL: return i == 0;
+            case RX_EOL: return i == s.size();
+            default: {
+                auto before = i > 0 && IsWordChar((uint8_t)s[i - 1]);
+                auto after = i < s.size() && IsWordChar((uint8_t)s[i]);
+                return (before != after) == (op == RX_WORDB);
+            }
+        }
+    }
+
+    // Follows all non-consuming instructions from pc, depth first so threads get added in
+    // priority order. Uses an explicit stack, since long chains of these (e.g. from a{1000})
+    // could overflow the native one. caps is restored before returning.
+    void AddThread(ThreadList &l, int pc, iint *caps, size_t i) {
+        jobs.push_back({ pc, 0, 0 });
+        while (!jobs.empty()) {
+            auto job = jobs.back();
+            jobs.pop_back();
+            if (job.pc < 0) {
+                caps[job.slot] = job.old;
+                continue;
+            }
+            if (l.mark[job.pc] == l.gen) continue;
+            l.mark[job.pc] = l.gen;
+            auto &in = prog.insts[job.pc];
+            switch (in.op) {
+                case RX_JMP:
+                    jobs.push_back({ in.x, 0, 0 });
+                    break;
+                case RX_SPLIT:
+                    // Reversed, so everything reachable from x gets added first.
+                    jobs.push_back({ in.y, 0, 0 });
+                    jobs.push_back({ in.x, 0, 0 });
+                    break;
+                case RX_SAVE:
+                    jobs.push_back({ -1, in.x, caps[in.x] });
+                    caps[in.x] = (iint)i;
+                    jobs.push_back({ job.pc + 1, 0, 0 });
+                    break;
+                case RX_BOL: case RX_EOL: case RX_WORDB: case RX_NWORDB:
+                    if (AssertionHolds(in.op, i)) jobs.push_back({ job.pc + 1, 0, 0 });
+                    break;
+                default:
+                    l.pcs.push_back(job.pc);
+                    l.caps.insert(l.caps.end(), caps, caps + nslots);
+                    break;
+            }
+        }
+    }
+
+    public:
+    explicit PikeVM(const RegexProg &prog) : prog(prog), nslots(prog.NumSlots()) {
+        for (auto &l : lists) l.mark.resize(prog.insts.size(), 0);
+        scratch.resize(nslots);
+    }
+
+    // Finds the leftmost match starting at or after from (or only at from if anchored), and
+    // stores its capture offsets (-1 for groups that didn't participate) in caps.
+    bool Run(string_view str, size_t from, bool anchored, bool full_match, vector<iint> &caps) {
+        s = str;
+        full = full_match;
+        auto *clist = &lists[0], *nlist = &lists[1];
+        clist->Clear();
+        bool matched = false;
+        for (size_t i = from;; i++) {
+            if (!matched && (i == from || !anchored)) {
+                // Lowest priority, since all threads already running started earlier.
+                std::fill(scratch.begin(), scratch.end(), -1);
+                AddThread(*clist, 0, scratch.data(), i);
+            }
+            if (clist->pcs.empty()) break;
+            nlist->Clear();
+            for (size_t t = 0; t < clist->pcs.size(); t++) {
+                auto tcaps = clist->caps.data() + t * nslots;
+                auto &in = prog.insts[clist->pcs[t]];
+                if (in.op == RX_CLASS) {
+                    if (i < s.size() && prog.classes[in.x].Has((uint8_t)s[i]))
+                        AddThread(*nlist, clist->pcs[t] + 1, tcaps, i + 1);
+                } else if (!full || i == s.size()) {
+                    assert(in.op == RX_MATCH);
+                    matched = true;
+                    caps.assign(tcaps, tcaps + nslots);
+                    // Any lower priority threads can't win anymore.
+                    break;
+                }
+            }
+            std::swap(clist, nlist);
+            if (i == s.size()) break;
+        }
+        return matched;
+    }
+};
+
+// Answers whether there's a match anywhere in a string, using a DFA built on the fly.
+// Can't deal with word boundary assertions, since those need to know the previous char.
+class RegexDFA {
+    const RegexProg &prog;
+
+    struct State {
+        vector<int> pcs;  // NFA threads: RX_CLASS, RX_MATCH, or a pending RX_EOL.
+        bool match = false;         // Matches now, regardless of what follows.
+        bool match_at_end = false;  // Matches if the input ends here.
+        int next[256];
+    };
+    vector<State> states;
+    map<vector<int>, int> index;
+    int start = -1;  // For position 0, where ^ holds.
+    vector<size_t> mark;
+    size_t gen = 1;
+    vector<int> todo;  // Worklist for the below, which may follow long chains of instructions.
+
+    static constexpr size_t max_states = 4096;
+
+    // Epsilon closure, except that $ is left as a pending thread.
+    void Closure(int pc, bool at_start, vector<int> &pcs) {
+        todo.push_back(pc);
+        while (!todo.empty()) {
+            pc = todo.back();
+            todo.pop_back();
+            if (mark[pc] == gen) continue;
+            mark[pc] = gen;
+            auto &in = prog.insts[pc];
+            switch (in.op) {
+                case RX_JMP: todo.push_back(in.x); break;
+                case RX_SPLIT: todo.push_back(in.y); todo.push_back(in.x); break;
+                case RX_SAVE: todo.push_back(pc + 1); break;
+                case RX_BOL: if (at_start) todo.push_back(pc + 1); break;
+                default: pcs.push_back(pc); break;
+            }
+        }
+    }
+
+    // Whether pc reaches a match without consuming anything, if the input ends here.
+    bool MatchesAtEnd(int pc) {
+        todo.push_back(pc);
+        while (!todo.empty()) {
+            pc = todo.back();
+            todo.pop_back();
+            if (mark[pc] == gen) continue;
+            mark[pc] = gen;
+            auto &in = prog.insts[pc];
+            switch (in.op) {
+                case RX_MATCH: todo.clear(); return true;
+                case RX_JMP: todo.push_back(in.x); break;
+                case RX_SPLIT: todo.push_back(in.y); todo.push_back(in.x); break;
+                case RX_SAVE: case RX_EOL: todo.push_back(pc + 1); break;
+                default: break;  // RX_CLASS, or RX_BOL which can't hold past position 0.
+            }
+        }
+        return false;
+    }
+
+    int StateFor(vector<int> &&pcs) {
+        sort(pcs.begin(), pcs.end());
+        auto it = index.find(pcs);
+        if (it != index.end()) return it->second;
+        State st;
+        st.pcs = pcs;
+        for (auto pc : pcs) {
+            if (prog.insts[pc].op == RX_MATCH) st.match = true;
+            gen++;
+            if (MatchesAtEnd(pc)) st.match_at_end = true;
+        }
+        std::fill(std::begin(st.next), std::end(st.next), -1);
+        states.push_back(std::move(st));
+        auto si = (int)states.size() - 1;
+        index[std::move(pcs)] = si;
+        return si;
+    }
+
+    int Step(int si, uint8_t c) {
+        vector<int> pcs;
+        gen++;
+        for (auto pc : states[si].pcs) {
+            auto &in = prog.insts[pc];
+            if (in.op == RX_CLASS && prog.classes[in.x].Has(c)) Closure(pc + 1, false, pcs);
+        }
+        // Unanchored: a new match may start at every position.
+        Closure(0, false, pcs);
+        auto ni = StateFor(std::move(pcs));
+        states[si].next[c] = ni;
+        return ni;
+    }
+
+    void Reset() {
+        states.clear();
+        index.clear();
+        vector<int> pcs;
+        gen++;
+        Closure(0, true, pcs);
+        start = StateFor(std::move(pcs));
+    }
+
+    public:
+    explicit RegexDFA(const RegexProg &prog) : prog(prog) {
+        assert(!prog.has_word_assertions);
+        mark.resize(prog.insts.size(), 0);
+        Reset();
+    }
+
+    bool Search(string_view s) {
+        // Pathological patterns can have exponentially many states, so start over if needed.
+        if (states.size() > max_states) Reset();
+        auto si = start;
+        for (auto c : s) {
+            if (states[si].match) return true;
+            auto ni = states[si].next[(uint8_t)c];
+            si = ni >= 0 ? ni : Step(si, (uint8_t)c);
+        }
+        return states[si].match || states[si].match_at_end;
+    }
+
+    size_t NumStates() { return states.size(); }
+};
+
+// Compiled programs are immutable, so can be shared by all resources (and threads) using the
+// same pattern. Cleared when full, so programs making many different patterns don't grow it
+// forever; resources keep their own reference to the program.
+static mutex regex_cache_mtx;
+static unordered_map<string, shared_ptr<const RegexProg>> regex_cache;
+static constexpr size_t regex_cache_max = 256;
+
+struct Regex : Resource {
+    shared_ptr<const RegexProg> prog;
+    PikeVM pike;
+    unique_ptr<RegexDFA> dfa;  // Only for patterns without word boundary assertions.
+    vector<iint> caps;
+
+    Regex(shared_ptr<const RegexProg> _prog) : prog(_prog), pike(*_prog) {
+        if (!prog->has_word_assertions) dfa = make_unique<RegexDFA>(*prog);
+    }
+
+    bool Test(string_view s) {
+        return dfa ? dfa->Search(s) : pike.Run(s, 0, false, false, caps);
+    }
+
+    size_t2 MemoryUsage() {
+        return { sizeof(Regex), prog->insts.size() * sizeof(RegexInst) +
+                                prog->classes.size() * sizeof(ByteClass) +
+                                (dfa ? dfa->NumStates() * sizeof(int) * 256 : 0) };
+    }
+};
+
+static ResourceType regex_type = { "regex" };
+
+static Regex &GetRegex(Value &res) {
+    return GetResourceDec<Regex>(res, &regex_type);
+}
+
+static shared_ptr<const RegexProg> CompileRegex(string_view pattern, string &err) {
+    lock_guard<mutex> lock(regex_cache_mtx);
+    auto it = regex_cache.find(string(pattern));
+    if (it != regex_cache.end()) return it->second;
+    auto prog = make_shared<RegexProg>();
+    #ifdef USE_EXCEPTION_HANDLING
+    try
+    #endif
+    {
+        RegexCompiler(pattern, *prog).Compile();
+    }
+    #ifdef USE_EXCEPTION_HANDLING
+    catch (string &s) {
+        err = s;
+        return nullptr;
+    }
+    #endif
+    if (regex_cache.size() >= regex_cache_max) regex_cache.clear();
+    regex_cache[string(pattern)] = prog;
+    return prog;
+}
+
+static LVector *CapsToVec(VM &vm, const vector<iint> &caps) {
+    auto vec = vm.NewVec(ssize(caps), ssize(caps), TYPE_ELEM_VECTOR_OF_INT);
+    for (size_t i = 0; i < caps.size(); i++) vec->Elems()[i] = Value(caps[i]);
+    return vec;
+}
+
+static size_t CheckOffset(VM &vm, Value &offset, string_view s, const char *fn) {
+    auto o = offset.ival();
+    if (o < 0 || o > (iint)s.size()) vm.BuiltinError(cat(fn, ": offset out of range"));
+    return (size_t)o;
+}
+
+// Calls f with the captures of each match, scanning left to right without overlap. After an
+// empty match, the next one is looked for one char further along.
+template<typename F> void ForEachMatch(Regex &re, string_view s, F f) {
+    if (re.dfa && !re.dfa->Search(s)) return;
+    for (size_t i = 0; i <= s.size(); ) {
+        if (!re.pike.Run(s, i, false, false, re.caps)) break;
+        f(re.caps);
+        auto start = (size_t)re.caps[0], end = (size_t)re.caps[1];
+        i = end > start ? end : end + 1;
+    }
+}
+
+void AddRegex(NativeRegistry &nfr) {
+
+nfr("regex_compile", "pattern", "S", "R:regex?S?",
+    "compiles a regular expression, or returns nil and an error message if it is malformed."
+    " supports . [] [^] \\d \\w \\s (and \\D \\W \\S) ^ $ \\b \\B | () (?:) * + ? {n} {n,} {n,m},"
+    " with an additional ? to make a repetition lazy. matches bytes, so multi-byte UTF-8"
+    " chars can be used literally, but . and [] only match single bytes. . doesn\'t match \\n."
+    " compiling the same pattern again is cheap.",
+    [](StackPtr &sp, VM &vm, Value &pattern) {
+        string err;
+        auto prog = CompileRegex(pattern.sval()->strv(), err);
+        if (!prog) {
+            Push(sp, NilVal());
+            return Value(vm.NewString(err));
+        }
+        Push(sp, vm.NewResource(&regex_type, new Regex(prog)));
+        return NilVal();
+    });
+
+nfr("regex_groups", "re", "R:regex", "I",
+    "the number of capture groups in the pattern (not counting the whole match).",
+    [](StackPtr &, VM &, Value &re) {
+        return Value(GetRegex(re).prog->ngroups);
+    });
+
+nfr("regex_test", "re,s", "R:regexS", "B",
+    "whether there is a match anywhere in s. this is the fastest way to match, as it doesn\'t"
+    " need to track captures.",
+    [](StackPtr &, VM &, Value &re, Value &s) {
+        return Value(GetRegex(re).Test(s.sval()->strv()));
+    });
+
+nfr("regex_match", "re,s", "R:regexS", "I]?",
+    "matches the whole of s, returning the start and end offsets of the match and then each"
+    " capture group (-1 for groups that didn\'t participate), or nil if it doesn\'t match.",
+    [](StackPtr &, VM &vm, Value &res, Value &s) {
+        auto &re = GetRegex(res);
+        if (!re.pike.Run(s.sval()->strv(), 0, true, true, re.caps)) return NilVal();
+        return Value(CapsToVec(vm, re.caps));
+    });
+
+nfr("regex_search", "re,s,offset", "R:regexSI?", "I]?",
+    "finds the first match in s (optionally starting at offset), returning offsets like"
+    " regex_match, or nil if none.",
+    [](StackPtr &, VM &vm, Value &res, Value &s, Value &offset) {
+        auto &re = GetRegex(res);
+        auto sv = s.sval()->strv();
+        auto o = CheckOffset(vm, offset, sv, "regex_search");
+        if (!o && re.dfa && !re.dfa->Search(sv)) return NilVal();
+        if (!re.pike.Run(sv, o, false, false, re.caps)) return NilVal();
+        return Value(CapsToVec(vm, re.caps));
+    });
+
+nfr("regex_find_all", "re,s", "R:regexS", "I]",
+    "finds all non-overlapping matches in s, returning the offsets of all of them in a single"
+    " vector: (regex_groups(re) + 1) * 2 ints per match, laid out as with regex_match.",
+    [](StackPtr &, VM &vm, Value &res, Value &s) {
+        auto &re = GetRegex(res);
+        auto vec = vm.NewVec(0, 0, TYPE_ELEM_VECTOR_OF_INT);
+        ForEachMatch(re, s.sval()->strv(), [&](const vector<iint> &caps) {
+            for (auto c : caps) vec->Push(vm, Value(c));
+        });
+        return Value(vec);
+    });
+
+nfr("regex_split", "re,s", "R:regexS", "S]",
+    "splits s into the parts between non-empty matches.",
+    [](StackPtr &, VM &vm, Value &res, Value &s) {
+        auto &re = GetRegex(res);
+        auto sv = s.sval()->strv();
+        auto vec = vm.NewVec(0, 0, TYPE_ELEM_VECTOR_OF_STRING);
+        size_t prev = 0;
+        ForEachMatch(re, sv, [&](const vector<iint> &caps) {
+            if (caps[0] == caps[1]) return;
+            vec->Push(vm, vm.NewString(sv.substr(prev, (size_t)caps[0] - prev)));
+            prev = (size_t)caps[1];
+        });
+        vec->Push(vm, vm.NewString(sv.substr(prev)));
+        return Value(vec);
+    });
+
+nfr("regex_filter", "re,strings,numthreads", "R:regexS]I?", "I]",
+    "returns the indices of all strings that have a match anywhere (as regex_test)."
+    " large vectors are split over numthreads threads (default: all hardware threads).",
+    [](StackPtr &, VM &vm, Value &res, Value &strings, Value &numthreads) {
+        auto &re = GetRegex(res);
+        auto v = strings.vval();
+        auto n = (size_t)v->len;
+        vector<uint8_t> hits(n, 0);
+        // Below this many strings per thread, starting threads costs more than it saves.
+        const size_t min_per_thread = 256;
+        auto nt = numthreads.ival() > 0 ? (size_t)numthreads.ival() : (size_t)NumHWThreads();
+        nt = std::max(size_t(1), std::min({ nt, n / min_per_thread, size_t(256) }));
+        if (nt == 1) {
+            for (size_t i = 0; i < n; i++) hits[i] = re.Test(v->At(i).sval()->strv());
+        } else {
+            // Each thread gets its own matcher, since the DFA gets built as it goes, starting
+            // from a copy of the states built so far. The VM is blocked in this call meanwhile,
+            // so the strings are safe to read.
+            vector<thread> threads;
+            for (size_t t = 0; t < nt; t++) {
+                threads.emplace_back([&, t]() {
+                    Regex local(re.prog);
+                    if (re.dfa) local.dfa = make_unique<RegexDFA>(*re.dfa);
+                    for (auto i = n * t / nt; i < n * (t + 1) / nt; i++)
+                        hits[i] = local.Test(v->At(i).sval()->strv());
+                });
+            }
+            for (auto &t : threads) t.join();
+        }
+        auto vec = vm.NewVec(0, 0, TYPE_ELEM_VECTOR_OF_INT);
+        for (size_t i = 0; i < n; i++) if (hits[i]) vec->Push(vm, Value((iint)i));
+        return Value(vec);
+    });
+
+}  // AddRegex
+
+}  // namespace lobster
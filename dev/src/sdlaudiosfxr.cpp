@@ -372,11 +372,9 @@ Mix_Chunk *RenderSFXR(string_view buf) {
     return AllocChunk(synth.data(), synth.size());
 }
 
-Sound *LoadSound(string_view filename, SoundType st) {
-    auto it = sound_files.find(filename);
-    if (it != sound_files.end()) {
-        return &it->second;
-    }
+// Does not touch any shared state, so can be called from any thread once audio has been
+// initialized.
+Mix_Chunk *DecodeSound(string_view filename, SoundType st) {
     string buf;
     if (LoadFile(filename, &buf) < 0)
         return nullptr;
@@ -406,13 +404,26 @@ Sound *LoadSound(string_view filename, SoundType st) {
         }
 
     }
-    if (!chunk) return nullptr;
+    return chunk;
+}
+
+Sound *CacheSound(string_view filename, Mix_Chunk *chunk) {
     //Mix_VolumeChunk(chunk, MIX_MAX_VOLUME / 2);
     Sound snd;
     snd.chunk.reset(chunk);
     return &(sound_files.insert({ string(filename), std::move(snd) }).first->second);
 }
 
+Sound *LoadSound(string_view filename, SoundType st) {
+    auto it = sound_files.find(filename);
+    if (it != sound_files.end()) {
+        return &it->second;
+    }
+    auto chunk = DecodeSound(filename, st);
+    if (!chunk) return nullptr;
+    return CacheSound(filename, chunk);
+}
+
 bool SDLSoundInit() {
     if (sound_init) return true;
 
@@ -465,6 +476,23 @@ int SDLLoadSound(string_view filename, SoundType st) {
     return LoadSound(filename, st) != 0;
 }
 
+void *SDLDecodeSound(string_view filename, SoundType st) {
+    return DecodeSound(filename, st);
+}
+
+bool SDLAddDecodedSound(string_view filename, void *chunk) {
+    if (sound_files.find(filename) != sound_files.end()) {
+        // Already loaded by other means, keep the existing one.
+        Mix_FreeChunk((Mix_Chunk *)chunk);
+        return true;
+    }
+    return CacheSound(filename, (Mix_Chunk *)chunk) != nullptr;
+}
+
+void SDLFreeDecodedSound(void *chunk) {
+    Mix_FreeChunk((Mix_Chunk *)chunk);
+}
+
 int SDLPlaySound(string_view filename, SoundType st, float vol, int loops, int pri) {
     if (!SDLSoundInit()) return 0;
     auto snd = LoadSound(filename, st);
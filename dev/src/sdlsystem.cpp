@@ -516,6 +516,7 @@ bool SDLFrame() {
     frames++;
     frametimelog.push_back((float)frametime);
     if (frametimelog.size() > 64) frametimelog.erase(frametimelog.begin());
+    TimingFrameEnd();
 
     for (auto &it : keymap) it.second.FrameAdvance();
 
@@ -0,0 +1,786 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A persistent spatial index of circles (2D) or spheres (3D), for when circles_within_range
+// rebuilding its grid every call is too slow, e.g. many entities moving a little each frame.
+
+// It is a loose grid: an entry lives in the (hashed, so unbounded) cell that contains its
+// center, and queries look maxrad further than they otherwise would to find entries that stick
+// out of their cell. Moving an entry within its cell costs nothing beyond storing the position.
+// Entries bigger than a cell are kept in a separate list that every query checks, such that a
+// single huge entry doesn't make all queries scan many cells.
+
+#include "lobster/stdafx.h"
+
+#include "lobster/natreg.h"
+
+namespace lobster {
+
+// Open addressing map from cell key to cell index. Much faster to probe than unordered_map,
+// which matters since every query looks up several cells, most of which may be empty.
+struct CellMap {
+    static constexpr uint64_t empty = ~0ULL;  // Not a valid key, see SpatialIndex::Key.
+    vector<uint64_t> keys;
+    vector<int> vals;
+    size_t used = 0;
+
+    CellMap() : keys(16, empty), vals(16, -1) {}
+
+    size_t Home(uint64_t key) const {
+        auto h = key * 0x9E3779B97F4A7C15ULL;
+        return (h ^ (h >> 32)) & (keys.size() - 1);
+    }
+
+    int Find(uint64_t key) const {
+        for (auto i = Home(key);; i = (i + 1) & (keys.size() - 1)) {
+            if (keys[i] == key) return vals[i];
+            if (keys[i] == empty) return -1;
+        }
+    }
+
+    void Insert(uint64_t key, int val) {
+        if ((used + 1) * 2 > keys.size()) {
+            auto okeys = std::move(keys);
+            auto ovals = std::move(vals);
+            keys.assign(okeys.size() * 2, empty);
+            vals.assign(okeys.size() * 2, -1);
+            used = 0;
+            for (size_t i = 0; i < okeys.size(); i++)
+                if (okeys[i] != empty) Insert(okeys[i], ovals[i]);
+        }
+        auto i = Home(key);
+        while (keys[i] != empty) i = (i + 1) & (keys.size() - 1);
+        keys[i] = key;
+        vals[i] = val;
+        used++;
+    }
+
+    void Erase(uint64_t key) {
+        auto mask = keys.size() - 1;
+        auto i = Home(key);
+        while (keys[i] != key) i = (i + 1) & mask;
+        // Shift back any following entries that would otherwise become unreachable.
+        for (auto j = (i + 1) & mask; keys[j] != empty; j = (j + 1) & mask) {
+            auto home = Home(keys[j]);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                keys[i] = keys[j];
+                vals[i] = vals[j];
+                i = j;
+            }
+        }
+        keys[i] = empty;
+        vals[i] = -1;
+        used--;
+    }
+};
+
+struct SpatialIndex : Resource {
+    // Stored in the cell rather than by id, so queries don't have to look elsewhere.
+    struct Item {
+        double3 pos;
+        double rad;
+        int id;
+    };
+    struct Cell {
+        int3 coord;
+        uint64_t key;
+        vector<Item> items;
+    };
+    struct Entry {
+        int cell = -1;  // < 0: id not in use.
+        int slot = -1;  // Index into the cell's items.
+        uint32_t stamp = 0;
+    };
+
+    double cellsize;
+    int dims;
+    double maxrad = 0;  // Largest radius ever inserted into the grid, at most cellsize.
+    iint count = 0;
+    int3 mincell = int3(INT_MAX), maxcell = int3(INT_MIN);  // All cells ever used.
+    vector<Entry> entries;  // Indexed by id.
+    vector<Cell> cells;  // cells[big_cell] holds the entries too big for the grid.
+    vector<int> free_cells;
+    CellMap cellmap;
+    // Cell indices for the box of cells dmin .. dmin + dsize - 1, valid if dense_ok.
+    vector<int> dense;
+    int3 dmin = int3_0, dsize = int3_0;
+    bool dense_ok = false;
+    size_t dense_failed_cells = 0;
+    uint32_t curstamp = 0;
+
+    static constexpr int big_cell = 0;
+
+    SpatialIndex(double cellsize, int dims) : cellsize(cellsize), dims(dims) {
+        cells.emplace_back();
+    }
+
+    size_t2 MemoryUsage() {
+        auto sz = entries.capacity() * sizeof(Entry) + cells.capacity() * sizeof(Cell) +
+                  cellmap.keys.size() * (sizeof(uint64_t) + sizeof(int)) +
+                  dense.capacity() * sizeof(int);
+        for (auto &c : cells) sz += c.items.capacity() * sizeof(Item);
+        return size_t2(sizeof(SpatialIndex), sz);
+    }
+
+    double3 Pos(const double3 &p) { return dims == 2 ? double3(p.x, p.y, 0.0) : p; }
+
+    // Cell coordinates are clamped such that they fit in a key, which only matters for
+    // entries very far from the origin (they end up sharing the border cells).
+    static constexpr int cell_limit = 1 << 20;
+
+    int3 CellOf(const double3 &p) {
+        return ffloor(max(double3(-cell_limit), min(double3(cell_limit - 1), p / cellsize)));
+    }
+
+    static uint64_t Key(const int3 &c) {
+        auto b = uint64_t(cell_limit);
+        return (c.x + b) | ((c.y + b) << 21) | ((c.z + b) << 42);
+    }
+
+    int DenseIdx(const int3 &c) {
+        auto d = c - dmin;
+        if (d.x < 0 || d.y < 0 || d.z < 0 || d.x >= dsize.x || d.y >= dsize.y || d.z >= dsize.z)
+            return -1;
+        return (d.z * dsize.y + d.y) * dsize.x + d.x;
+    }
+
+    int Lookup(const int3 &c) {
+        if (!dense_ok) return cellmap.Find(Key(c));
+        auto i = DenseIdx(c);
+        return i < 0 ? -1 : dense[i];
+    }
+
+    const vector<Item> *FindCell(const int3 &c) {
+        auto ci = Lookup(c);
+        return ci < 0 ? nullptr : &cells[ci].items;
+    }
+
+    // Queries look up cells in a dense array covering all cells in use if that isn't too
+    // sparse, since that is quite a bit faster than even CellMap. It has some slack around the
+    // edges such that entries moving outwards don't immediately require a rebuild.
+    void Prepare() {
+        if (dense_ok || !count || cells.size() < dense_failed_cells * 2) return;
+        auto size = maxcell - mincell + 1;
+        auto slack = size / 4 + 1;
+        if (dims == 2) slack.z = 0;
+        auto lo = max(mincell - slack, int3(-cell_limit));
+        auto hi = min(maxcell + slack, int3(cell_limit - 1));
+        size = hi - lo + 1;
+        auto volume = (int64_t)size.x * size.y * size.z;
+        if (volume > std::max<int64_t>(1 << 16, 16 * (int64_t)cells.size())) {
+            dense_failed_cells = cells.size();
+            dense.clear();
+            return;
+        }
+        dmin = lo;
+        dsize = size;
+        dense.assign((size_t)volume, -1);
+        for (size_t ci = big_cell + 1; ci < cells.size(); ci++)
+            if (!cells[ci].items.empty()) dense[DenseIdx(cells[ci].coord)] = (int)ci;
+        dense_ok = true;
+        dense_failed_cells = 0;
+    }
+
+    bool Valid(iint id) { return id >= 0 && id < ssize(entries) && entries[id].cell >= 0; }
+
+    Item &Get(int id) {
+        auto &e = entries[id];
+        return cells[e.cell].items[e.slot];
+    }
+
+    bool IsBig(double rad) { return rad > cellsize; }
+
+    const vector<Item> &BigItems() { return cells[big_cell].items; }
+
+    void Link(const Item &item) {
+        if (IsBig(item.rad)) {
+            LinkTo(item, big_cell);
+            return;
+        }
+        auto c = CellOf(item.pos);
+        mincell = min(mincell, c);
+        maxcell = max(maxcell, c);
+        auto key = Key(c);
+        auto ci = cellmap.Find(key);
+        if (ci < 0) {
+            if (free_cells.empty()) {
+                ci = (int)cells.size();
+                cells.emplace_back();
+            } else {
+                ci = free_cells.back();
+                free_cells.pop_back();
+            }
+            cells[ci].coord = c;
+            cells[ci].key = key;
+            cellmap.Insert(key, ci);
+            if (dense_ok) {
+                auto di = DenseIdx(c);
+                if (di >= 0) dense[di] = ci;
+                else dense_ok = false;
+            }
+        }
+        LinkTo(item, ci);
+    }
+
+    void LinkTo(const Item &item, int ci) {
+        auto &e = entries[item.id];
+        e.cell = ci;
+        e.slot = (int)cells[ci].items.size();
+        cells[ci].items.push_back(item);
+    }
+
+    Item Unlink(int id) {
+        auto &e = entries[id];
+        auto &cell = cells[e.cell];
+        auto item = cell.items[e.slot];
+        cell.items[e.slot] = cell.items.back();
+        entries[cell.items[e.slot].id].slot = e.slot;
+        cell.items.pop_back();
+        if (cell.items.empty() && e.cell != big_cell) {
+            cellmap.Erase(cell.key);
+            if (dense_ok) dense[DenseIdx(cell.coord)] = -1;
+            free_cells.push_back(e.cell);
+        }
+        e.cell = -1;
+        return item;
+    }
+
+    void Set(int id, const double3 &pos, double rad) {
+        if (id >= ssize(entries)) entries.resize(id + 1);
+        if (entries[id].cell < 0) {
+            count++;
+            Link({ Pos(pos), rad, id });
+        } else if (IsBig(rad) != IsBig(Get(id).rad)) {
+            auto item = Unlink(id);
+            item.pos = Pos(pos);
+            item.rad = rad;
+            Link(item);
+        } else {
+            Move(id, pos);
+            Get(id).rad = rad;
+        }
+        if (!IsBig(rad)) maxrad = std::max(maxrad, rad);
+    }
+
+    void Move(int id, const double3 &pos) {
+        auto np = Pos(pos);
+        auto &item = Get(id);
+        auto ci = entries[id].cell;
+        if (ci == big_cell || Key(CellOf(np)) == cells[ci].key) {
+            item.pos = np;
+        } else {
+            auto moved = Unlink(id);
+            moved.pos = np;
+            Link(moved);
+        }
+    }
+
+    void Remove(int id) {
+        Unlink(id);
+        count--;
+    }
+
+    // Calls f on all items in grid cells in the [minc..maxc] range. If the range has more cells
+    // than there are in use (e.g. with entries far apart), it is cheaper to just go through those.
+    template<typename F> void ForCells(int3 minc, int3 maxc, F f) {
+        if (dims == 2) minc.z = maxc.z = 0;
+        minc = max(minc, mincell);
+        maxc = min(maxc, maxcell);
+        auto size = maxc - minc + 1;
+        if (size.x <= 0 || size.y <= 0 || size.z <= 0) return;
+        if ((int64_t)size.x * size.y * size.z > (int64_t)cells.size()) {
+            for (size_t ci = big_cell + 1; ci < cells.size(); ci++) {
+                auto &cell = cells[ci];
+                if (cell.items.empty() || cell.coord != max(minc, min(maxc, cell.coord))) continue;
+                for (auto &item : cell.items) f(item);
+            }
+            return;
+        }
+        for (int z = minc.z; z <= maxc.z; z++)
+            for (int y = minc.y; y <= maxc.y; y++)
+                for (int x = minc.x; x <= maxc.x; x++)
+                    if (auto items = FindCell(int3(x, y, z)))
+                        for (auto &item : *items) f(item);
+    }
+
+    // Entries whose distance to the sphere at pos with radius rad is less than dist.
+    void QueryRadius(const double3 &pos, double rad, double dist, iint exclude,
+                     vector<int> &out) {
+        Prepare();
+        auto p = Pos(pos);
+        auto scan = rad + maxrad + dist;
+        auto range = rad + dist;
+        auto Test = [&](const Item &item) {
+            auto v = item.pos - p;
+            auto r = range + item.rad;
+            if (r > 0 && dot(v, v) < r * r && item.id != exclude) out.push_back(item.id);
+        };
+        for (auto &item : BigItems()) Test(item);
+        ForCells(CellOf(p - scan), CellOf(p + scan), Test);
+    }
+
+    void QueryBox(const double3 &bmin, const double3 &bmax, vector<int> &out) {
+        Prepare();
+        auto lo = Pos(bmin), hi = Pos(bmax);
+        auto Test = [&](const Item &item) {
+            auto v = item.pos - max(lo, min(hi, item.pos));
+            if (dot(v, v) <= item.rad * item.rad) out.push_back(item.id);
+        };
+        for (auto &item : BigItems()) Test(item);
+        ForCells(CellOf(lo - maxrad), CellOf(hi + maxrad), Test);
+    }
+
+    // Entries hit by the ray within maxdist, closest first. Walks the cells along the ray,
+    // looking at neighbours far enough to catch any entry sticking out of its cell.
+    void QueryRay(const double3 &origin, const double3 &dir, double maxdist, vector<int> &out) {
+        Prepare();
+        auto o = Pos(origin);
+        auto d = normalize(Pos(dir));
+        vector<pair<double, int>> hits;
+        auto reach = (int)ceil(maxrad / cellsize);
+        auto stamp = ++curstamp;
+        auto Test = [&](const Item &item) {
+            auto &e = entries[item.id];
+            if (e.stamp == stamp) return;
+            e.stamp = stamp;
+            auto oc = item.pos - o;
+            auto tc = dot(oc, d);
+            auto d2 = dot(oc, oc) - tc * tc;
+            auto r2 = item.rad * item.rad;
+            if (d2 > r2) return;
+            auto t = std::max(0.0, tc - sqrt(r2 - d2));
+            if (t <= maxdist && tc + sqrt(r2 - d2) >= 0) hits.push_back({ t, item.id });
+        };
+        for (auto &item : BigItems()) Test(item);
+        WalkRay(o, d, maxdist, [&](const int3 &c) { ForCells(c - reach, c + reach, Test); });
+        sort(hits.begin(), hits.end());
+        for (auto &h : hits) out.push_back(h.second);
+    }
+
+    // Calls visit on the grid cells along the ray (Amanatides & Woo).
+    template<typename F> void WalkRay(const double3 &o, const double3 &d, double maxdist,
+                                      F visit) {
+        if (!cellmap.used) return;
+        // Clip the ray to the cells in use, the walk may otherwise be arbitrarily long.
+        auto lo = double3(mincell) * cellsize - maxrad - cellsize;
+        auto hi = double3(maxcell + 1) * cellsize + maxrad + cellsize;
+        auto tstart = 0.0;
+        for (int i = 0; i < 3; i++) {
+            if (d[i] == 0) {
+                if (o[i] < lo[i] || o[i] > hi[i]) return;
+                continue;
+            }
+            auto t0 = (lo[i] - o[i]) / d[i];
+            auto t1 = (hi[i] - o[i]) / d[i];
+            if (t0 > t1) std::swap(t0, t1);
+            tstart = std::max(tstart, t0);
+            maxdist = std::min(maxdist, t1);
+        }
+        if (tstart > maxdist) return;
+        auto c = CellOf(o + d * tstart);
+        auto end = CellOf(o + d * maxdist);
+        int3 step;
+        double3 tmax, tdelta;
+        for (int i = 0; i < 3; i++) {
+            step[i] = d[i] > 0 ? 1 : (d[i] < 0 ? -1 : 0);
+            auto boundary = (c[i] + (step[i] > 0)) * cellsize;
+            tmax[i] = step[i] ? (boundary - o[i]) / d[i] : DBL_MAX;
+            tdelta[i] = step[i] ? cellsize / fabs(d[i]) : DBL_MAX;
+        }
+        for (;;) {
+            visit(c);
+            if (c == end) break;
+            auto i = tmax.x < tmax.y ? (tmax.x < tmax.z ? 0 : 2) : (tmax.y < tmax.z ? 1 : 2);
+            if (tmax[i] > maxdist) break;
+            c[i] += step[i];
+            tmax[i] += tdelta[i];
+        }
+    }
+
+    // The k entries with the closest surface to pos (closest first), optionally no further
+    // than maxdist. Searches rings of cells outwards until no closer entries are possible.
+    void QueryNearest(const double3 &pos, iint k, double maxdist, iint exclude,
+                      vector<int> &out) {
+        if (k <= 0 || !count) return;
+        Prepare();
+        auto p = Pos(pos);
+        auto limit = maxdist > 0 ? maxdist : DBL_MAX;
+        // Max-heap on distance, so the worst of the best k is on top.
+        vector<pair<double, int>> best;
+        auto Consider = [&](const Item &item) {
+            if (item.id == exclude) return;
+            auto dist = length(item.pos - p) - item.rad;
+            if (dist > limit) return;
+            if (ssize(best) == k) {
+                if (dist >= best.front().first) return;
+                pop_heap(best.begin(), best.end());
+                best.pop_back();
+            }
+            best.push_back({ dist, item.id });
+            push_heap(best.begin(), best.end());
+        };
+        for (auto &item : BigItems()) Consider(item);
+        if (cellmap.used) SearchRings(p, limit, k, best, Consider);
+        sort_heap(best.begin(), best.end());
+        for (auto &b : best) out.push_back(b.second);
+    }
+
+    template<typename F> void SearchRings(const double3 &p, double limit, iint k,
+                                          const vector<pair<double, int>> &best, F consider) {
+        auto c = CellOf(p);
+        // Rings (relative to c) only need to cover the cells in use: start at the first ring
+        // that overlaps them, and clip each ring to them, so a pos far away from all entries
+        // doesn't have to visit all the empty cells in between.
+        auto lo = mincell - c, hi = maxcell - c;
+        int rmin = 0, rmax = 0;
+        for (int i = 0; i < dims; i++) {
+            rmin = std::max(rmin, std::max(lo[i], -hi[i]));
+            rmax = std::max(rmax, std::max(-lo[i], hi[i]));
+        }
+        auto ConsiderCell = [&](const int3 &rel) {
+            if (auto items = FindCell(c + rel))
+                for (auto &item : *items) consider(item);
+        };
+        for (int r = rmin; r <= rmax; r++) {
+            // Anything in this ring or further has its center at least this far away.
+            auto ringdist = (r - 1) * cellsize - maxrad;
+            if (ringdist > limit) break;
+            if (ssize(best) == k && ringdist >= best.front().first) break;
+            auto zr = dims == 3 ? r : 0;
+            for (int z = std::max(-zr, lo.z); z <= std::min(zr, hi.z); z++) {
+                for (int y = std::max(-r, lo.y); y <= std::min(r, hi.y); y++) {
+                    if (r && abs(z) != r && abs(y) != r) {
+                        // Only the shell of the cube, inner rows just need their end points.
+                        if (-r >= lo.x) ConsiderCell(int3(-r, y, z));
+                        if (r <= hi.x) ConsiderCell(int3(r, y, z));
+                    } else {
+                        for (int x = std::max(-r, lo.x); x <= std::min(r, hi.x); x++)
+                            ConsiderCell(int3(x, y, z));
+                    }
+                }
+            }
+        }
+    }
+
+    // Queries in random order spend most of their time on cache misses looking up cells, so
+    // batch queries are done grouped by the cell they fall in (queries outside of any cell in
+    // use get a group of their own). Returns groups as ranges of order.
+    void GroupByCell(const vector<double3> &qpos, vector<int> &order, vector<int> &groups) {
+        Prepare();
+        // With the dense array, groups also end up in spatial order, so neighbouring groups
+        // share most of their cells.
+        auto n = (int)qpos.size();
+        vector<int> qcell(n), counts((dense_ok ? dense.size() : cells.size()) + 1, 0);
+        for (int q = 0; q < n; q++) {
+            auto c = CellOf(Pos(qpos[q]));
+            qcell[q] = dense_ok ? DenseIdx(c) : cellmap.Find(Key(c));
+            if (qcell[q] >= 0) counts[qcell[q] + 1]++;
+        }
+        for (size_t i = 1; i < counts.size(); i++) counts[i] += counts[i - 1];
+        auto lone = counts.back();
+        order.resize(n);
+        for (int q = 0; q < n; q++) order[qcell[q] >= 0 ? counts[qcell[q]]++ : lone++] = q;
+        groups.clear();
+        for (int i = 0; i < n; i++)
+            if (!i || qcell[order[i]] < 0 || qcell[order[i]] != qcell[order[i - 1]])
+                groups.push_back(i);
+        groups.push_back(n);
+    }
+
+    // Turns per query ranges of results into offsets + ids in query order.
+    static void Assemble(const vector<pair<int, int>> &spans, const vector<int> &results,
+                         vector<int> &offsets, vector<int> &ids) {
+        offsets.clear();
+        ids.clear();
+        ids.reserve(results.size());
+        for (auto &s : spans) {
+            offsets.push_back((int)ids.size());
+            ids.insert(ids.end(), results.begin() + s.first, results.begin() + s.second);
+        }
+        offsets.push_back((int)ids.size());
+    }
+
+    // QueryRadius for many positions at once. The candidates from the cells around a group are
+    // gathered once, and then tested against all queries in the group.
+    void QueryRadiusBatch(const vector<double3> &qpos, const vector<double> &qrad, double dist,
+                          bool exclude_self, vector<int> &offsets, vector<int> &ids) {
+        vector<int> order, groups, results;
+        GroupByCell(qpos, order, groups);
+        vector<pair<int, int>> spans(qpos.size());
+        vector<Item> candidates;
+        for (size_t g = 0; g + 1 < groups.size(); g++) {
+            auto gmaxrad = 0.0;
+            for (auto i = groups[g]; i < groups[g + 1]; i++)
+                gmaxrad = std::max(gmaxrad, qrad[order[i]]);
+            auto c = CellOf(Pos(qpos[order[groups[g]]]));
+            auto scan = gmaxrad + maxrad + dist;
+            candidates.assign(BigItems().begin(), BigItems().end());
+            ForCells(CellOf(double3(c) * cellsize - scan),
+                     CellOf(double3(c + 1) * cellsize + scan),
+                     [&](const Item &item) { candidates.push_back(item); });
+            for (auto i = groups[g]; i < groups[g + 1]; i++) {
+                auto q = order[i];
+                auto p = Pos(qpos[q]);
+                auto range = qrad[q] + dist;
+                auto exclude = exclude_self ? q : -1;
+                auto start = (int)results.size();
+                for (auto &item : candidates) {
+                    auto v = item.pos - p;
+                    auto r = range + item.rad;
+                    if (r > 0 && dot(v, v) < r * r && item.id != exclude)
+                        results.push_back(item.id);
+                }
+                spans[q] = { start, (int)results.size() };
+            }
+        }
+        Assemble(spans, results, offsets, ids);
+    }
+
+    void QueryNearestBatch(const vector<double3> &qpos, iint k, double maxdist, bool exclude_self,
+                           vector<int> &offsets, vector<int> &ids) {
+        vector<int> order, groups, results;
+        GroupByCell(qpos, order, groups);
+        vector<pair<int, int>> spans(qpos.size());
+        for (auto q : order) {
+            auto start = (int)results.size();
+            QueryNearest(qpos[q], k, maxdist, exclude_self ? q : -1, results);
+            spans[q] = { start, (int)results.size() };
+        }
+        Assemble(spans, results, offsets, ids);
+    }
+};
+
+static ResourceType spatial_index_type = { "spatialindex" };
+
+static SpatialIndex &GetSpatialIndex(Value &res) {
+    return GetResourceDec<SpatialIndex>(res, &spatial_index_type);
+}
+
+static int CheckId(VM &vm, SpatialIndex &si, Value &id, bool must_exist) {
+    auto i = id.ival();
+    if (i < 0 || i > INT_MAX / 2) vm.BuiltinError(cat("spatial index: illegal id: ", i));
+    if (must_exist && !si.Valid(i)) vm.BuiltinError(cat("spatial index: no such id: ", i));
+    return (int)i;
+}
+
+static double3 AtPos(const LVector *v, iint i) {
+    return ValueToF<3>(v->AtSt(i), v->width);
+}
+
+static LVector *ToIntVec(VM &vm, const vector<int> &ids) {
+    auto vec = vm.NewVec(ssize(ids), ssize(ids), TYPE_ELEM_VECTOR_OF_INT);
+    for (size_t i = 0; i < ids.size(); i++) vec->Elems()[i] = Value(ids[i]);
+    return vec;
+}
+
+static vector<double3> ToPositions(const LVector *v) {
+    vector<double3> positions(v->len);
+    for (iint i = 0; i < v->len; i++) positions[i] = AtPos(v, i);
+    return positions;
+}
+
+void AddSpatial(NativeRegistry &nfr) {
+
+nfr("spatial_index", "cellsize,dimensions", "FI?", "R:spatialindex",
+    "creates an empty index of circles (dimensions 2, default) or spheres (3) that can be"
+    " updated incrementally and queried quickly. ids are ints of your choosing (e.g. indices"
+    " into your own entity vector), best kept small since storage is proportional to the largest"
+    " id. cellsize is best set to around the typical query radius or entity size: too small"
+    " makes queries look at many cells, too big makes them test many entries. positions may"
+    " be any size vector: in 2D only x and y are used, in 3D missing components are 0."
+    " for many entries in a single frame, see also spatial_update_all and the _batch queries.",
+    [](StackPtr &, VM &vm, Value &cellsize, Value &dims) {
+        auto d = dims.ival() ? dims.ival() : 2;
+        if (cellsize.fval() <= 0 || (d != 2 && d != 3))
+            vm.BuiltinError("spatial_index: cellsize must be > 0, dimensions 2 or 3");
+        return Value(vm.NewResource(&spatial_index_type, new SpatialIndex(cellsize.fval(),
+                                                                           (int)d)));
+    });
+
+nfr("spatial_set", "index,id,pos,radius", "R:spatialindexIF}F", "",
+    "inserts id into the index, or moves it (and changes its radius) if it is already present.",
+    [](StackPtr &sp, VM &vm) {
+        auto rad = Pop(sp).fval();
+        auto pos = PopVec<double3>(sp);
+        auto id = Pop(sp);
+        auto res = Pop(sp);
+        auto &si = GetSpatialIndex(res);
+        if (rad < 0) vm.BuiltinError("spatial_set: radius must be >= 0");
+        si.Set(CheckId(vm, si, id, false), pos, rad);
+    });
+
+nfr("spatial_move", "index,id,pos", "R:spatialindexIF}", "",
+    "moves id, which must be present. cheap if it stays in the same cell.",
+    [](StackPtr &sp, VM &vm) {
+        auto pos = PopVec<double3>(sp);
+        auto id = Pop(sp);
+        auto res = Pop(sp);
+        auto &si = GetSpatialIndex(res);
+        si.Move(CheckId(vm, si, id, true), pos);
+    });
+
+nfr("spatial_remove", "index,id", "R:spatialindexI", "B",
+    "removes id from the index. returns false if it wasn't present.",
+    [](StackPtr &, VM &vm, Value &res, Value &id) {
+        auto &si = GetSpatialIndex(res);
+        auto i = CheckId(vm, si, id, false);
+        if (!si.Valid(i)) return Value(false);
+        si.Remove(i);
+        return Value(true);
+    });
+
+nfr("spatial_update_all", "index,positions,radiuses", "R:spatialindexF}]F]", "",
+    "makes ids 0 .. positions.length - 1 be present with these positions (as if calling"
+    " spatial_set for each), and removes all higher ids. radiuses must be the same length, or"
+    " empty to keep the radiuses of ids already present (and use 0 for new ones). the fastest"
+    " way to update a simulation where most entries move every frame.",
+    [](StackPtr &, VM &vm, Value &res, Value &positions, Value &radiuses) {
+        auto &si = GetSpatialIndex(res);
+        auto pv = positions.vval();
+        auto rv = radiuses.vval();
+        if (rv->len && rv->len != pv->len)
+            vm.BuiltinError("spatial_update_all: input vectors size mismatch");
+        for (int i = 0; i < pv->len; i++) {
+            auto pos = AtPos(pv, i);
+            if (rv->len) {
+                auto rad = rv->At(i).fval();
+                if (rad < 0) vm.BuiltinError("spatial_update_all: radius must be >= 0");
+                si.Set(i, pos, rad);
+            } else if (si.Valid(i)) {
+                si.Move(i, pos);
+            } else {
+                si.Set(i, pos, 0);
+            }
+        }
+        for (auto i = (int)pv->len; i < ssize(si.entries); i++)
+            if (si.Valid(i)) si.Remove(i);
+        si.entries.resize(pv->len);
+        return NilVal();
+    });
+
+nfr("spatial_size", "index", "R:spatialindex", "I",
+    "the number of ids present in the index.",
+    [](StackPtr &, VM &, Value &res) {
+        return Value(GetSpatialIndex(res).count);
+    });
+
+nfr("spatial_get", "index,id", "R:spatialindexI", "F}:3F",
+    "returns position and radius of id, which must be present.",
+    [](StackPtr &sp, VM &vm) {
+        auto id = Pop(sp);
+        auto res = Pop(sp);
+        auto &si = GetSpatialIndex(res);
+        auto &item = si.Get(CheckId(vm, si, id, true));
+        PushVec(sp, item.pos);
+        Push(sp, item.rad);
+    });
+
+nfr("spatial_query_radius", "index,pos,radius,dist", "R:spatialindexF}FF?", "I]",
+    "returns the ids (in no particular order) whose circle/sphere is less than dist away from"
+    " the one given by pos and radius, i.e. they overlap if dist is 0 (the default).",
+    [](StackPtr &sp, VM &vm) {
+        auto dist = Pop(sp).fval();
+        auto rad = Pop(sp).fval();
+        auto pos = PopVec<double3>(sp);
+        auto res = Pop(sp);
+        vector<int> ids;
+        GetSpatialIndex(res).QueryRadius(pos, rad, dist, -1, ids);
+        Push(sp, ToIntVec(vm, ids));
+    });
+
+nfr("spatial_query_box", "index,min,max", "R:spatialindexF}F}", "I]",
+    "returns the ids (in no particular order) whose circle/sphere overlaps the box from min to"
+    " max.",
+    [](StackPtr &sp, VM &vm) {
+        auto bmax = PopVec<double3>(sp);
+        auto bmin = PopVec<double3>(sp);
+        auto res = Pop(sp);
+        vector<int> ids;
+        GetSpatialIndex(res).QueryBox(bmin, bmax, ids);
+        Push(sp, ToIntVec(vm, ids));
+    });
+
+nfr("spatial_query_ray", "index,origin,dir,maxdist", "R:spatialindexF}F}F", "I]",
+    "returns the ids whose circle/sphere is hit by the ray from origin along dir (which doesn't"
+    " need to be normalized) within maxdist, closest first.",
+    [](StackPtr &sp, VM &vm) {
+        auto maxdist = Pop(sp).fval();
+        auto dir = PopVec<double3>(sp);
+        auto origin = PopVec<double3>(sp);
+        auto res = Pop(sp);
+        auto &si = GetSpatialIndex(res);
+        if (dot(si.Pos(dir), si.Pos(dir)) == 0 || maxdist < 0)
+            vm.BuiltinError("spatial_query_ray: dir must be non-zero and maxdist >= 0");
+        vector<int> ids;
+        si.QueryRay(origin, dir, maxdist, ids);
+        Push(sp, ToIntVec(vm, ids));
+    });
+
+nfr("spatial_query_nearest", "index,pos,k,maxdist", "R:spatialindexF}IF?", "I]",
+    "returns up to k ids whose circle/sphere surface is closest to pos, closest first. if"
+    " maxdist > 0, only considers ids at most that far away, which is faster.",
+    [](StackPtr &sp, VM &vm) {
+        auto maxdist = Pop(sp).fval();
+        auto k = Pop(sp).ival();
+        auto pos = PopVec<double3>(sp);
+        auto res = Pop(sp);
+        vector<int> ids;
+        GetSpatialIndex(res).QueryNearest(pos, k, maxdist, -1, ids);
+        Push(sp, ToIntVec(vm, ids));
+    });
+
+nfr("spatial_query_radius_batch", "index,positions,radiuses,dist,exclude_self",
+    "R:spatialindexF}]F]FB?", "I]I]",
+    "does spatial_query_radius for each element of positions (and the same size radiuses),"
+    " without allocating a vector per query. returns offsets and ids: the results for query i"
+    " are ids[offsets[i]] .. ids[offsets[i + 1] - 1]. exclude_self leaves out id i from the"
+    " results of query i, useful when querying the same set that is in the index, which"
+    " makes this a faster circles_within_range.",
+    [](StackPtr &sp, VM &vm) {
+        auto exclude_self = Pop(sp).True();
+        auto dist = Pop(sp).fval();
+        auto radiuses = Pop(sp).vval();
+        auto positions = Pop(sp).vval();
+        auto res = Pop(sp);
+        auto &si = GetSpatialIndex(res);
+        if (radiuses->len != positions->len)
+            vm.BuiltinError("spatial_query_radius_batch: input vectors size mismatch");
+        vector<double> qrad(radiuses->len);
+        for (iint i = 0; i < radiuses->len; i++) qrad[i] = radiuses->At(i).fval();
+        vector<int> offsets, ids;
+        si.QueryRadiusBatch(ToPositions(positions), qrad, dist, exclude_self, offsets, ids);
+        Push(sp, ToIntVec(vm, offsets));
+        Push(sp, ToIntVec(vm, ids));
+    });
+
+nfr("spatial_query_nearest_batch", "index,positions,k,maxdist,exclude_self",
+    "R:spatialindexF}]IF?B?", "I]I]",
+    "does spatial_query_nearest for each element of positions, returning offsets and ids like"
+    " spatial_query_radius_batch.",
+    [](StackPtr &sp, VM &vm) {
+        auto exclude_self = Pop(sp).True();
+        auto maxdist = Pop(sp).fval();
+        auto k = Pop(sp).ival();
+        auto positions = Pop(sp).vval();
+        auto res = Pop(sp);
+        auto &si = GetSpatialIndex(res);
+        vector<int> offsets, ids;
+        si.QueryNearestBatch(ToPositions(positions), k, maxdist, exclude_self, offsets, ids);
+        Push(sp, ToIntVec(vm, offsets));
+        Push(sp, ToIntVec(vm, ids));
+    });
+
+}  // AddSpatial
+
+}
@@ -6,18 +6,8 @@
 
 namespace lobster {
 
-bool RunC(const char *source,
-          const char *object_name,
-          string &error,
-          const void **imports,
-          const char **export_names,
-          function<bool (void **)> runf) {
-    // Wrap this thing in a unique pointer since the compiled code may
-    // throw an exception still.
-    auto deleter = [&](TCCState *p) { tcc_delete(p); };
-    unique_ptr<TCCState, decltype(deleter)> state(tcc_new(), deleter);
-    tcc_set_output_type(state.get(), object_name ? TCC_OUTPUT_OBJ : TCC_OUTPUT_MEMORY);
-    tcc_set_error_func(state.get(), &error, [](void *err, const char *msg) {
+static bool InitState(TCCState *state, string &error, const void **imports) {
+    tcc_set_error_func(state, &error, [](void *err, const char *msg) {
         // No way to disable warnings individually, so filter them here :)
         //if (strstr(msg, "label at end of compound statement")) return;
         *((string *)err) += msg;
@@ -25,7 +15,7 @@ bool RunC(const char *source,
     });
     #ifdef _WIN32
         // Need to provide chkstk.
-        tcc_set_options(state.get(), "-xa");
+        tcc_set_options(state, "-xa");
         // FIXME replace this by an tcc_add_symbol call?
         auto chkstk_src =
             ".globl __chkstk                                             \n"
@@ -48,16 +38,31 @@ bool RunC(const char *source,
             "    mov     %rcx,%rsp                                       \n"
             "    mov     (%rax),%rcx     /* restore ecx */               \n"
             "    jmp     *8(%rax)                                        \n";
-        if (tcc_compile_string(state.get(), chkstk_src) < 0) return false;
-        tcc_set_options(state.get(), "-xc");
+        if (tcc_compile_string(state, chkstk_src) < 0) return false;
+        tcc_set_options(state, "-xc");
     #endif
-    tcc_add_symbol(state.get(), "memmove", (const void *)memmove);
-    tcc_set_options(state.get(), "-nostdlib -Wall");
+    tcc_add_symbol(state, "memmove", (const void *)memmove);
+    tcc_set_options(state, "-nostdlib -Wall");
     while (*imports) {
         auto name = (const char *)(*imports++);
         auto fun = *imports++;
-        tcc_add_symbol(state.get(), name, fun);
+        tcc_add_symbol(state, name, fun);
     }
+    return true;
+}
+
+bool RunC(const char *source,
+          const char *object_name,
+          string &error,
+          const void **imports,
+          const char **export_names,
+          function<bool (void **)> runf) {
+    // Wrap this thing in a unique pointer since the compiled code may
+    // throw an exception still.
+    auto deleter = [&](TCCState *p) { tcc_delete(p); };
+    unique_ptr<TCCState, decltype(deleter)> state(tcc_new(), deleter);
+    tcc_set_output_type(state.get(), object_name ? TCC_OUTPUT_OBJ : TCC_OUTPUT_MEMORY);
+    if (!InitState(state.get(), error, imports)) return false;
     if (tcc_compile_string(state.get(), source) < 0) return false;
     if (object_name) {
         return tcc_output_file(state.get(), object_name) == 0;
@@ -71,5 +76,25 @@ bool RunC(const char *source,
     }
 }
 
+void *CompileC(const char *source, string &error, const void **imports,
+               const char **export_names, vector<void *> &exports) {
+    auto state = tcc_new();
+    tcc_set_output_type(state, TCC_OUTPUT_MEMORY);
+    if (!InitState(state, error, imports) ||
+        tcc_compile_string(state, source) < 0 ||
+        tcc_relocate(state, TCC_RELOCATE_AUTO) < 0) {
+        tcc_delete(state);
+        return nullptr;
+    }
+    while (*export_names) {
+        exports.push_back(tcc_get_symbol(state, *export_names++));
+    }
+    return state;
+}
+
+void FreeC(void *state) {
+    tcc_delete((TCCState *)state);
+}
+
 }
 
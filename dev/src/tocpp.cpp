@@ -20,15 +20,58 @@
 
 namespace lobster {
 
-string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bool cpp,
-             int runtime_checks, string_view custom_pre_init_name) {
-    auto bcf = bytecode::GetBytecodeFile(bytecode_buffer.data());
+CGenerator::CGenerator(NativeRegistry &natreg, string_view bytecode_buffer, bool cpp,
+                       int runtime_checks, bool lazy)
+    : natreg(natreg), bytecode_buffer(bytecode_buffer), cpp(cpp),
+      runtime_checks(runtime_checks), lazy(lazy) {
+    bcf = bytecode::GetBytecodeFile(bytecode_buffer.data());
+    code = (const int *)bcf->bytecode()->Data();  // Assumes we're on a little-endian machine.
+    typetable = (const type_elem_t *)bcf->typetable()->Data();  // Same.
+    function_lookup = CreateFunctionLookUp(bcf);
+    specidents = bcf->specidents();
+    len = bcf->bytecode()->size();
+}
+
+string CGenerator::Init() {
     if (!FLATBUFFERS_LITTLEENDIAN) return "native code gen requires little endian";
-    auto code = (const int *)bcf->bytecode()->Data();  // Assumes we're on a little-endian machine.
-    auto typetable = (const type_elem_t *)bcf->typetable()->Data();  // Same.
-    auto function_lookup = CreateFunctionLookUp(bcf);
-    auto specidents = bcf->specidents();
+    var_to_local.resize(specidents->size(), -1);
+    auto ip = code;
+    // Skip past 1st jump.
+    assert(*ip == IL_JUMP);
+    ip += 2;
+    starting_ip = code + *ip++;
+    while (ip < code + len) {
+        int id = (int)(ip - code);
+        if (*ip == IL_FUNSTART || ip == starting_ip) {
+            fun_index[id] = (int)fun_ids.size();
+            fun_ids.push_back(id);
+            starting_point = id;
+        }
+        if ((false)) {  // Debug corrupt bytecode.
+            string da;
+            DisAsmIns(natreg, da, ip, code, typetable, bcf, -1);
+            LOG_DEBUG(da);
+        }
+        int opc = *ip++;
+        if (opc < 0 || opc >= IL_MAX_OPS) {
+            return cat("Corrupt bytecode: ", opc, " at: ", id);
+        }
+        int regso = -1;
+        ParseOpAndGetArity(opc, ip, regso);
+    }
+    return "";
+}
+
+string CGenerator::FunCall(int id) {
+    return lazy ? cat("funtab[", fun_index[id], "]") : cat("fun_", id);
+}
+
+string CGenerator::FunValue(int id) {
+    // Always the stub, since function values may be compared.
+    return lazy ? cat("stubtab[", fun_index[id], "]") : cat("fun_", id);
+}
 
+void CGenerator::Prelude(string &sd, string_view used) {
     if (cpp) {
         sd +=
             "#include \"lobster/stdafx.h\"\n"
@@ -85,25 +128,36 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
         auto args = [&](int A) {
             for (int i = 0; i < A; i++) sd += ", int";
         };
+        // Lazily compiled functions are small, so declaring all ops would dominate their parse
+        // time.
+        set<string_view> used_ops;
+        for (size_t i = 0; (i = used.find("U_", i)) != used.npos; ) {
+            auto end = used.find('(', i);
+            used_ops.insert(used.substr(i, end - i));
+            i = end;
+        }
+        auto needed = [&](string_view name) {
+            return used.empty() || used_ops.count(name);
+        };
 
         #define F(N, A, USE, DEF) \
-            sd += "void U_" #N "(VMRef, StackPtr"; args(A); sd += ");\n";
+            if (needed("U_" #N)) { sd += "void U_" #N "(VMRef, StackPtr"; args(A); sd += ");\n"; }
             ILBASENAMES
         #undef F
         #define F(N, A, USE, DEF) \
-            sd += "void U_" #N "(VMRef, StackPtr"; args(A); sd += ", fun_base_t);\n";
+            if (needed("U_" #N)) { sd += "void U_" #N "(VMRef, StackPtr"; args(A); sd += ", fun_base_t);\n"; }
             ILCALLNAMES
         #undef F
         #define F(N, A, USE, DEF) \
-            sd += "void U_" #N "(VMRef, StackPtr, const int *);\n";
+            if (needed("U_" #N)) { sd += "void U_" #N "(VMRef, StackPtr, const int *);\n"; }
             ILVARARGNAMES
         #undef F
         #define F(N, A, USE, DEF) \
-            sd += "int U_" #N "(VMRef, StackPtr);\n";
+            if (needed("U_" #N)) { sd += "int U_" #N "(VMRef, StackPtr);\n"; }
             ILJUMPNAMES1
         #undef F
         #define F(N, A, USE, DEF) \
-            sd += "int U_" #N "(VMRef, StackPtr, int);\n";
+            if (needed("U_" #N)) { sd += "int U_" #N "(VMRef, StackPtr, int);\n"; }
             ILJUMPNAMES2
         #undef F
 
@@ -120,6 +174,7 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
               "extern void SetLVal(VMRef, Value *);\n"
               "extern int RetSlots(VMRef);\n"
               "extern int GetTypeSwitchID(VMRef, Value, int);\n"
+              "extern int GetStringSwitchID(VMRef, Value, const int *);\n"
               "extern void PushFunId(VMRef, const int *, StackPtr);\n"
               "extern void PopFunId(VMRef);\n"
               #if LOBSTER_FRAME_PROFILER
@@ -129,54 +184,26 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
               "\n";
     }
 
-    if (runtime_checks >= RUNTIME_ASSERT_PLUS) {
-        append(sd, "extern const int funinfo_table[];\n\n");
+    if (lazy) {
+        sd += "extern fun_base_t funtab[];\n"
+              "extern fun_base_t stubtab[];\n"
+              "extern fun_base_t LazyCompile(VMRef, void *, int, StackPtr);\n"
+              "extern char lazy_context;\n\n";
     }
+}
 
-    vector<int> var_to_local;
-    var_to_local.resize(specidents->size(), -1);
-
-    auto len = bcf->bytecode()->size();
-    auto ip = code;
-    // Skip past 1st jump.
-    assert(*ip == IL_JUMP);
-    ip += 2;
-    auto starting_ip = code + *ip++;
-    int starting_point = -1;
-    while (ip < code + len) {
-        int id = (int)(ip - code);
-        if (*ip == IL_FUNSTART || ip == starting_ip) {
-            append(sd, "static void fun_", id, "(VMRef, StackPtr);\n");
-            starting_point = id;
-        }
-        if ((false)) {  // Debug corrupt bytecode.
-            string da;
-            DisAsmIns(natreg, da, ip, code, typetable, bcf, -1);
-            LOG_DEBUG(da);
-        }
-        int opc = *ip++;
-        if (opc < 0 || opc >= IL_MAX_OPS) {
-            return cat("Corrupt bytecode: ", opc, " at: ", id);
-        }
-        int regso = -1;
-        ParseOpAndGetArity(opc, ip, regso);
-    }
-    sd += "\n";
-    vector<const int *> jumptables;
-    vector<int> funstarttables;
-    ip = code + 3;  // Past first IL_JUMP.
+void CGenerator::Function(string &sd, const int *&ip) {
     const int *funstart = nullptr;
     int nkeepvars = 0;
     string sdt, sp;
-    int opc = -1;
-    const int *args = nullptr;
     bool has_profile = false;
+    vector<pair<int, const int *>> jumptables;  // (opcode, args)
     auto comment = [&](string_view c) { append(sd, " // ", c); };
-    while (ip < code + len) {
+    for (;;) {
         int id = (int)(ip - code);
         bool is_start = ip == starting_ip;
-        opc = *ip++;
-        args = ip + 1;
+        int opc = *ip++;
+        auto args = ip + 1;
         if (opc == IL_FUNSTART || is_start) {
             funstart = args;
             nkeepvars = 0;
@@ -186,9 +213,16 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
             auto f = it != function_lookup.end() ? it->second : nullptr;
             sd += "\n";
             if (f) append(sd, "// ", f->name()->string_view(), "\n");
-            append(sd, "static void fun_", id, "(VMRef vm, StackPtr psp) {\n");
+            // Lazy JIT functions each go in their own unit, and are looked up by name.
+            if (osr_block >= 0) {
+                append(sd, "void osr_", id, "(VMRef vm, StackPtr psp, Value *oregs, ",
+                       "Value *olocals, Value *okeepvar) {\n");
+            } else {
+                append(sd, lazy ? "" : "static ", "void fun_", id, "(VMRef vm, StackPtr psp) {\n");
+            }
             const int *funstartend = nullptr;
             int numlocals = 0;
+            int numregs = 1;
             if (opc == IL_FUNSTART) {
                 auto fip = funstart;
                 fip++;  // definedfunction
@@ -217,7 +251,8 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
                 }
                 // FIXME: don't emit array.
                 // (there may be functions that don't use regs yet still refer to sp?)
-                append(sd, "    Value regs[", std::max(1, regs_max), "];\n");
+                numregs = std::max(1, regs_max);
+                append(sd, "    Value regs[", numregs, "];\n");
                 if (!regs_max) append(sd, "    (void)regs;\n");
                 if (nkeepvars) append(sd, "    Value keepvar[", nkeepvars, "];\n");
                 if (numlocals) append(sd, "    Value locals[", numlocals, "];\n");
@@ -225,7 +260,22 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
                 // Final program return at most 1 value.
                 append(sd, "    Value regs[1];\n");
             }
-            if (opc == IL_FUNSTART) {
+            if (osr_block >= 0) {
+                // Entered from the interpreter at a loop, continue with its state.
+                auto copy = [&](string_view to, string_view from, int n) {
+                    if (n) append(sd, "    for (int i = 0; i < ", n, "; i++) ", to, "[i] = ", from, "[i];\n");
+                };
+                copy("regs", "oregs", numregs);
+                copy("locals", "olocals", numlocals);
+                copy("keepvar", "okeepvar", nkeepvars);
+                if (opc == IL_FUNSTART && runtime_checks >= RUNTIME_ASSERT_PLUS) {
+                    append(sd, "    PopFunId(vm);\n");
+                    append(sd, "    PushFunId(vm, funinfo_table + ", funstarttables.size(), ", ",
+                           numlocals ? "locals" : "0", ");\n");
+                    funstarttables.insert(funstarttables.end(), funstart, funstartend);
+                }
+                append(sd, "    goto block", osr_block, ";\n");
+            } else if (opc == IL_FUNSTART) {
                 auto fip = funstart;
                 fip++;  // definedfunction
                 fip++;  // regs_max.
@@ -326,7 +376,7 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
                     append(sd, "{ int top = GetTypeSwitchID(vm, regs[", regso - 1, "], ", args[0],
                                "); switch (top) {");
                 }
-                jumptables.push_back(args + 1);
+                jumptables.push_back({ opc, args + 1 });
                 break;
             case IL_JUMP_TABLE:
                 if (cpp) {
@@ -334,20 +384,57 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
                 } else {
                     append(sd, "{ long long top = regs[", regso - 1, "].ival; switch (top) {");
                 }
-                jumptables.push_back(args);
+                jumptables.push_back({ opc, args });
+                break;
+            case IL_JUMP_TABLE_SPARSE:
+                // Leave it to the C compiler to pick between binary search, jump tables etc.
+                if (cpp) {
+                    append(sd, "switch (regs[", regso - 1, "].ival()) {");
+                } else {
+                    append(sd, "{ long long top = regs[", regso - 1, "].ival; switch (top) {");
+                }
+                jumptables.push_back({ opc, args });
+                break;
+            case IL_JUMP_TABLE_STRING:
+                // Table needs to be available at runtime, but there is no guarantee the bytecode
+                // still is, so make a copy.
+                append(sd, "{ static const int strtable[] = {");
+                for (auto t = args; t < ip; t++) append(sd, " ", *t, ",");
+                append(sd, " }; switch (GetStringSwitchID(vm, regs[", regso - 1, "], strtable)) {");
+                jumptables.push_back({ opc, args });
                 break;
             case IL_JUMP_TABLE_CASE_START: {
-                auto t = jumptables.back();
-                auto mini = *t++;
-                auto maxi = *t++;
-                for (auto i = mini; i <= maxi; i++) {
-                    if (*t++ == id) append(sd, "case ", i, ":");
+                auto [jtopc, t] = jumptables.back();
+                if (jtopc == IL_JUMP_TABLE_SPARSE) {
+                    auto n = *t++;
+                    auto targets = t + n;
+                    for (int i = 0; i < n; i++) {
+                        if (targets[i] == id) append(sd, "case ", t[i], ":");
+                    }
+                    if (targets[n] == id) append(sd, "default:");
+                } else if (jtopc == IL_JUMP_TABLE_STRING) {
+                    // GetStringSwitchID returns the target directly.
+                    t++;  // owned.
+                    auto n = *t++;
+                    for (int i = 0; i < n; i++) {
+                        if (t[i * 4 + 3] == id) {
+                            append(sd, "case ", id, ":");
+                            break;
+                        }
+                    }
+                    if (t[n * 4] == id) append(sd, "default:");
+                } else {
+                    auto mini = *t++;
+                    auto maxi = *t++;
+                    for (auto i = mini; i <= maxi; i++) {
+                        if (*t++ == id) append(sd, "case ", i, ":");
+                    }
+                    if (*t++ == id) append(sd, "default:");
                 }
-                if (*t++ == id) append(sd, "default:");
                 break;
             }
             case IL_JUMP_TABLE_END: {
-                if (cpp) sd += "} // switch";
+                if (cpp && jumptables.back().first != IL_JUMP_TABLE_STRING) sd += "} // switch";
                 else sd += "}} // switch";
                 jumptables.pop_back();
                 break;
@@ -439,10 +526,10 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
                 append(sd, "keepvar[", args[1], "] = TopM(", sp, ", ", args[0], ");");
                 break;
             case IL_PUSHFUN:
-                append(sd, "U_PUSHFUN(vm, ", sp, ", 0, ", "fun_", args[0], ");");
+                append(sd, "U_PUSHFUN(vm, ", sp, ", 0, ", FunValue(args[0]), ");");
                 break;
             case IL_CALL: {
-                append(sd, "fun_", args[0], "(vm, ", sp, ");");
+                append(sd, FunCall(args[0]), "(vm, ", sp, ");");
                 auto fs = code + args[0];
                 assert(*fs == IL_FUNSTART);
                 fs += 2;
@@ -515,36 +602,58 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
                 append(sd, "    PopFunId(vm);\n");
             }
             sd += "}\n";
+            return;
         }
     }
+}
 
+void CGenerator::VTables(string &sd) {
     if (cpp) sd += "\nstatic";
     else sd += "\nextern";
     sd += " const fun_base_t vtables[] = {\n";
     for (auto id : *bcf->vtables()) {
         sd += "    ";
-        if (id >= 0) append(sd, "fun_", id);
+        if (id >= 0) append(sd, lazy ? cat("stub_", fun_index[id]) : cat("fun_", id));
         else if (id <= -2) append(sd, "(fun_base_t)", -id - 2);  // Bit of a hack, would be nice to separate.
         else sd += "0";
         sd += ",\n";
     }
     sd += "    0\n};\n";  // Make sure table is never empty.
+}
+
+void CGenerator::FunInfoTable(string &sd) {
+    append(sd, lazy ? "static " : "", "const int funinfo_table[] = {\n    ");
+    for (auto [i, d] : enumerate(funstarttables)) {
+        if (i && (i & 15) == 0) append(sd, "\n    ");
+        append(sd, d, ", ");
+    }
+    append(sd, "    0\n};\n\n");
+}
 
+string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bool cpp,
+             int runtime_checks, string_view custom_pre_init_name) {
+    CGenerator gen(natreg, bytecode_buffer, cpp, runtime_checks, false);
+    auto err = gen.Init();
+    if (!err.empty()) return err;
+    gen.Prelude(sd);
     if (runtime_checks >= RUNTIME_ASSERT_PLUS) {
-        append(sd, "const int funinfo_table[] = {\n    ");
-        for (auto [i, d] : enumerate(funstarttables)) {
-            if (i && (i & 15) == 0) append(sd, "\n    ");
-            append(sd, d, ", ");
-        }
-        append(sd, "    0\n};\n\n");
+        append(sd, "extern const int funinfo_table[];\n\n");
     }
+    for (auto id : gen.fun_ids) {
+        append(sd, "static void fun_", id, "(VMRef, StackPtr);\n");
+    }
+    sd += "\n";
+    auto ip = gen.code + 3;  // Past first IL_JUMP.
+    while (ip < gen.code + gen.len) gen.Function(sd, ip);
+    gen.VTables(sd);
+    if (runtime_checks >= RUNTIME_ASSERT_PLUS) gen.FunInfoTable(sd);
 
     if (cpp) {
         // Output only the metadata part of the bytecode, not the bytecode itself.
         // TODO: it be nice if this metadate were in readable format in the generated code.
         sd += "\nstatic const int bytecodefb[] = {";
         auto bytecode_ints = (const int *)bytecode_buffer.data();
-        for (size_t i = 0; i < size_t(code - bytecode_ints); i++) {
+        for (size_t i = 0; i < size_t(gen.code - bytecode_ints); i++) {
             if ((i & 0xF) == 0) sd += "\n ";
             auto x = bytecode_ints[i];
             sd += " ";
@@ -561,7 +670,7 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
     if (cpp) sd += "extern \"C\" ";
     sd += "void compiled_entry_point(VMRef vm, StackPtr sp) {\n";
     if (!cpp) sd += "    Entry(sizeof(Value));\n";
-    append(sd, "    fun_", starting_point, "(vm, sp);\n}\n\n");
+    append(sd, "    fun_", gen.starting_point, "(vm, sp);\n}\n\n");
     if (cpp) {
         sd += "int main(int argc, char *argv[]) {\n";
         sd += "    // This is hard-coded to call compiled_entry_point()\n";
@@ -573,5 +682,41 @@ string ToCPP(NativeRegistry &natreg, string &sd, string_view bytecode_buffer, bo
     return "";
 }
 
-}  // namespace lobster
+// The main unit of the lazy JIT has a stub for each function, which compiles it on first call
+// and patches funtab, through which all direct calls go. Function values and vtables always
+// refer to the stub, which then just forwards. LazyCompile may also have run the call itself (in
+// the interpreter), in which case it returns nullptr.
+string ToCLazyMain(CGenerator &gen, string &sd) {
+    auto err = gen.Init();
+    if (!err.empty()) return err;
+    string stubs;
+    for (auto [i, id] : enumerate(gen.fun_ids)) {
+        append(stubs, "static void stub_", i, "(VMRef vm, StackPtr sp) { fun_base_t f = funtab[", i,
+               "]; if (f == stub_", i, " && !(f = LazyCompile(vm, &lazy_context, ", i,
+               ", sp))) return; f(vm, sp); }\n");
+    }
+    gen.VTables(stubs);
+    stubs += "const fun_base_t lazy_stubs[] = {\n";
+    for (size_t i = 0; i < gen.fun_ids.size(); i++) append(stubs, "    stub_", i, ",\n");
+    stubs += "    0\n};\n\n";
+    stubs += "void compiled_entry_point(VMRef vm, StackPtr sp) {\n";
+    stubs += "    Entry(sizeof(Value));\n";
+    append(stubs, "    ", gen.FunCall(gen.starting_point), "(vm, sp);\n}\n");
+    gen.Prelude(sd, stubs);
+    sd += stubs;
+    return "";
+}
 
+void ToCLazyFunction(CGenerator &gen, string &sd, int fun_idx, int osr_block) {
+    gen.funstarttables.clear();
+    string body;
+    auto ip = gen.code + gen.fun_ids[fun_idx];
+    gen.osr_block = osr_block;
+    gen.Function(body, ip);
+    gen.osr_block = -1;
+    gen.Prelude(sd, body);
+    if (gen.runtime_checks >= RUNTIME_ASSERT_PLUS) gen.FunInfoTable(sd);
+    sd += body;
+}
+
+}  // namespace lobster
@@ -278,8 +278,10 @@ LVector *VM::NewVec(iint initial, iint max, type_elem_t tti) {
 }
 
 LObject *VM::NewObject(iint max, type_elem_t tti) {
-    assert(IsUDT(GetTypeInfo(tti).t));
-    auto s = new (pool.alloc(ssizeof<LObject>() + ssizeof<Value>() * max)) LObject(tti);
+    auto &ti = GetTypeInfo(tti);
+    assert(IsUDT(ti.t));
+    auto size = ti.packed_size ? ti.ObjectBytes() : ssizeof<Value>() * max;
+    auto s = new (pool.alloc(ssizeof<LObject>() + size)) LObject(tti);
     OnAlloc(s);
     return s;
 }
@@ -614,6 +616,11 @@ void VM::IDXErr(iint i, iint n, const RefObj *v) {
     Error(sd);
 }
 
+void VM::NarrowErr(Value v, int storage) {
+    static const char *names[] = { "", "int8", "int16", "int32", "float32" };
+    Error(cat("value ", v.ival(), " does not fit in ", names[storage & 7], " field"));
+}
+
 string_view VM::StructName(const TypeInfo &ti) {
     return bcf->udts()->Get(ti.structidx)->name()->string_view();
 }
@@ -700,6 +707,8 @@ void VM::StartWorkers(iint numthreads) {
     // Stop bad values from locking up the machine :)
     numthreads = std::min(numthreads, 256_L64);
     tuple_space = new TupleSpace(bcf->udts()->size());
+    // Each worker gets its own random stream, deterministically derived from ours.
+    auto worker_rndx = rndx;
     for (iint i = 0; i < numthreads; i++) {
         // Create a new VM that should own all its own memory and be completely independent
         // from this one.
@@ -711,6 +720,9 @@ void VM::StartWorkers(iint numthreads) {
         auto vma = new VMAllocator(std::move(vmargs));
         vma->vm->is_worker = true;
         vma->vm->tuple_space = tuple_space;
+        worker_rndx.jump();
+        vma->vm->rndx = worker_rndx;
+        vma->vm->rndm.seed((uint32_t)i + 1);
         workers.emplace_back([vma] {
             string err;
             #ifdef USE_EXCEPTION_HANDLING
@@ -753,7 +765,7 @@ void VM::WorkerWrite(RefObj *ref) {
         // FIXME: lift this restriction.
         if (IsRefNil(GetTypeInfo(ti.elemtypes[i].type).t))
             Error("thread write: only scalar class members supported for now");
-        buf[i] = st->AtS(i);
+        buf[i] = st->GetSlot(ti, i);
     }
     auto &tt = tuple_space->tupletypes[ti.structidx];
     {
@@ -778,7 +790,7 @@ LObject *VM::WorkerRead(type_elem_t tti) {
     }
     if (!buf) return nullptr;
     auto ns = NewObject(ti.len, tti);
-    ns->CopyElemsShallow(buf, ti.len);
+    ns->InitSlots(*this, ti, buf);
     free(buf);
     return ns;
 }
@@ -856,6 +868,7 @@ StackPtr CVM_PopArg(VM *vm, int i, StackPtr psp) { return PopArg(*vm, i, psp); }
 void CVM_SetLVal(VM *vm, Value *v) { SetLVal(*vm, v); }
 int CVM_RetSlots(VM *vm) { return RetSlots(*vm); }
 int CVM_GetTypeSwitchID(VM *vm, Value self, int vtable_idx) { return GetTypeSwitchID(*vm, self, vtable_idx); }
+int CVM_GetStringSwitchID(VM *vm, Value self, const int *table) { return GetStringSwitchID(*vm, self, table); }
 void CVM_PushFunId(VM *vm, const int *id, StackPtr locals) { PushFunId(*vm, id, locals); }
 void CVM_PopFunId(VM *vm) { PopFunId(*vm); }
 #if LOBSTER_FRAME_PROFILER
@@ -921,6 +934,7 @@ const void *vm_ops_jit_table[] = {
     "SetLVal", (void *)CVM_SetLVal,
     "RetSlots", (void *)CVM_RetSlots,
     "GetTypeSwitchID", (void *)CVM_GetTypeSwitchID,
+    "GetStringSwitchID", (void *)CVM_GetStringSwitchID,
     "PushFunId", (void *)CVM_PushFunId,
     "PopFunId", (void *)CVM_PopFunId,
     #if LOBSTER_ENGINE
@@ -78,14 +78,49 @@ LVector::LVector(VM &vm, iint _initial, iint _max, type_elem_t _tti)
 }
 
 void LVector::Resize(VM &vm, iint newmax) {
+    if (front >= len && front + maxl >= newmax) {
+        // At least as many elements were removed from the front as are left (i.e. it is used as
+        // a queue), so sliding them back to the start of the buffer is cheap enough.
+        auto base = v - front * width;
+        t_memmove(base, v, len * width);
+        v = base;
+        maxl += front;
+        front = 0;
+        return;
+    }
     // FIXME: check overflow
     auto mem = AllocSubBuf<Value>(vm, newmax * width, TYPE_ELEM_VALUEBUF);
     if (len) t_memcpy(mem, v, len * width);
     DeallocBuf(vm);
     maxl = newmax;
+    front = 0;
     v = mem;
 }
 
+// Makes room to insert before the first element, as much as there are elements already,
+// such that repeatedly inserting at the front is amortized O(1).
+void LVector::GrowFront(VM &vm) {
+    auto newfront = std::max(len, iint(4));
+    auto mem = AllocSubBuf<Value>(vm, (newfront + maxl) * width, TYPE_ELEM_VALUEBUF);
+    if (len) t_memcpy(mem + newfront * width, v, len * width);
+    DeallocBuf(vm);
+    front = newfront;
+    v = mem + newfront * width;
+}
+
+// Closes the gap of n elements at i, moving whichever side of it is smaller.
+void LVector::RemoveGap(iint i, iint n) {
+    if (i < len - i - n) {
+        t_memmove(v + n * width, v, i * width);
+        v += n * width;
+        front += n;
+        maxl -= n;
+    } else {
+        t_memmove(v + i * width, v + (i + n) * width, (len - i - n) * width);
+    }
+    len -= n;
+}
+
 void LVector::Append(VM &vm, LVector *from, iint start, iint amount) {
     if (len + amount > maxl) Resize(vm, std::max(len + amount, maxl * 2));  // FIXME: check overflow
     assert(width == from->width);
@@ -98,15 +133,13 @@ void LVector::RemovePush(StackPtr &sp, iint i) {
     assert(len >= 1 && i >= 0 && i < len);
     tsnz_memcpy(TopPtr(sp), v + i * width, width);
     PushN(sp, (int)width);
-    t_memmove(v + i * width, v + (i + 1) * width, (len - i - 1) * width);
-    len--;
+    RemoveGap(i, 1);
 }
 
 void LVector::Remove(VM &vm, iint i, iint n) {
     assert(n >= 0 && n <= len && i >= 0 && i <= len - n);
     DestructElementRange(vm, i, i + n);
-    t_memmove(v + i * width, v + (i + n) * width, (len - i - n) * width);
-    len -= n;
+    RemoveGap(i, n);
 }
 
 void LVector::AtVW(StackPtr &sp, iint i) const {
@@ -175,11 +208,40 @@ void LVector::DeleteSelf(VM &vm) {
 }
 
 void LObject::DeleteSelf(VM &vm) {
-    auto len = Len(vm);
-    for (iint i = 0; i < len; i++) {
-        AtS(i).LTDECTYPE(vm, ElemTypeS(vm, i).t);
+    auto &sti = ti(vm);
+    for (iint i = 0; i < sti.len; i++) {
+        auto et = ElemTypeS(vm, i).t;
+        if (IsRefNil(et)) RefSlot(sti, i).LTDECTYPE(vm, et);
     }
-    vm.pool.dealloc(this, ssizeof<LObject>() + ssizeof<Value>() * len);
+    vm.pool.dealloc(this, ssizeof<LObject>() + sti.ObjectBytes());
+}
+
+Value LObject::GetSlot(const TypeInfo &sti, iint i) const {
+    auto storage = sti.elemtypes[i].storage;
+    return LoadField(Bytes() + FieldOffset(storage), storage & 7);
+}
+
+void LObject::SetSlot(VM &vm, const TypeInfo &sti, iint i, Value v) {
+    auto storage = sti.elemtypes[i].storage;
+    if (!StoreField(Bytes() + FieldOffset(storage), storage & 7, v) &&
+        vm.runtime_checks >= RUNTIME_ASSERT) {
+        vm.NarrowErr(v, storage);
+    }
+}
+
+void LObject::InitSlots(VM &vm, const TypeInfo &sti, const Value *from) {
+    if (!sti.packed_size) {
+        t_memcpy(Elems(), from, sti.len);
+        return;
+    }
+    for (iint i = 0; i < sti.len; i++) SetSlot(vm, sti, i, from[i]);
+}
+
+const Value *LObject::ElemsUnpacked(const TypeInfo &sti, vector<Value> &buf) const {
+    if (!sti.packed_size) return Elems();
+    buf.resize(sti.len);
+    for (iint i = 0; i < sti.len; i++) buf[i] = GetSlot(sti, i);
+    return buf.data();
 }
 
 void LResource::DeleteSelf(VM &vm) {
@@ -433,10 +495,11 @@ Value Value::CopyRef(VM &vm, iint depth) {
             return Value(nv);
         }
         case V_CLASS: {
-            auto len = oval()->Len(vm);
+            auto &sti = oval()->ti(vm);
+            auto len = sti.len;
             auto nv = vm.NewObject(len, oval()->tti);
             if (len) {
-                nv->CopyElemsShallow(oval()->Elems(), len);
+                memcpy(nv->Bytes(), oval()->Bytes(), sti.ObjectBytes());
                 if (depth) {
                     nv->CopyRefElemsDeep(vm, len, depth);
                 } else {
@@ -464,8 +527,11 @@ string TypeInfo::Debug(VM &vm, bool rec) const {
         string s = string(vm.StructName(*this));
         if (rec) {
             s += "{";
-            for (int i = 0; i < len; i++)
-                s += vm.GetTypeInfo(elemtypes[i].type).Debug(vm, false) + ",";
+            for (int i = 0; i < len; i++) {
+                s += vm.GetTypeInfo(elemtypes[i].type).Debug(vm, false);
+                if (packed_size) append(s, "@", elemtypes[i].storage >> 3);
+                s += ",";
+            }
             s += "}";
         }
         return s;
@@ -564,10 +630,12 @@ void VectorOrObjectToString(VM &vm, string &sd, PrintPrefs &pp, char openb, char
 
 void LObject::ToString(VM &vm, string &sd, PrintPrefs &pp) {
     if (CycleCheck(sd, pp)) return;
-    auto name = vm.ReverseLookupType(ti(vm).structidx);
+    auto &sti = ti(vm);
+    auto name = vm.ReverseLookupType(sti.structidx);
     sd += name;
     if (pp.indent) sd += ' ';
-    VectorOrObjectToString(vm, sd, pp, '{', '}', Len(vm), 1, Elems(), false,
+    vector<Value> buf;
+    VectorOrObjectToString(vm, sd, pp, '{', '}', sti.len, 1, ElemsUnpacked(sti, buf), false,
         [&](iint i) -> const TypeInfo & {
             return ElemTypeSP(vm, i);
         }
@@ -639,10 +707,12 @@ void LObject::ToFlexBuffer(ToFlexBufferContext &fbc) {
         fbc.builder.Key("_type");
         fbc.builder.String(type_name.data(), type_name.size());
     }
+    vector<Value> buf;
+    auto elems = ElemsUnpacked(stti, buf);
     for (iint i = 0, f = 0; i < stti.len; i++, f++) {
         auto &eti = ElemTypeSP(fbc.vm, i);
         auto fname = fbc.vm.LookupField(stidx, f);
-        ElemToFlexBuffer(fbc, eti, i, 1, Elems(), fname, stti.elemtypes[i].defval);
+        ElemToFlexBuffer(fbc, eti, i, 1, elems, fname, stti.elemtypes[i].defval);
     }
     fbc.builder.EndMap(start);
 }
@@ -687,9 +757,11 @@ void LObject::ToLobsterBinary(VM &vm, vector<uint8_t> &buf) {
         vm.Error("cannot serialize (missing serializable attribute): " + vm.StructName(stti));
     }
     EncodeVarintU(stti.serializable_id, buf);
+    vector<Value> ubuf;
+    auto elems = ElemsUnpacked(stti, ubuf);
     for (iint i = 0; i < stti.len; i++) {
         auto &eti = ElemTypeSP(vm, i);
-        ElemToLobsterBinary(vm, buf, eti, i, 1, Elems(), true);
+        ElemToLobsterBinary(vm, buf, eti, i, 1, elems, true);
     }
 }
 